@@ -4,18 +4,51 @@
 #include <iostream>
 #include <vector>
 #include <string>
-#include <sstream>
-#include <fstream>
 #include <algorithm>
+#include <cstdint>
 #include <filesystem>
+#include <limits>
+#include <memory>
 #include <gmpxx.h>
+#include "frac_parser.h"
+#include "program_cache.h"
 
 namespace fs = std::filesystem;
 
 struct FractranConfig {
     std::vector<mpq_class> program;
     mpz_class input;
-    int steps = 1000;
+    std::uint64_t steps = 1000;
+    std::string engine = "gmp"; // "gmp", "registers" or "batch" (sweeps only)
+    std::string match = "indexed"; // register engine: "linear", "indexed" or "simd"
+    bool history = true;           // record every state for printing
+    bool accelerate = false;       // register engine: collapse repeating fraction cycles
+    unsigned cacheBlock = 0;       // register engine: macro-step cache block size, 0 = off
+    bool detectCycles = false;     // register engine: stop when the state repeats
+    bool jit = false;              // register engine: run on natively compiled code
+    bool stats = false;            // gmp engine: collect and print run statistics
+    bool optimize = false;         // rewrite the program before running it (program_optimizer.h)
+    std::vector<std::vector<mpz_class>> fusedChains; // set by --optimize for the gmp engine
+    bool programCache = true;      // file mode: load through the .fracc next to the .frac, refreshing it
+    std::shared_ptr<const RegisterProgram> factored; // from the program cache; null or matching `program`
+    std::string tracePath;         // stream steps to this binary trace file (turns history off)
+    unsigned sparseHistory = 0;    // gmp engine: checkpoint interval of sparse history, 0 = off
+    std::string checkpointPath;    // save a resumable snapshot here while running
+    std::uint64_t checkpointEvery = 1000000; // steps between snapshots
+    double deadlineSeconds = 0;    // stop after this much wall-clock time, 0 = no deadline
+    std::string stopKind;          // --stop-at: "pow" or "fraction", empty = none
+    unsigned long stopValue = 0;   // --stop-at: the prime P or the fraction index J
+    std::uint64_t stopCount = 1;   // --stop-at: stop at the N-th match
+    unsigned long observePrime = 0; // print every state that is a power of this prime, 0 = off
+    bool primes = false;           // stream the exponent of every power of 2 as it appears (turns history off)
+    std::string notation = "decimal"; // states: "decimal", "factored" (2^3 * 5) or "binary" (FRSTATE1 on stdout)
+    bool limbPool = false;         // GMP allocates through limb_pool.h (installed by main before parsing)
+    std::string resumePath;        // continue from this snapshot (missing file = fresh start)
+    std::string sweepRange;        // "FROM..TO": run every input in the range instead of one
+    std::string sweepFile;         // run every input listed in this file, one per line
+    unsigned threads = 0;          // sweep workers, 0 = one per core
+    std::string outputPath;        // sweep results go here instead of stdout
+    std::string format = "csv";    // sweep results: "csv" or "binary"
     bool success = true;
     std::string errorMessage;
 };
@@ -29,41 +62,244 @@ inline bool hasSuffix(const std::string& str, const std::string& suffix) {
            str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
 }
 
-// UPDATED: Now accepts out_steps by reference
-inline bool parseFileContent(const std::string& filepath, std::vector<mpq_class>& out_prog, std::string& out_input, int& out_steps) {
-    std::ifstream file(filepath);
-    if (!file.is_open()) return false;
-
-    std::string line;
-    while (std::getline(file, line)) {
-        size_t comment_pos = line.find('#');
-        if (comment_pos != std::string::npos) {
-            line = line.substr(0, comment_pos);
-        }
+// Step counts are 64-bit. False unless s is a decimal that fits.
+inline bool parseCount(const std::string& s, std::uint64_t& out) {
+    if (!isInteger(s) || s.size() > 20) return false;
+    try {
+        out = std::stoull(s);
+    } catch (...) {
+        return false;
+    }
+    return true;
+}
 
-        std::stringstream ss(line);
-        std::string segment;
-        while (ss >> segment) {
-            if (segment == "Input:") {
-                if (ss >> segment) out_input = segment;
-            } else if (segment == "Steps:") { // NEW: Parse Steps from file
-                if (ss >> segment && isInteger(segment)) {
-                     try { out_steps = std::stoi(segment); } catch(...) {}
-                }
-            } else {
-                try {
-                    mpq_class frac(segment);
-                    if (frac.get_den() != 0) out_prog.push_back(frac);
-                } catch (...) { }
+// Reads a .frac file (frac_parser.h). On a syntax error returns false with
+// every problem found, "file:line:column: message", one per line.
+inline bool parseFileContent(const std::string& filepath, std::vector<mpq_class>& out_prog, std::string& out_input,
+                             std::uint64_t& out_steps, std::string* out_error = nullptr) {
+    FracFile file;
+    if (!loadFracFile(filepath, file)) {
+        if (out_error) *out_error = "Failed to read file: " + filepath;
+        return false;
+    }
+    if (!file.ok()) {
+        if (out_error) {
+            out_error->clear();
+            for (const auto& error : file.errors) {
+                if (!out_error->empty()) *out_error += "\n";
+                *out_error += error.describe(filepath);
             }
         }
+        return false;
+    }
+    if (out_prog.empty()) {
+        out_prog = std::move(file.fractions);
+    } else {
+        out_prog.insert(out_prog.end(), file.fractions.begin(), file.fractions.end());
     }
+    if (!file.input.empty()) out_input = file.input;
+    if (file.steps > 0) out_steps = file.steps;
     return true;
 }
 
-inline FractranConfig parseFractranArgs(const std::vector<std::string>& args) {
+// Handles a single "--name=value" option. Returns false on unknown options or values.
+inline bool parseOption(const std::string& arg, FractranConfig& config) {
+    size_t eq = arg.find('=');
+    std::string name = arg.substr(0, eq);
+    std::string value = (eq == std::string::npos) ? "" : arg.substr(eq + 1);
+
+    if (name == "--engine") {
+        if (value != "gmp" && value != "registers" && value != "batch") return false;
+        config.engine = value;
+        return true;
+    }
+    if (name == "--no-history" && value.empty()) {
+        config.history = false;
+        return true;
+    }
+    if (name == "--accelerate" && value.empty()) {
+        config.accelerate = true;
+        return true;
+    }
+    if (name == "--trace") {
+        if (value.empty()) return false;
+        config.tracePath = value;
+        config.history = false;
+        return true;
+    }
+    if (name == "--sparse-history") {
+        if (!isInteger(value) || value.size() > 9 || std::stoul(value) == 0) return false;
+        config.sparseHistory = static_cast<unsigned>(std::stoul(value));
+        return true;
+    }
+    if (name == "--checkpoint") {
+        if (value.empty()) return false;
+        config.checkpointPath = value;
+        return true;
+    }
+    if (name == "--checkpoint-every") {
+        return parseCount(value, config.checkpointEvery) && config.checkpointEvery > 0;
+    }
+    if (name == "--resume") {
+        if (value.empty()) return false;
+        config.resumePath = value;
+        return true;
+    }
+    if (name == "--sweep") {
+        size_t dots = value.find("..");
+        if (dots == std::string::npos || !isInteger(value.substr(0, dots)) || !isInteger(value.substr(dots + 2))) {
+            return false;
+        }
+        mpz_class count = mpz_class(value.substr(dots + 2)) - mpz_class(value.substr(0, dots)) + 1;
+        if (count <= 0 || !count.fits_ulong_p()) return false;
+        config.sweepRange = value;
+        return true;
+    }
+    if (name == "--sweep-file") {
+        if (value.empty()) return false;
+        config.sweepFile = value;
+        return true;
+    }
+    if (name == "--threads") {
+        if (!isInteger(value) || value.size() > 4) return false;
+        config.threads = static_cast<unsigned>(std::stoul(value));
+        return true;
+    }
+    if (name == "--output") {
+        if (value.empty()) return false;
+        config.outputPath = value;
+        return true;
+    }
+    if (name == "--format") {
+        if (value != "csv" && value != "binary") return false;
+        config.format = value;
+        return true;
+    }
+    if (name == "--stats" && value.empty()) {
+        config.stats = true;
+        return true;
+    }
+    if (name == "--no-program-cache" && value.empty()) {
+        config.programCache = false;
+        return true;
+    }
+    if (name == "--optimize" && value.empty()) {
+        config.optimize = true;
+        return true;
+    }
+    if (name == "--jit" && value.empty()) {
+        config.jit = true;
+        return true;
+    }
+    if (name == "--detect-cycles" && value.empty()) {
+        config.detectCycles = true;
+        return true;
+    }
+    if (name == "--cache") {
+        if (value.empty()) value = "16";
+        if (!isInteger(value) || value.size() > 9 || std::stoul(value) == 0) return false;
+        config.cacheBlock = static_cast<unsigned>(std::stoul(value));
+        return true;
+    }
+    if (name == "--deadline") {
+        // Seconds, fractions allowed: "30", "0.5".
+        if (value.empty() || value.find_first_not_of("0123456789.") != std::string::npos ||
+            std::count(value.begin(), value.end(), '.') > 1 || value == ".") {
+            return false;
+        }
+        config.deadlineSeconds = std::stod(value);
+        return config.deadlineSeconds > 0;
+    }
+    if (name == "--stop-at") {
+        // pow:P[:N] stops at the N-th state that is a power of the prime P,
+        // fraction:J[:N] once fraction J (counting from 0) has fired N times.
+        size_t colon = value.find(':');
+        if (colon == std::string::npos) return false;
+        std::string kind = value.substr(0, colon);
+        std::string rest = value.substr(colon + 1);
+        size_t second = rest.find(':');
+        std::uint64_t target = 0, count = 1;
+        if (!parseCount(rest.substr(0, second), target)) return false;
+        if (second != std::string::npos && (!parseCount(rest.substr(second + 1), count) || count == 0)) return false;
+        if (kind == "pow") {
+            if (target < 2 || mpz_probab_prime_p(mpz_class(std::to_string(target)).get_mpz_t(), 25) == 0) return false;
+        } else if (kind != "fraction") {
+            return false;
+        }
+        if (target > std::numeric_limits<unsigned long>::max()) return false;
+        config.stopKind = kind;
+        config.stopValue = static_cast<unsigned long>(target);
+        config.stopCount = count;
+        return true;
+    }
+    if (name == "--observe") {
+        std::uint64_t prime = 0;
+        if (value.rfind("pow:", 0) != 0 || !parseCount(value.substr(4), prime) || prime < 2 ||
+            prime > std::numeric_limits<unsigned long>::max() ||
+            mpz_probab_prime_p(mpz_class(std::to_string(prime)).get_mpz_t(), 25) == 0) {
+            return false;
+        }
+        config.observePrime = static_cast<unsigned long>(prime);
+        return true;
+    }
+    if (name == "--primes" && value.empty()) {
+        config.primes = true;
+        config.history = false;
+        return true;
+    }
+    if (name == "--limb-pool" && value.empty()) {
+        config.limbPool = true;
+        return true;
+    }
+    if (name == "--notation") {
+        if (value != "decimal" && value != "factored" && value != "binary") return false;
+        config.notation = value;
+        return true;
+    }
+    if (name == "--match") {
+        if (value != "linear" && value != "indexed" && value != "simd") return false;
+        config.match = value;
+        return true;
+    }
+    return false;
+}
+
+inline FractranConfig parseFractranArgs(const std::vector<std::string>& raw_args) {
     FractranConfig config;
-    
+
+    // Options may appear anywhere; strip them before the positional logic below.
+    std::vector<std::string> args;
+    for (const auto& arg : raw_args) {
+        if (arg.rfind("--", 0) == 0) {
+            if (!parseOption(arg, config)) {
+                config.success = false;
+                config.errorMessage = "Unknown option: " + arg;
+                return config;
+            }
+        } else {
+            args.push_back(arg);
+        }
+    }
+
+    // These only exist on one engine; elsewhere they would be silently ignored.
+    if (config.engine != "registers") {
+        std::string option = config.detectCycles ? "--detect-cycles" : config.accelerate ? "--accelerate"
+                             : config.cacheBlock > 0 ? "--cache" : config.jit ? "--jit" : "";
+        if (!option.empty()) {
+            config.success = false;
+            config.errorMessage = option + " needs --engine=registers";
+            return config;
+        }
+    }
+    if (config.engine != "gmp") {
+        std::string option = config.sparseHistory > 0 ? "--sparse-history" : config.stats ? "--stats" : "";
+        if (!option.empty()) {
+            config.success = false;
+            config.errorMessage = option + " needs --engine=gmp";
+            return config;
+        }
+    }
+
     if (args.empty()) {
         config.success = false;
         config.errorMessage = "No arguments provided.";
@@ -72,11 +308,23 @@ inline FractranConfig parseFractranArgs(const std::vector<std::string>& args) {
 
     std::string input_str;
     bool steps_set_by_cli = false;
+    bool sweeping = !config.sweepRange.empty() || !config.sweepFile.empty();
+    if (sweeping) {
+        // The sweep supplies the inputs, so a lone integer is the step budget.
+        input_str = "0";
+    }
     std::string target_file;
-    int file_steps = -1; // Sentinel value
+    std::uint64_t file_steps = 0; // 0 = not given
+    // A step count that does not fit 64 bits is an error, not the default budget.
+    auto setSteps = [&](const std::string& arg) {
+        if (parseCount(arg, config.steps)) return true;
+        config.success = false;
+        config.errorMessage = "Invalid step count: " + arg;
+        return false;
+    };
 
-    // Strategy 1: Check for .frac File
-    if (hasSuffix(args[0], ".frac") && fs::exists(args[0])) {
+    // Strategy 1: Check for .frac File (or its compiled .fracc)
+    if ((hasSuffix(args[0], ".frac") || hasSuffix(args[0], ".fracc")) && fs::exists(args[0])) {
         target_file = args[0];
     } else if (fs::exists(args[0] + ".frac")) {
         target_file = args[0] + ".frac";
@@ -84,11 +332,17 @@ inline FractranConfig parseFractranArgs(const std::vector<std::string>& args) {
 
     if (!target_file.empty()) {
         // --- FILE MODE ---
-        if (!parseFileContent(target_file, config.program, input_str, file_steps)) {
+        CompiledProgram compiled;
+        // Only the register and batch engines need the program factored.
+        if (!loadCompiledProgram(target_file, compiled, config.errorMessage, config.programCache,
+                                 config.engine != "gmp")) {
             config.success = false;
-            config.errorMessage = "Failed to read file: " + target_file;
             return config;
         }
+        config.program = std::move(compiled.fractions);
+        config.factored = std::move(compiled.factored);
+        if (!compiled.input.empty()) input_str = compiled.input;
+        file_steps = compiled.steps;
 
         // Apply file steps if found (can be overridden later by CLI)
         if (file_steps > 0) {
@@ -108,7 +362,7 @@ inline FractranConfig parseFractranArgs(const std::vector<std::string>& args) {
                          input_str = arg; // Override Input
                          next_arg_idx++;
                     } else {
-                         config.steps = std::stoi(arg); // Override Steps
+                         if (!setSteps(arg)) return config; // Override Steps
                          steps_set_by_cli = true;
                          next_arg_idx++;
                     }
@@ -119,7 +373,7 @@ inline FractranConfig parseFractranArgs(const std::vector<std::string>& args) {
         // Final check for steps override
         if (!steps_set_by_cli && next_arg_idx < args.size()) {
              if(isInteger(args[next_arg_idx])) {
-                 config.steps = std::stoi(args[next_arg_idx]);
+                 if (!setSteps(args[next_arg_idx])) return config;
              }
         }
 
@@ -136,7 +390,7 @@ inline FractranConfig parseFractranArgs(const std::vector<std::string>& args) {
                 if (input_str.empty()) {
                     input_str = arg;
                 } else if (!steps_set_by_cli) {
-                    config.steps = std::stoi(arg);
+                    if (!setSteps(arg)) return config;
                     steps_set_by_cli = true;
                 }
             }
@@ -0,0 +1,462 @@
+#ifndef BATCH_FRACTRAN_H
+#define BATCH_FRACTRAN_H
+
+#include <gmpxx.h>
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+#include "binary_io.h"
+#include "register_fractran.h"
+#include "register_program.h"
+#include "simd_match.h"
+#include "snapshot.h"
+
+// Lane kernels of BatchFractran. Each is one branch-free pass over the lanes,
+// always inlined so that the AVX2 entry points below vectorize them with
+// 256-bit registers and the plain ones with the baseline instruction set.
+namespace batch_detail {
+
+// Masks are 0 or -1 per lane. A lane still searching (and in `narrowed`, if
+// NARROWED) hits if each of the K rows is at least its exponent; hits take
+// fraction `index` and stop searching. Returns the number of hits.
+template <size_t K, bool NARROWED>
+__attribute__((always_inline)) inline std::int32_t matchBody(
+    const std::int32_t* const* rows, const std::int32_t* exps, std::int32_t index,
+    const std::int32_t* __restrict narrowed, std::int32_t* __restrict searching,
+    std::int32_t* __restrict chosen, std::int32_t* __restrict hits, size_t n) {
+    const std::int32_t* r[K > 0 ? K : 1];
+    std::int32_t e[K > 0 ? K : 1];
+    for (size_t k = 0; k < K; ++k) {
+        r[k] = rows[k];
+        e[k] = exps[k];
+    }
+    std::int32_t matched = 0;
+    for (size_t l = 0; l < n; ++l) {
+        std::int32_t hit = NARROWED ? narrowed[l] : searching[l];
+        for (size_t k = 0; k < K; ++k) hit &= -static_cast<std::int32_t>(r[k][l] >= e[k]);
+        hits[l] = hit;
+        chosen[l] = hit ? index : chosen[l];
+        searching[l] &= ~hit;
+        matched -= hit;
+    }
+    return matched;
+}
+
+// row += exp in the lanes of `mask`.
+__attribute__((always_inline)) inline void addBody(std::int32_t* __restrict row, std::int32_t exp,
+                                                   const std::int32_t* __restrict mask, size_t n) {
+    for (size_t l = 0; l < n; ++l) row[l] += mask[l] & exp;
+}
+
+// out = in & (row >= exp).
+__attribute__((always_inline)) inline void narrowBody(const std::int32_t* row, std::int32_t exp,
+                                                      const std::int32_t* in, std::int32_t* out, size_t n) {
+    for (size_t l = 0; l < n; ++l) out[l] = in[l] & -static_cast<std::int32_t>(row[l] >= exp);
+}
+
+template <size_t K, bool NARROWED = false>
+std::int32_t matchLanes(const std::int32_t* const* rows, const std::int32_t* exps, std::int32_t index,
+                        const std::int32_t* narrowed, std::int32_t* searching, std::int32_t* chosen,
+                        std::int32_t* hits, size_t n) {
+    return matchBody<K, NARROWED>(rows, exps, index, narrowed, searching, chosen, hits, n);
+}
+inline void addLanes(std::int32_t* row, std::int32_t exp, const std::int32_t* mask, size_t n) {
+    addBody(row, exp, mask, n);
+}
+inline void narrowLanes(const std::int32_t* row, std::int32_t exp, const std::int32_t* in, std::int32_t* out,
+                        size_t n) {
+    narrowBody(row, exp, in, out, n);
+}
+
+#ifdef FRACTRAN_X86
+template <size_t K, bool NARROWED = false>
+__attribute__((target("avx2"))) std::int32_t matchLanesAvx2(
+    const std::int32_t* const* rows, const std::int32_t* exps, std::int32_t index,
+    const std::int32_t* narrowed, std::int32_t* searching, std::int32_t* chosen,
+    std::int32_t* hits, size_t n) {
+    return matchBody<K, NARROWED>(rows, exps, index, narrowed, searching, chosen, hits, n);
+}
+__attribute__((target("avx2"))) inline void addLanesAvx2(std::int32_t* row, std::int32_t exp,
+                                                         const std::int32_t* mask, size_t n) {
+    addBody(row, exp, mask, n);
+}
+__attribute__((target("avx2"))) inline void narrowLanesAvx2(const std::int32_t* row, std::int32_t exp,
+                                                            const std::int32_t* in, std::int32_t* out, size_t n) {
+    narrowBody(row, exp, in, out, n);
+}
+#endif
+
+} // namespace batch_detail
+
+// Many inputs of one program stepped together. The registers of all machines
+// live in one structure-of-arrays block, one int32 row per register and one
+// lane per machine, so the program is factored once and a step is a few
+// vectorized passes over contiguous rows instead of one dispatch loop per
+// machine.
+//
+// A step tests fraction after fraction against the lanes still searching:
+// one pass compares up to TERMS denominator rows, and the lanes that match
+// take the fraction and have its exponent changes added right away (they no
+// longer search, so later tests ignore them). Once fewer than 1/TAIL of the
+// lanes are left searching, those finish with a scalar scan. Lanes that match
+// nothing have halted and are compacted away by moving the last lane into
+// their slot, so later steps only touch machines that are still running.
+//
+// Exponents are int32 to double the lanes per vector. Every few thousand
+// steps the block is checked for headroom, and a lane that could overflow
+// before the next check is spilled to its own RegisterFractran. Signs are
+// tracked per machine; a machine whose state becomes zero leaves the block,
+// since from then on the first fraction fires forever on a zero state.
+class BatchFractran {
+public:
+    // `factored` as for RegisterFractran.
+    BatchFractran(const std::vector<mpq_class>& fractions, const std::vector<mpz_class>& inputs,
+                  const RegisterProgram* factored = nullptr)
+        : fractionList(fractions) {
+        program = factored ? *factored : buildRegisterProgram(fractions);
+        std::vector<mpz_class> unrepresentable;
+        std::vector<std::int64_t> exps;
+        mpz_class rest;
+        for (const auto& n : inputs) {
+            if (!program.encode(n, exps, rest)) unrepresentable.push_back(n);
+        }
+        if (!unrepresentable.empty()) program = buildRegisterProgram(fractions, unrepresentable);
+        prepare();
+
+        const size_t count = inputs.size();
+        registerCount = program.registerCount();
+        capacity = count;
+        regs.assign(registerCount * capacity, 0);
+        cofactor.resize(count);
+        sign.assign(count, 1);
+        lane.assign(count, NO_LANE);
+        machineOf.resize(count);
+        haltedAt.assign(count, NOT_HALTED);
+        zero.assign(count, false);
+        finalRegisters.resize(count);
+        spilled.resize(count);
+        spillSteps.assign(count, 0);
+
+        for (size_t m = 0; m < count; ++m) {
+            program.encode(inputs[m], exps, cofactor[m]);
+            if (cofactor[m] == 0 && program.fractionCount() > 0) {
+                zero[m] = true;
+                continue;
+            }
+            bool fits = narrow && std::all_of(exps.begin(), exps.end(), [this](std::int64_t e) { return e <= limit; });
+            if (!fits) {
+                spilled[m] = std::make_unique<RegisterFractran>(fractionList, inputs[m], false, &program);
+                continue;
+            }
+            size_t l = live++;
+            lane[m] = l;
+            machineOf[l] = static_cast<std::uint32_t>(m);
+            for (size_t r = 0; r < registerCount; ++r) regs[r * capacity + l] = static_cast<std::int32_t>(exps[r]);
+        }
+        choice.resize(capacity);
+        pending.resize(capacity);
+        hits.resize(capacity);
+        scratch.resize(capacity);
+    }
+
+    // Advances every running machine by up to `steps` steps.
+    void runMachine(std::uint64_t steps);
+
+    size_t size() const { return cofactor.size(); }
+    size_t liveCount() const { return live; }
+    size_t spilledCount() const {
+        return static_cast<size_t>(std::count_if(spilled.begin(), spilled.end(), [](const auto& p) { return p != nullptr; }));
+    }
+
+    bool isHalted(size_t m) const { return spilled[m] ? spilled[m]->isHalted() : haltedAt[m] != NOT_HALTED; }
+    unsigned long long getStepCount(size_t m) const;
+    mpz_class getLastNumber(size_t m) const;
+
+    const RegisterProgram& getProgram() const { return program; }
+
+    // AVX2 kernels are used when the CPU has them; false forces the portable ones.
+    void setVectorized(bool enabled) { avx2 = enabled && SimdMatcher::detect() == SimdMatcher::Kernel::Avx2; }
+
+private:
+    static constexpr unsigned long long NOT_HALTED = ~0ULL;
+    static constexpr size_t NO_LANE = ~size_t(0);
+    static constexpr size_t TERMS = 4;             // denominator rows compared per pass
+    static constexpr size_t TAIL = 16;             // scalar scan below 1/TAIL of the lanes searching
+    static constexpr std::int64_t WIDE = 1 << 30;  // exponents beyond this never enter the block
+
+    void prepare();
+    std::int32_t* row(size_t r) { return &regs[r * capacity]; }
+    size_t matchFraction(size_t f, size_t n);
+    size_t finishLanes(size_t f, size_t n);
+    void compact(size_t n, unsigned long long step);
+    void spillWide(unsigned long long step, std::uint64_t stepsLeft);
+    void retire(size_t l);
+
+    std::vector<mpq_class> fractionList;
+    RegisterProgram program;
+    std::vector<std::vector<std::int32_t>> requireExps; // program.require exponents as int32
+    std::vector<std::vector<std::int32_t>> deltaExps;   // program.delta exponents as int32
+    bool narrow = true;      // every exponent of the program fits comfortably in int32
+    bool signFree = true;    // no negative or zero numerators
+    std::int64_t limit = 0;  // lanes above this may overflow before the next check
+    int checkEvery = 1;      // steps between headroom checks
+    bool avx2 = false;
+
+    size_t registerCount = 0;
+    size_t capacity = 0;
+    size_t live = 0;
+    unsigned long long totalSteps = 0;
+
+    std::vector<std::int32_t> regs;       // [register][lane]
+    std::vector<std::uint32_t> machineOf; // machine in each lane
+    std::vector<std::int32_t> choice;     // per lane: fraction taken this step, -1 for none
+    std::vector<std::int32_t> pending;    // per lane: -1 while still searching
+    std::vector<std::int32_t> hits;       // per lane: -1 if it took the fraction just tested
+    std::vector<std::int32_t> scratch;    // per lane: candidates of a long denominator
+
+    // Per machine, in input order.
+    std::vector<mpz_class> cofactor;
+    std::vector<int> sign;
+    std::vector<size_t> lane;
+    std::vector<unsigned long long> haltedAt;
+    std::vector<bool> zero;
+    std::vector<std::vector<std::int64_t>> finalRegisters;
+    std::vector<std::unique_ptr<RegisterFractran>> spilled; // lanes that outgrew int32
+    std::vector<unsigned long long> spillSteps;             // batch steps taken before spilling
+};
+
+inline void BatchFractran::prepare() {
+    std::int64_t growth = 1;
+    for (size_t f = 0; f < program.fractionCount(); ++f) {
+        std::vector<std::int32_t> require, delta;
+        for (const auto& t : program.require[f]) {
+            narrow = narrow && t.exp <= WIDE;
+            require.push_back(static_cast<std::int32_t>(std::min(t.exp, WIDE)));
+        }
+        for (const auto& t : program.delta[f]) {
+            narrow = narrow && t.exp <= WIDE && -t.exp <= WIDE;
+            delta.push_back(static_cast<std::int32_t>(std::max(-WIDE, std::min(t.exp, WIDE))));
+            growth = std::max(growth, t.exp);
+        }
+        requireExps.push_back(require);
+        deltaExps.push_back(delta);
+        signFree = signFree && program.scale[f] == 1;
+    }
+    // Between two checks a lane grows by at most checkEvery * growth.
+    checkEvery = static_cast<int>(std::max<std::int64_t>(1, std::min<std::int64_t>(4096, WIDE / growth)));
+    limit = std::numeric_limits<std::int32_t>::max() - static_cast<std::int64_t>(checkEvery) * growth;
+    avx2 = SimdMatcher::detect() == SimdMatcher::Kernel::Avx2;
+}
+
+inline unsigned long long BatchFractran::getStepCount(size_t m) const {
+    if (spilled[m]) return spillSteps[m] + spilled[m]->getStepCount();
+    return haltedAt[m] != NOT_HALTED ? haltedAt[m] : totalSteps;
+}
+
+// Tests denominator f against the first n lanes, applies its exponent
+// changes to the lanes that take it, and returns how many did.
+inline size_t BatchFractran::matchFraction(size_t f, size_t n) {
+    using namespace batch_detail;
+    const std::vector<RegisterTerm>& require = program.require[f];
+    const std::vector<std::int32_t>& exps = requireExps[f];
+    const std::int32_t* candidates = pending.data();
+    size_t k = 0;
+
+    // Denominators longer than one pass narrow a scratch mask first.
+    for (; k + TERMS < require.size(); ++k) {
+#ifdef FRACTRAN_X86
+        if (avx2) {
+            narrowLanesAvx2(row(require[k].reg), exps[k], candidates, scratch.data(), n);
+            candidates = scratch.data();
+            continue;
+        }
+#endif
+        narrowLanes(row(require[k].reg), exps[k], candidates, scratch.data(), n);
+        candidates = scratch.data();
+    }
+    const bool narrowed = k > 0;
+
+    const std::int32_t* rows[TERMS];
+    std::int32_t last[TERMS];
+    size_t count = require.size() - k;
+    for (size_t i = 0; i < count; ++i) {
+        rows[i] = row(require[k + i].reg);
+        last[i] = exps[k + i];
+    }
+
+    const std::int32_t index = static_cast<std::int32_t>(f);
+    std::int32_t* searching = pending.data();
+    std::int32_t* chosen = choice.data();
+    std::int32_t* hit = hits.data();
+    std::int32_t matched = 0;
+#ifdef FRACTRAN_X86
+    if (avx2) {
+        switch (narrowed ? TERMS + 1 : count) {
+            case 0: matched = matchLanesAvx2<0>(rows, last, index, candidates, searching, chosen, hit, n); break;
+            case 1: matched = matchLanesAvx2<1>(rows, last, index, candidates, searching, chosen, hit, n); break;
+            case 2: matched = matchLanesAvx2<2>(rows, last, index, candidates, searching, chosen, hit, n); break;
+            case 3: matched = matchLanesAvx2<3>(rows, last, index, candidates, searching, chosen, hit, n); break;
+            case 4: matched = matchLanesAvx2<4>(rows, last, index, candidates, searching, chosen, hit, n); break;
+            default: matched = matchLanesAvx2<4, true>(rows, last, index, candidates, searching, chosen, hit, n); break;
+        }
+        if (matched > 0) {
+            const auto& delta = program.delta[f];
+            for (size_t d = 0; d < delta.size(); ++d) addLanesAvx2(row(delta[d].reg), deltaExps[f][d], hit, n);
+        }
+        return static_cast<size_t>(matched);
+    }
+#endif
+    switch (narrowed ? TERMS + 1 : count) {
+        case 0: matched = matchLanes<0>(rows, last, index, candidates, searching, chosen, hit, n); break;
+        case 1: matched = matchLanes<1>(rows, last, index, candidates, searching, chosen, hit, n); break;
+        case 2: matched = matchLanes<2>(rows, last, index, candidates, searching, chosen, hit, n); break;
+        case 3: matched = matchLanes<3>(rows, last, index, candidates, searching, chosen, hit, n); break;
+        case 4: matched = matchLanes<4>(rows, last, index, candidates, searching, chosen, hit, n); break;
+        default: matched = matchLanes<4, true>(rows, last, index, candidates, searching, chosen, hit, n); break;
+    }
+    if (matched > 0) {
+        const auto& delta = program.delta[f];
+        for (size_t d = 0; d < delta.size(); ++d) addLanes(row(delta[d].reg), deltaExps[f][d], hit, n);
+    }
+    return static_cast<size_t>(matched);
+}
+
+// Scalar first match from fraction f on for the few lanes still searching, so
+// one slow lane does not cost a pass over every lane per remaining fraction.
+// Returns the number of lanes that matched nothing (they halted).
+inline size_t BatchFractran::finishLanes(size_t f, size_t n) {
+    const size_t fractionCount = program.fractionCount();
+    size_t halted = 0;
+    for (size_t l = 0; l < n; ++l) {
+        if (!pending[l]) continue;
+        size_t g = f;
+        for (; g < fractionCount; ++g) {
+            bool fits = true;
+            for (size_t i = 0; i < program.require[g].size() && fits; ++i) {
+                fits = regs[program.require[g][i].reg * capacity + l] >= requireExps[g][i];
+            }
+            if (fits) break;
+        }
+        if (g == fractionCount) {
+            halted++;
+            continue;
+        }
+        choice[l] = static_cast<std::int32_t>(g);
+        for (size_t d = 0; d < program.delta[g].size(); ++d) {
+            regs[program.delta[g][d].reg * capacity + l] += deltaExps[g][d];
+        }
+    }
+    return halted;
+}
+
+// Retires the lanes that halted at `step` and the ones whose state just
+// became zero. Walking backwards means the lane moved into a freed slot has
+// already been handled.
+inline void BatchFractran::compact(size_t n, unsigned long long step) {
+    for (size_t l = n; l-- > 0; ) {
+        if (choice[l] < 0) {
+            haltedAt[machineOf[l]] = step;
+            retire(l);
+            continue;
+        }
+        int scale = program.scale[choice[l]];
+        if (scale == 1) continue;
+        size_t m = machineOf[l];
+        sign[m] *= scale;
+        if (scale == 0) {
+            zero[m] = true;
+            retire(l);
+        }
+    }
+}
+
+// Hands lanes close to the int32 limit to their own RegisterFractran, which
+// runs the `stepsLeft` steps of this call straight away. The registers are
+// carried over as a snapshot when both engines factor the program alike;
+// otherwise the state is rebuilt from its integer value.
+inline void BatchFractran::spillWide(unsigned long long step, std::uint64_t stepsLeft) {
+    for (size_t l = live; l-- > 0; ) {
+        bool wide = false;
+        for (size_t r = 0; r < registerCount && !wide; ++r) wide = regs[r * capacity + l] > limit;
+        if (!wide) continue;
+
+        size_t m = machineOf[l];
+        Snapshot snap;
+        snap.kind = Snapshot::Kind::Registers;
+        snap.programHash = binary::programHash(fractionList);
+        snap.cofactor = cofactor[m] * sign[m];
+        for (size_t r = 0; r < registerCount; ++r) snap.registers.push_back(regs[r * capacity + l]);
+        auto machine = std::make_unique<RegisterFractran>(fractionList, snap.cofactor, false, &program);
+        if (machine->getProgram().primes != program.primes || !machine->restore(snap)) {
+            machine = std::make_unique<RegisterFractran>(fractionList, getLastNumber(m));
+        }
+        spilled[m] = std::move(machine);
+        spillSteps[m] = step;
+        retire(l);
+        spilled[m]->runMachine(stepsLeft);
+    }
+}
+
+// Moves lane l's machine out of the block and the last lane into its place.
+inline void BatchFractran::retire(size_t l) {
+    size_t m = machineOf[l];
+    size_t last = live - 1;
+    if (!zero[m] && !spilled[m]) {
+        finalRegisters[m].resize(registerCount);
+        for (size_t r = 0; r < registerCount; ++r) finalRegisters[m][r] = regs[r * capacity + l];
+    }
+    lane[m] = NO_LANE;
+    if (l != last) {
+        for (size_t r = 0; r < registerCount; ++r) regs[r * capacity + l] = regs[r * capacity + last];
+        machineOf[l] = machineOf[last];
+        lane[machineOf[l]] = l;
+    }
+    live--;
+}
+
+inline void BatchFractran::runMachine(std::uint64_t steps) {
+    if (steps == 0) return;
+    for (auto& machine : spilled) {
+        if (machine) machine->runMachine(steps);
+    }
+
+    const size_t fractionCount = program.fractionCount();
+    int sinceCheck = checkEvery;
+    for (std::uint64_t s = 0; s < steps && live > 0; ++s) {
+        if (sinceCheck == checkEvery) {
+            spillWide(totalSteps + s, steps - s);
+            sinceCheck = 0;
+            if (live == 0) break;
+        }
+        sinceCheck++;
+
+        const size_t n = live;
+        for (size_t l = 0; l < n; ++l) {
+            choice[l] = -1;
+            pending[l] = -1;
+        }
+        size_t waiting = n;
+        size_t f = 0;
+        for (; f < fractionCount && waiting > 0 && waiting * TAIL >= n; ++f) {
+            waiting -= matchFraction(f, n);
+        }
+        size_t halted = waiting > 0 ? finishLanes(f, n) : 0;
+        if (halted > 0 || !signFree) compact(n, totalSteps + s);
+    }
+    // Machines still in the block (and zero states) took every step.
+    totalSteps += steps;
+}
+
+inline mpz_class BatchFractran::getLastNumber(size_t m) const {
+    if (spilled[m]) return spilled[m]->getLastNumber();
+    if (zero[m]) return 0;
+    mpz_class value = cofactor[m] * sign[m];
+    if (lane[m] == NO_LANE) return program.decode(finalRegisters[m], value);
+    std::vector<std::int64_t> exps(registerCount);
+    for (size_t r = 0; r < registerCount; ++r) exps[r] = regs[r * capacity + lane[m]];
+    return program.decode(exps, value);
+}
+
+#endif // BATCH_FRACTRAN_H
@@ -0,0 +1,289 @@
+#ifndef BENCH_SUITE_H
+#define BENCH_SUITE_H
+
+#include <gmpxx.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "fractran.h"
+#include "limb_pool.h"
+#include "register_fractran.h"
+
+// The benchmark_sim suite: a fixed matrix of workloads (program x engine x
+// step budget x history), each measured in a child process so that its peak
+// RSS is its own. Results are written as JSON and can be compared against a
+// stored baseline run.
+namespace bench {
+
+// Heap traffic of the measured runs. benchmark.cpp feeds these from its
+// operator new/delete replacements and from GMP's memory functions.
+inline std::atomic<std::uint64_t> allocations{0};
+inline std::atomic<std::uint64_t> allocatedBytes{0};
+
+struct Workload {
+    std::string program;                // prime_game, adder, ...
+    std::vector<mpq_class> fractions;
+    mpz_class input;
+    std::string engine;                 // "gmp" or "registers"
+    int steps = 0;
+    bool history = false;
+    bool pooled = false;                // GMP allocates through limb_pool.h instead of malloc
+
+    std::string name() const {
+        return program + "/" + engine + "/" + std::to_string(steps) + (history ? "/history" : "/no-history") +
+               (pooled ? "/pool" : "");
+    }
+};
+
+// Per-workload numbers. Rates are steps per second over `repeats` timed runs
+// after one warm-up run; p95 is the rate 95% of runs reach (the slow tail).
+// Allocation counts are per run and count calls into malloc, so a pooled
+// workload only counts the blocks its pool had to get from the system.
+struct Measurement {
+    double medianRate = 0;
+    double p95Rate = 0;
+    unsigned long long steps = 0;       // steps per run (less than the budget if it halted)
+    long peakRssKb = 0;
+    std::uint64_t allocations = 0;
+    std::uint64_t allocatedBytes = 0;
+    bool ok = false;
+};
+
+struct SuiteOptions {
+    int repeats = 5;
+    bool quick = false;  // budgets divided by 10, three repeats
+    std::string filter;  // only workloads whose name contains this
+};
+
+inline std::vector<mpq_class> fractionsOf(std::initializer_list<std::pair<long, long>> list) {
+    std::vector<mpq_class> out;
+    for (const auto& f : list) out.push_back(mpq_class(f.first, f.second));
+    return out;
+}
+
+// Prime game behind `padding` fractions that never fire. Their denominators
+// use primes the state never contains, the way unreachable fractions of a
+// compiled program do, so a linear scan has to reject each of them per step.
+inline std::vector<mpq_class> paddedPrimeGame(int padding) {
+    std::vector<unsigned long> unused;
+    for (unsigned long p = 31; unused.size() < 40; p += 2) {
+        bool prime = true;
+        for (unsigned long d = 3; d * d <= p; d += 2) {
+            if (p % d == 0) { prime = false; break; }
+        }
+        if (prime) unused.push_back(p);
+    }
+    std::vector<mpq_class> prog;
+    for (int i = 0; i < padding; ++i) prog.push_back(mpq_class(2 * (i + 1), unused[i % unused.size()]));
+    std::vector<mpq_class> game = fractionsOf({{17, 91}, {78, 85}, {19, 51}, {23, 38}, {29, 33}, {77, 29}, {95, 23},
+                                               {77, 19}, {1, 17}, {11, 13}, {13, 11}, {15, 2}, {1, 7}, {55, 1}});
+    prog.insert(prog.end(), game.begin(), game.end());
+    return prog;
+}
+
+inline std::vector<Workload> workloads(const SuiteOptions& options) {
+    struct Program {
+        std::string name;
+        std::vector<mpq_class> fractions;
+        mpz_class input;
+        int divisor; // long programs get smaller budgets
+    };
+    mpz_class adderInput, multiplierInput, fibonacciInput;
+    mpz_ui_pow_ui(adderInput.get_mpz_t(), 2, 20000);           // 2^20000 * 3 -> 3^20001
+    adderInput *= 3;
+    mpz_ui_pow_ui(multiplierInput.get_mpz_t(), 6, 100);        // 2^100 * 3^100 -> 5^10000
+    mpz_ui_pow_ui(fibonacciInput.get_mpz_t(), 5, 24);          // 78 * 5^24 -> 2^F(25)
+    fibonacciInput *= 78;
+
+    std::vector<Program> programs = {
+        {"prime_game", paddedPrimeGame(0), 2, 1},
+        {"adder", fractionsOf({{3, 2}}), adderInput, 1},
+        {"multiplier", fractionsOf({{455, 33}, {11, 13}, {1, 11}, {3, 7}, {11, 2}, {1, 3}}), multiplierInput, 1},
+        {"fibonacci", fractionsOf({{17, 65}, {133, 34}, {17, 19}, {23, 17}, {2233, 69}, {23, 29}, {31, 23},
+                                   {74, 341}, {31, 37}, {41, 31}, {129, 287}, {41, 43}, {13, 41}, {1, 13}, {1, 3}}),
+         fibonacciInput, 1},
+        {"synthetic_4096", paddedPrimeGame(4096), 2, 10},
+    };
+
+    std::vector<Workload> out;
+    for (const auto& program : programs) {
+        for (const char* engine : {"gmp", "registers"}) {
+            for (int steps : {10000, 100000}) {
+                for (bool history : {false, true}) {
+                    // The limb pool against malloc where GMP does the work.
+                    for (bool pooled : {false, true}) {
+                        if (pooled && std::string(engine) != "gmp") continue;
+                        Workload w;
+                        w.program = program.name;
+                        w.fractions = program.fractions;
+                        w.input = program.input;
+                        w.engine = engine;
+                        w.steps = steps / program.divisor / (options.quick ? 10 : 1);
+                        w.history = history;
+                        w.pooled = pooled;
+                        if (options.filter.empty() || w.name().find(options.filter) != std::string::npos) {
+                            out.push_back(w);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return out;
+}
+
+inline double percentile(std::vector<double> values, double p) {
+    std::sort(values.begin(), values.end());
+    double at = p * (values.size() - 1);
+    size_t lo = static_cast<size_t>(std::floor(at));
+    size_t hi = std::min(values.size() - 1, lo + 1);
+    return values[lo] + (values[hi] - values[lo]) * (at - lo);
+}
+
+template <typename Machine>
+Measurement measureEngine(const Workload& w, int repeats) {
+    Measurement m;
+    std::vector<double> rates;
+    std::uint64_t allocs = 0, bytes = 0;
+    // With the limb pool installed GMP's calls never reach the counters above.
+    auto heapCalls = [] { return allocations.load() + limb_pool::stats().systemAllocations; };
+    auto heapBytes = [] { return allocatedBytes.load() + limb_pool::stats().systemBytes; };
+    for (int run = 0; run <= repeats; ++run) {
+        std::uint64_t allocsBefore = heapCalls(), bytesBefore = heapBytes();
+        Machine machine(w.fractions, w.input, w.history);
+        auto start = std::chrono::steady_clock::now();
+        machine.runMachine(w.steps);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        if (run == 0) continue; // warm-up
+        m.steps = machine.getStepCount();
+        rates.push_back(m.steps / std::max(elapsed.count(), 1e-9));
+        allocs += heapCalls() - allocsBefore;
+        bytes += heapBytes() - bytesBefore;
+    }
+    m.medianRate = percentile(rates, 0.5);
+    m.p95Rate = percentile(rates, 0.05);
+    m.allocations = allocs / repeats;
+    m.allocatedBytes = bytes / repeats;
+    m.ok = true;
+    return m;
+}
+
+// Runs one workload in a forked child and reads its Measurement from a pipe.
+inline Measurement measure(const Workload& w, int repeats) {
+    Measurement m;
+    int fds[2];
+    if (::pipe(fds) != 0) return m;
+    pid_t pid = ::fork();
+    if (pid == 0) {
+        ::close(fds[0]);
+        // The workload's own numbers were allocated before the fork and are
+        // never freed here, so the child can still switch allocators.
+        if (w.pooled) limb_pool::install();
+        Measurement result = (w.engine == "registers") ? measureEngine<RegisterFractran>(w, repeats)
+                                                       : measureEngine<Fractran>(w, repeats);
+        struct rusage usage;
+        ::getrusage(RUSAGE_SELF, &usage);
+        result.peakRssKb = usage.ru_maxrss;
+        ssize_t written = ::write(fds[1], &result, sizeof(result));
+        ::_exit(written == static_cast<ssize_t>(sizeof(result)) ? 0 : 1);
+    }
+    ::close(fds[1]);
+    if (pid > 0) {
+        if (::read(fds[0], &m, sizeof(m)) != static_cast<ssize_t>(sizeof(m))) m = Measurement();
+        int status = 0;
+        ::waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) m.ok = false;
+    }
+    ::close(fds[0]);
+    return m;
+}
+
+struct Result {
+    Workload workload;
+    Measurement measurement;
+};
+
+inline void writeJson(std::ostream& out, const SuiteOptions& options, const std::vector<Result>& results) {
+    out << "{\n  \"suite\": \"benchmark_sim\",\n  \"version\": 1,\n";
+    out << "  \"repeats\": " << options.repeats << ",\n  \"quick\": " << (options.quick ? "true" : "false") << ",\n";
+    out << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Workload& w = results[i].workload;
+        const Measurement& m = results[i].measurement;
+        char rates[128];
+        std::snprintf(rates, sizeof(rates), "\"median_steps_per_sec\": %.1f, \"p95_steps_per_sec\": %.1f",
+                      m.medianRate, m.p95Rate);
+        out << "    {\"name\": \"" << w.name() << "\", \"program\": \"" << w.program << "\", \"engine\": \""
+            << w.engine << "\", \"steps\": " << w.steps << ", \"history\": " << (w.history ? "true" : "false")
+            << ", \"allocator\": \"" << (w.pooled ? "pool" : "malloc") << "\""
+            << ", \"ok\": " << (m.ok ? "true" : "false") << ", \"steps_run\": " << m.steps << ", " << rates
+            << ", \"peak_rss_kb\": " << m.peakRssKb << ", \"allocations\": " << m.allocations
+            << ", \"allocated_bytes\": " << m.allocatedBytes << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+// Reads name -> median_steps_per_sec from a file written by writeJson. This
+// is not a general JSON parser: it relies on one result object per line.
+inline bool readBaseline(const std::string& path, std::map<std::string, double>& medians, std::string& error) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        error = "cannot open " + path;
+        return false;
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t name = line.find("\"name\": \"");
+        size_t median = line.find("\"median_steps_per_sec\": ");
+        if (name == std::string::npos || median == std::string::npos) continue;
+        name += 9;
+        medians[line.substr(name, line.find('"', name) - name)] = std::atof(line.c_str() + median + 24);
+    }
+    if (medians.empty()) {
+        error = path + " has no benchmark results";
+        return false;
+    }
+    return true;
+}
+
+// Prints current against baseline medians. A workload is a regression when
+// its median drops by more than `thresholdPercent`; returns the number found.
+inline int compare(std::ostream& out, const std::map<std::string, double>& baseline,
+                   const std::vector<Result>& results, double thresholdPercent) {
+    int regressions = 0;
+    char line[256];
+    std::snprintf(line, sizeof(line), "%-44s %14s %14s %8s\n", "workload (median steps/s)", "baseline", "current", "change");
+    out << line;
+    for (const auto& r : results) {
+        std::string name = r.workload.name();
+        auto it = baseline.find(name);
+        if (it == baseline.end() || it->second <= 0) {
+            std::snprintf(line, sizeof(line), "%-44s %14s %14.0f  (new)\n", name.c_str(), "-", r.measurement.medianRate);
+            out << line;
+            continue;
+        }
+        double change = 100.0 * (r.measurement.medianRate - it->second) / it->second;
+        bool regressed = !r.measurement.ok || change < -thresholdPercent;
+        if (regressed) regressions++;
+        std::snprintf(line, sizeof(line), "%-44s %14.0f %14.0f %+7.1f%%%s\n", name.c_str(), it->second,
+                      r.measurement.medianRate, change, regressed ? "  REGRESSION" : "");
+        out << line;
+    }
+    return regressions;
+}
+
+} // namespace bench
+
+#endif // BENCH_SUITE_H
@@ -2,9 +2,59 @@
 #include <vector>
 #include <chrono> 
 #include <iomanip> 
+#include <sstream>
+#include <filesystem>
+#include <thread>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include "bench_suite.h"
 #include "fractran.h"
+#include "register_fractran.h"
+#include "batch_fractran.h"
+#include "jit.h"
+#include "static_fractran.h"
+#include "sweep.h"
+#include "frac_parser.h"
 
-int main() {
+// Every heap allocation of the process is counted for the suite, both C++
+// (operator new) and GMP (mp_set_memory_functions).
+void* operator new(std::size_t size) {
+    bench::allocations.fetch_add(1, std::memory_order_relaxed);
+    bench::allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+// Kept out of line so GCC does not see free() meet operator new at call sites.
+__attribute__((noinline)) void operator delete(void* p) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+void* countedGmpAlloc(size_t size) {
+    bench::allocations.fetch_add(1, std::memory_order_relaxed);
+    bench::allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    return std::malloc(size);
+}
+void* countedGmpRealloc(void* p, size_t oldSize, size_t newSize) {
+    if (newSize > oldSize) {
+        bench::allocations.fetch_add(1, std::memory_order_relaxed);
+        bench::allocatedBytes.fetch_add(newSize - oldSize, std::memory_order_relaxed);
+    }
+    return std::realloc(p, newSize);
+}
+void countedGmpFree(void* p, size_t) { std::free(p); }
+
+// Runs `steps` steps and returns the throughput in steps per second.
+template <typename Machine>
+double stepsPerSecond(Machine& machine, int steps) {
+    auto start_time = std::chrono::high_resolution_clock::now();
+    machine.runMachine(steps);
+    auto end_time = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> elapsed = end_time - start_time;
+    return machine.getStepCount() / elapsed.count();
+}
+
+// The human-readable tour of every engine (benchmark_sim without arguments).
+int report() {
     // 1. Setup Conway's Prime Game (A heavy arithmetic workload)
     std::vector<mpq_class> primes_prog = {
         mpq_class(17, 91), mpq_class(78, 85), mpq_class(19, 51), mpq_class(23, 38),
@@ -19,33 +69,410 @@ int main() {
     std::cout << "Program: Conway's Prime Game" << std::endl;
     std::cout << "Target Steps: " << TARGET_STEPS << std::endl;
     std::cout << "History Recording: DISABLED (Pure Compute Speed)" << std::endl;
-    std::cout << "Running..." << std::endl;
 
-    // 2. Initialize Machine (History DISABLED)
-    Fractran machine(primes_prog, 2, false);
+    double baseline = 0;
+    for (ArithmeticMode mode : {ArithmeticMode::Reference, ArithmeticMode::InPlace, ArithmeticMode::Native}) {
+        const char* label = (mode == ArithmeticMode::Reference) ? "Reference (temporaries)"
+                          : (mode == ArithmeticMode::InPlace)   ? "In-place (no allocation)"
+                                                                : "Native (64-bit, GMP on overflow)";
+        std::cout << "Running " << label << "..." << std::endl;
 
-    // 3. Start Timer
-    auto start_time = std::chrono::high_resolution_clock::now();
+        // 2. Initialize Machine (History DISABLED)
+        Fractran machine(primes_prog, 2, false, mode);
 
-    // 4. Run Workload
-    machine.runMachine(TARGET_STEPS);
+        // 3. Start Timer
+        auto start_time = std::chrono::high_resolution_clock::now();
 
-    // 5. Stop Timer
-    auto end_time = std::chrono::high_resolution_clock::now();
+        // 4. Run Workload
+        machine.runMachine(TARGET_STEPS);
 
-    // 6. Calculate Metrics
-    std::chrono::duration<double> elapsed = end_time - start_time;
-    double seconds = elapsed.count();
-    unsigned long long actual_steps = machine.getStepCount();
-    double steps_per_second = actual_steps / seconds;
+        // 5. Stop Timer
+        auto end_time = std::chrono::high_resolution_clock::now();
+
+        // 6. Calculate Metrics
+        std::chrono::duration<double> elapsed = end_time - start_time;
+        double seconds = elapsed.count();
+        unsigned long long actual_steps = machine.getStepCount();
+        double steps_per_second = actual_steps / seconds;
+        if (mode == ArithmeticMode::Reference) baseline = steps_per_second;
+
+        // 7. Report
+        std::cout << "------------------------------------" << std::endl;
+        std::cout << "Mode:            " << label << std::endl;
+        std::cout << "Time Elapsed:    " << std::fixed << std::setprecision(4) << seconds << "s" << std::endl;
+        std::cout << "Steps Completed: " << actual_steps << std::endl;
+        std::cout << "Performance:     " << std::fixed << std::setprecision(2) << steps_per_second << " Steps/Sec" << std::endl;
+        std::cout << "Speedup:         " << std::fixed << std::setprecision(2) << steps_per_second / baseline << "x" << std::endl;
+        std::cout << "Final Integer Bits: " << machine.getLastNumber().get_str(2).length() << " bits" << std::endl;
+        std::cout << "------------------------------------" << std::endl;
+    }
+
+    // Instrumentation: the same native run with --stats collection on.
+    const int STATS_STEPS = 2000000;
+    std::cout << "--- STATS OVERHEAD (native mode, " << STATS_STEPS << " steps) ---" << std::endl;
+    {
+        double best[2] = {0, 0};
+        for (int round = 0; round < 3; ++round) {
+            for (int collect = 0; collect < 2; ++collect) {
+                Fractran machine(primes_prog, 2, false, ArithmeticMode::Native);
+                if (collect) machine.enableStats();
+                best[collect] = std::max(best[collect], stepsPerSecond(machine, STATS_STEPS));
+            }
+        }
+        std::cout << std::setprecision(0) << "Off: " << best[0] << " steps/s, on: " << best[1] << " steps/s ("
+                  << std::setprecision(1) << 100.0 * (best[0] - best[1]) / best[0] << "% overhead)" << std::endl;
+    }
+    std::cout << "------------------------------------" << std::endl;
+
+    // Stop predicates checked every step: power of 2 (prime game output) plus a deadline.
+    std::cout << "--- STOP PREDICATES (native mode, " << STATS_STEPS << " steps) ---" << std::endl;
+    {
+        double best[3] = {0, 0, 0};
+        for (int round = 0; round < 3; ++round) {
+            for (int variant = 0; variant < 3; ++variant) {
+                Fractran machine(primes_prog, 2, false, ArithmeticMode::Native);
+                PowerOfPrime<Fractran> pow2(machine, primes_prog, 2);
+                RunLimits limits;
+                limits.steps = STATS_STEPS;
+                if (variant >= 1) limits.observers.push_back(&pow2);
+                if (variant == 2) limits.deadline = std::chrono::steady_clock::now() + std::chrono::hours(1);
+                auto start = std::chrono::steady_clock::now();
+                machine.run(limits);
+                std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+                best[variant] = std::max(best[variant], machine.getStepCount() / elapsed.count());
+            }
+        }
+        std::cout << std::setprecision(0) << "None: " << best[0] << " steps/s, pow:2 " << best[1]
+                  << " steps/s, pow:2 + deadline " << best[2] << " steps/s (" << std::setprecision(1)
+                  << 100.0 * (best[0] - best[2]) / best[0] << "% overhead)" << std::endl;
+    }
+    std::cout << "------------------------------------" << std::endl;
+
+    // Register engine: first-match strategies as the program grows.
+    const int SCALING_STEPS = 50000;
+    std::cout << "--- DISPATCH SCALING (register engine, " << SCALING_STEPS << " steps, SIMD kernel: "
+              << SimdMatcher::kernelName(SimdMatcher::detect()) << ") ---" << std::endl;
+    std::cout << std::setw(10) << "Fractions" << std::setw(14) << "Linear"
+              << std::setw(14) << "Indexed" << std::setw(14) << "SIMD" << std::endl;
+    for (int padding : {0, 64, 256, 1024, 4096}) {
+        std::vector<mpq_class> prog = bench::paddedPrimeGame(padding);
+
+        std::cout << std::setw(10) << prog.size() << std::setprecision(0);
+        for (MatchStrategy strategy : {MatchStrategy::Linear, MatchStrategy::Indexed, MatchStrategy::Simd}) {
+            RegisterFractran machine(prog, 2, false);
+            machine.setMatchStrategy(strategy);
+            std::cout << std::setw(14) << stepsPerSecond(machine, SCALING_STEPS);
+        }
+        std::cout << std::endl;
+    }
+    std::cout << "------------------------------------" << std::endl;
+
+    // Input sweep: the same budget for 2000 inputs, with 1, 2, 4, ... workers.
+    const int SWEEP_STEPS = 5000;
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    std::cout << "--- SWEEP SCALING (2000 inputs x " << SWEEP_STEPS << " steps, " << cores << " cores) ---" << std::endl;
+    std::cout << std::setw(10) << "Threads" << std::setw(14) << "Inputs/Sec" << std::setw(10) << "Speedup" << std::endl;
+    double single = 0;
+    for (unsigned threads = 1; threads <= cores; threads *= 2) {
+        SweepOptions options;
+        options.threads = threads;
+        options.maxSteps = SWEEP_STEPS;
+        std::ostringstream out;
+        auto start_time = std::chrono::high_resolution_clock::now();
+        runSweep<Fractran>(primes_prog, SweepInputs::range(2, 2001), options, SweepFormat::Binary, out, [](Fractran&) {});
+        std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start_time;
+        double rate = 2000 / elapsed.count();
+        if (threads == 1) single = rate;
+        std::cout << std::setw(10) << threads << std::setw(14) << std::setprecision(0) << rate
+                  << std::setw(9) << std::setprecision(2) << rate / single << "x" << std::endl;
+    }
+    std::cout << "------------------------------------" << std::endl;
 
-    // 7. Report
+    // The prime game as template parameters against the generic engines.
+    using PrimeGame = StaticFractran<Frac<17, 91>, Frac<78, 85>, Frac<19, 51>, Frac<23, 38>, Frac<29, 33>,
+                                     Frac<77, 29>, Frac<95, 23>, Frac<77, 19>, Frac<1, 17>, Frac<11, 13>,
+                                     Frac<13, 11>, Frac<15, 2>, Frac<1, 7>, Frac<55, 1>>;
+    // All three run the same steps: the state keeps growing, so rates from
+    // different stretches of the run would not compare.
+    const int STATIC_STEPS = 2000000;
+    std::cout << "--- STATIC ENGINE (prime game, " << STATIC_STEPS << " steps) ---" << std::endl;
+    {
+        Fractran generic(primes_prog, 2, false, ArithmeticMode::Native);
+        RegisterFractran registers(primes_prog, 2, false);
+        PrimeGame fixed(2);
+        double genericRate = stepsPerSecond(generic, STATIC_STEPS);
+        double registerRate = stepsPerSecond(registers, STATIC_STEPS);
+        double staticRate = stepsPerSecond(fixed, STATIC_STEPS);
+        std::cout << std::setprecision(0) << "Fractran (native): " << genericRate << " steps/s" << std::endl;
+        std::cout << "RegisterFractran:  " << registerRate << " steps/s" << std::endl;
+        std::cout << "StaticFractran:    " << staticRate << " steps/s (" << std::setprecision(1)
+                  << staticRate / genericRate << "x Fractran)" << std::endl;
+    }
     std::cout << "------------------------------------" << std::endl;
-    std::cout << "Time Elapsed:    " << std::fixed << std::setprecision(4) << seconds << "s" << std::endl;
-    std::cout << "Steps Completed: " << actual_steps << std::endl;
-    std::cout << "Performance:     " << std::fixed << std::setprecision(2) << steps_per_second << " Steps/Sec" << std::endl;
-    std::cout << "Final Integer Bits: " << machine.getLastNumber().get_str(2).length() << " bits" << std::endl;
+
+    // JIT: compile (into a fresh cache), cached load, then steps per second.
+    const int JIT_STEPS = 20000000;
+    std::cout << "--- JIT (prime game, " << JIT_STEPS << " steps) ---" << std::endl;
+    {
+        JitOptions options;
+        options.cacheDir = "/tmp/fractran-jit-bench-" + std::to_string(::geteuid());
+        std::filesystem::remove_all(options.cacheDir);
+        RegisterProgram prog = buildRegisterProgram(primes_prog);
+        std::string error;
+        auto timed = [&] {
+            auto start_time = std::chrono::high_resolution_clock::now();
+            auto jit = JitProgram::load(prog, error, options);
+            std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start_time;
+            return elapsed.count() * 1000;
+        };
+        double compileMs = timed();
+        double cachedMs = timed();
+        if (!error.empty()) {
+            std::cout << "JIT unavailable: " << error << std::endl;
+        } else {
+            RegisterFractran interpreted(primes_prog, 2, false);
+            RegisterFractran compiled(primes_prog, 2, false);
+            compiled.enableJit(error, options);
+            std::cout << std::setprecision(1) << "Compile: " << compileMs << " ms, cached load: " << cachedMs
+                      << " ms" << std::endl;
+            std::cout << std::setprecision(0) << "Interpreted: " << stepsPerSecond(interpreted, JIT_STEPS / 10)
+                      << " steps/s, JIT: " << stepsPerSecond(compiled, JIT_STEPS) << " steps/s" << std::endl;
+        }
+        std::filesystem::remove_all(options.cacheDir);
+    }
+    std::cout << "------------------------------------" << std::endl;
+
+    // Lockstep batch against one machine per input, in machine-steps per second.
+    const int BATCH_STEPS = 5000;
+    std::cout << "--- BATCH (" << BATCH_STEPS << " steps per input, lanes: "
+              << (SimdMatcher::detect() == SimdMatcher::Kernel::Avx2 ? "AVX2" : "portable") << ") ---" << std::endl;
+    std::cout << std::setw(10) << "Inputs" << std::setw(14) << "Fractran" << std::setw(14) << "Registers"
+              << std::setw(14) << "Batch" << std::endl;
+    for (unsigned long inputs : {64UL, 1024UL}) {
+        std::vector<mpz_class> values;
+        for (unsigned long n = 2; n < inputs + 2; ++n) values.push_back(n);
+        auto rate = [&](auto run) {
+            auto start_time = std::chrono::high_resolution_clock::now();
+            unsigned long long steps = run();
+            std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start_time;
+            return steps / elapsed.count();
+        };
+        auto separate = [&](auto make) {
+            return [&, make] {
+                unsigned long long steps = 0;
+                for (const auto& n : values) {
+                    auto machine = make(n);
+                    machine.runMachine(BATCH_STEPS);
+                    steps += machine.getStepCount();
+                }
+                return steps;
+            };
+        };
+        std::cout << std::setw(10) << inputs << std::setprecision(0)
+                  << std::setw(14) << rate(separate([&](const mpz_class& n) { return Fractran(primes_prog, n, false); }))
+                  << std::setw(14) << rate(separate([&](const mpz_class& n) { return RegisterFractran(primes_prog, n, false); }))
+                  << std::setw(14) << rate([&] {
+                         BatchFractran batch(primes_prog, values);
+                         batch.runMachine(BATCH_STEPS);
+                         unsigned long long steps = 0;
+                         for (size_t m = 0; m < batch.size(); ++m) steps += batch.getStepCount(m);
+                         return steps;
+                     })
+                  << std::endl;
+    }
+    std::cout << "------------------------------------" << std::endl;
+
+    // Startup: loading a generated program, the old getline/stringstream
+    // loader against the memory-mapped parser on one thread and on all cores.
+    const int LOAD_FRACTIONS = 300000;
+    std::cout << "--- PROGRAM LOADING (" << LOAD_FRACTIONS << " fractions) ---" << std::endl;
+    {
+        std::string path = (std::filesystem::temp_directory_path() / "fractran_bench_load.frac").string();
+        {
+            std::ofstream out(path);
+            out << "Input: 2\n";
+            for (int i = 0; i < LOAD_FRACTIONS; ++i) {
+                out << (i * 7919UL % 1000003 + 1) << "/" << (i % 4099 + 1) << ((i % 8 == 7) ? "\n" : " ");
+            }
+        }
+        auto millis = [](auto load) {
+            double best = 1e300;
+            for (int round = 0; round < 3; ++round) {
+                auto start = std::chrono::steady_clock::now();
+                size_t count = load();
+                std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+                if (count != static_cast<size_t>(LOAD_FRACTIONS)) return -1.0;
+                best = std::min(best, elapsed.count());
+            }
+            return best;
+        };
+        double streams = millis([&] {
+            std::vector<mpq_class> fractions;
+            std::ifstream file(path);
+            std::string line, segment;
+            while (std::getline(file, line)) {
+                std::stringstream ss(line.substr(0, line.find('#')));
+                while (ss >> segment) {
+                    if (segment == "Input:" || segment == "Steps:") {
+                        ss >> segment;
+                        continue;
+                    }
+                    try {
+                        fractions.push_back(mpq_class(segment));
+                    } catch (...) { }
+                }
+            }
+            return fractions.size();
+        });
+        auto mapped = [&](unsigned threads) {
+            return millis([&, threads] {
+                FracFile file;
+                loadFracFile(path, file, threads);
+                return file.fractions.size();
+            });
+        };
+        double single = mapped(1), parallel = mapped(0);
+        std::cout << std::setprecision(1) << "getline/stringstream: " << streams << " ms, mapped: " << single
+                  << " ms, mapped on " << std::max(1u, std::thread::hardware_concurrency()) << " threads: " << parallel
+                  << " ms (" << streams / parallel << "x)" << std::endl;
+        std::filesystem::remove(path);
+    }
+    std::cout << "------------------------------------" << std::endl;
+
+    // Printing a history of big states: decimal conversion of every state
+    // against exponents replayed over the program's registers.
+    const unsigned long PRINT_BITS = 20000;
+    std::cout << "--- STATE OUTPUT (3/2 from 2^" << PRINT_BITS << ", " << PRINT_BITS + 1 << " states) ---" << std::endl;
+    {
+        mpz_class start;
+        mpz_ui_pow_ui(start.get_mpz_t(), 2, PRINT_BITS);
+        Fractran machine({mpq_class(3, 2)}, start, true);
+        machine.runMachine(PRINT_BITS + 1);
+
+        struct CountingBuffer : std::streambuf {
+            std::uint64_t bytes = 0;
+            std::streamsize xsputn(const char*, std::streamsize n) override {
+                bytes += static_cast<std::uint64_t>(n);
+                return n;
+            }
+            int overflow(int c) override {
+                bytes++;
+                return c;
+            }
+        };
+        auto print = [&](Notation notation, std::uint64_t& bytes) {
+            CountingBuffer sink;
+            std::streambuf* saved = std::cout.rdbuf(&sink);
+            auto start = std::chrono::steady_clock::now();
+            machine.printSequence(notation);
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+            std::cout.rdbuf(saved);
+            bytes = sink.bytes;
+            return elapsed.count();
+        };
+        std::uint64_t decimalBytes = 0, factoredBytes = 0, binaryBytes = 0;
+        double decimal = print(Notation::Decimal, decimalBytes);
+        double factored = print(Notation::Factored, factoredBytes);
+        double binary = print(Notation::Binary, binaryBytes);
+        std::cout << std::setprecision(1) << "decimal: " << decimal << " ms (" << decimalBytes / 1000000.0
+                  << " MB), factored: " << factored << " ms (" << factoredBytes / 1000000.0 << " MB), binary: "
+                  << binary << " ms (" << binaryBytes / 1000000.0 << " MB), " << decimal / factored << "x" << std::endl;
+    }
     std::cout << "------------------------------------" << std::endl;
 
+    // GMP's heap traffic through malloc against limb_pool.h, each run in a
+    // child process that installs its allocator first (bench::measure).
+    std::cout << "--- GMP LIMB ALLOCATOR (gmp engine, malloc vs pool) ---" << std::endl;
+    {
+        bench::SuiteOptions options;
+        options.filter = "/gmp/100000/";
+        options.repeats = 3;
+        std::vector<bench::Workload> workloads = bench::workloads(options);
+        // Count malloc's side the way the suite does; both sides are malloc.
+        void* (*savedAlloc)(size_t);
+        void* (*savedRealloc)(void*, size_t, size_t);
+        void (*savedFree)(void*, size_t);
+        mp_get_memory_functions(&savedAlloc, &savedRealloc, &savedFree);
+        mp_set_memory_functions(countedGmpAlloc, countedGmpRealloc, countedGmpFree);
+        for (size_t i = 0; i + 1 < workloads.size(); i += 2) {
+            const bench::Workload& system = workloads[i];
+            const bench::Workload& pooled = workloads[i + 1];
+            if (system.pooled || !pooled.pooled || system.program == "synthetic_4096") continue;
+            bench::Measurement a = bench::measure(system, options.repeats);
+            bench::Measurement b = bench::measure(pooled, options.repeats);
+            std::cout << std::setprecision(0) << std::left << std::setw(12) << system.program
+                      << (system.history ? " history    " : " no history ") << std::right << "malloc: " << std::setw(9)
+                      << a.medianRate << " steps/s, " << std::setw(7) << a.allocations << " mallocs | pool: "
+                      << std::setw(9) << b.medianRate << " steps/s, " << std::setw(7) << b.allocations << " mallocs ("
+                      << std::setprecision(2) << b.medianRate / std::max(a.medianRate, 1.0) << "x)" << std::endl;
+        }
+        mp_set_memory_functions(savedAlloc, savedRealloc, savedFree);
+    }
+    std::cout << "------------------------------------" << std::endl;
+
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) return report();
+
+    bench::SuiteOptions options;
+    std::string jsonPath, baselinePath;
+    double threshold = 10;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        size_t eq = arg.find('=');
+        std::string name = arg.substr(0, eq);
+        std::string value = (eq == std::string::npos) ? "" : arg.substr(eq + 1);
+        if (name == "--suite") continue;
+        else if (name == "--quick") options.quick = true;
+        else if (name == "--repeats" && std::atoi(value.c_str()) > 0) options.repeats = std::atoi(value.c_str());
+        else if (name == "--filter") options.filter = value;
+        else if (name == "--json" && !value.empty()) jsonPath = value;
+        else if (name == "--compare" && !value.empty()) baselinePath = value;
+        else if (name == "--threshold" && std::atof(value.c_str()) > 0) threshold = std::atof(value.c_str());
+        else {
+            std::cerr << "Usage: " << argv[0] << "                      human-readable report\n"
+                      << "       " << argv[0] << " --suite [--quick] [--repeats=N] [--filter=TEXT] [--json=FILE]\n"
+                      << "       " << argv[0] << " --compare=BASELINE.json [--threshold=PERCENT] [suite options]\n";
+            return 1;
+        }
+    }
+    if (options.quick && options.repeats == 5) options.repeats = 3;
+
+    std::map<std::string, double> baseline;
+    std::string error;
+    if (!baselinePath.empty() && !bench::readBaseline(baselinePath, baseline, error)) {
+        std::cerr << "Error: " << error << std::endl;
+        return 1;
+    }
+
+    mp_set_memory_functions(countedGmpAlloc, countedGmpRealloc, countedGmpFree);
+    std::vector<bench::Result> results;
+    for (const auto& workload : bench::workloads(options)) {
+        std::cerr << workload.name() << "..." << std::flush;
+        results.push_back({workload, bench::measure(workload, options.repeats)});
+        std::cerr << (results.back().measurement.ok ? " done" : " FAILED") << std::endl;
+    }
+
+    if (!jsonPath.empty()) {
+        std::ofstream out(jsonPath);
+        bench::writeJson(out, options, results);
+        if (!out) {
+            std::cerr << "Error: cannot write " << jsonPath << std::endl;
+            return 1;
+        }
+    } else if (baselinePath.empty()) {
+        bench::writeJson(std::cout, options, results);
+    }
+
+    if (!baselinePath.empty()) {
+        int regressions = bench::compare(std::cout, baseline, results, threshold);
+        std::cout << regressions << " regression(s) beyond " << threshold << "% against " << baselinePath << std::endl;
+        return regressions == 0 ? 0 : 1;
+    }
+    for (const auto& r : results) {
+        if (!r.measurement.ok) return 1;
+    }
     return 0;
 }
@@ -0,0 +1,167 @@
+#ifndef BINARY_IO_H
+#define BINARY_IO_H
+
+#include <gmpxx.h>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Little helpers shared by the binary file formats (traces, snapshots,
+// compiled programs). Integers are little-endian or LEB128 varints; an
+// mpz is a sign byte, a varint byte count and its magnitude, least
+// significant byte first.
+namespace binary {
+
+inline void putU32(std::string& out, std::uint32_t v) {
+    for (int i = 0; i < 4; ++i) out.push_back(static_cast<char>(v >> (8 * i)));
+}
+
+inline void putU64(std::string& out, std::uint64_t v) {
+    for (int i = 0; i < 8; ++i) out.push_back(static_cast<char>(v >> (8 * i)));
+}
+
+// Writes a varint into `buf` (at least 10 bytes) and returns its length.
+inline size_t encodeVarint(std::uint64_t v, unsigned char* buf) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        buf[n++] = static_cast<unsigned char>(v | 0x80);
+        v >>= 7;
+    }
+    buf[n++] = static_cast<unsigned char>(v);
+    return n;
+}
+
+inline void putVarint(std::string& out, std::uint64_t v) {
+    unsigned char buf[10];
+    out.append(reinterpret_cast<const char*>(buf), encodeVarint(v, buf));
+}
+
+inline void putMpz(std::string& out, const mpz_class& n) {
+    size_t count = 0;
+    std::vector<unsigned char> bytes((mpz_sizeinbase(n.get_mpz_t(), 2) + 7) / 8 + 1);
+    mpz_export(bytes.data(), &count, -1, 1, 0, 0, n.get_mpz_t());
+    out.push_back(static_cast<char>(sgn(n) < 0 ? 1 : 0));
+    putVarint(out, count);
+    out.append(reinterpret_cast<const char*>(bytes.data()), count);
+}
+
+// Bounds-checked cursor over a byte range (a mapped file or a string).
+// Any read past the end sets `failed` and returns zero.
+struct Reader {
+    const unsigned char* pos;
+    const unsigned char* end;
+    bool failed = false;
+
+    Reader(const void* data, size_t size)
+        : pos(static_cast<const unsigned char*>(data)), end(pos + size) {}
+
+    bool atEnd() const { return pos >= end; }
+
+    std::uint32_t u32() {
+        if (end - pos < 4) { failed = true; pos = end; return 0; }
+        std::uint32_t v = 0;
+        for (int i = 0; i < 4; ++i) v |= std::uint32_t(pos[i]) << (8 * i);
+        pos += 4;
+        return v;
+    }
+
+    std::uint64_t u64() {
+        if (end - pos < 8) { failed = true; pos = end; return 0; }
+        std::uint64_t v = 0;
+        for (int i = 0; i < 8; ++i) v |= std::uint64_t(pos[i]) << (8 * i);
+        pos += 8;
+        return v;
+    }
+
+    std::uint64_t varint() {
+        std::uint64_t v = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (pos >= end) { failed = true; return 0; }
+            unsigned char b = *pos++;
+            v |= std::uint64_t(b & 0x7F) << shift;
+            if (!(b & 0x80)) return v;
+        }
+        failed = true;
+        return 0;
+    }
+
+    mpz_class mpz() {
+        mpz_class n;
+        if (pos >= end) { failed = true; return n; }
+        bool negative = *pos++ != 0;
+        std::uint64_t count = varint();
+        if (failed || static_cast<std::uint64_t>(end - pos) < count) { failed = true; pos = end; return n; }
+        mpz_import(n.get_mpz_t(), count, -1, 1, 0, 0, pos);
+        pos += count;
+        if (negative) n = -n;
+        return n;
+    }
+
+    bool bytes(void* dest, size_t count) {
+        if (static_cast<size_t>(end - pos) < count) { failed = true; pos = end; return false; }
+        std::memcpy(dest, pos, count);
+        pos += count;
+        return true;
+    }
+};
+
+// FNV-1a over a byte range, used for program and content hashes.
+inline std::uint64_t fnv1a(const void* data, size_t size, std::uint64_t h = 1469598103934665603ULL) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// Serialized fraction list: count, then numerator and denominator of each.
+inline void putProgram(std::string& out, const std::vector<mpq_class>& fractions) {
+    putVarint(out, fractions.size());
+    for (const auto& frac : fractions) {
+        putMpz(out, frac.get_num());
+        putMpz(out, frac.get_den());
+    }
+}
+
+// Reads a fraction list written by putProgram, without canonicalizing it.
+// A denominator that is not positive marks the reader failed: no program
+// the parser accepts has one, and dividing by it would crash.
+inline std::vector<mpq_class> getProgram(Reader& in) {
+    std::vector<mpq_class> fractions;
+    std::uint64_t count = in.varint();
+    for (std::uint64_t i = 0; i < count && !in.failed; ++i) {
+        mpz_class num = in.mpz();
+        mpz_class den = in.mpz();
+        if (sgn(den) <= 0) {
+            in.failed = true;
+            break;
+        }
+        mpq_class frac;
+        mpq_set_num(frac.get_mpq_t(), num.get_mpz_t());
+        mpq_set_den(frac.get_mpq_t(), den.get_mpz_t());
+        fractions.push_back(frac);
+    }
+    return fractions;
+}
+
+// Identifies a program independently of how it was written down.
+inline std::uint64_t programHash(const std::vector<mpq_class>& fractions) {
+    std::string bytes;
+    putProgram(bytes, fractions);
+    return fnv1a(bytes.data(), bytes.size());
+}
+
+// Identifies a register base (RegisterProgram::primes), which depends on the
+// input as well as the fractions.
+inline std::uint64_t baseHash(const std::vector<mpz_class>& bases) {
+    std::string bytes;
+    putVarint(bytes, bases.size());
+    for (const auto& base : bases) putMpz(bytes, base);
+    return fnv1a(bytes.data(), bytes.size());
+}
+
+} // namespace binary
+
+#endif // BINARY_IO_H
@@ -0,0 +1,112 @@
+#ifndef CHECKPOINT_HISTORY_H
+#define CHECKPOINT_HISTORY_H
+
+#include <gmpxx.h>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+// Sparse history: the full state every `interval` entries, plus the index of
+// the fraction applied after every entry. Any entry is rebuilt by replaying
+// at most interval - 1 steps from the checkpoint before it, so `interval`
+// trades memory against access latency.
+class CheckpointHistory {
+public:
+    CheckpointHistory() = default;
+
+    CheckpointHistory(const std::vector<mpq_class>& fractions, size_t interval)
+        : every(interval == 0 ? 1 : interval) {
+        for (const auto& frac : fractions) {
+            numerators.push_back(frac.get_num());
+            denominators.push_back(frac.get_den());
+        }
+    }
+
+    size_t interval() const { return every; }
+    size_t size() const { return entries; }
+
+    // Appends the next entry. `state()` is only called when a checkpoint is due.
+    template <typename StateFn>
+    void record(StateFn&& state) {
+        if (entries % every == 0) checkpoints.push_back(state());
+        entries++;
+    }
+
+    // The fraction applied to the latest entry.
+    void transition(std::uint32_t fraction) { fractions.push_back(fraction); }
+
+    mpz_class getState(size_t i) const {
+        mpz_class state = checkpoints[i / every];
+        for (size_t step = (i / every) * every; step < i; ++step) advance(state, step);
+        return state;
+    }
+
+    // Turns the state of entry i into the state of entry i + 1.
+    void advance(mpz_class& state, size_t i) const {
+        std::uint32_t f = fractions[i];
+        mpz_divexact(state.get_mpz_t(), state.get_mpz_t(), denominators[f].get_mpz_t());
+        mpz_mul(state.get_mpz_t(), state.get_mpz_t(), numerators[f].get_mpz_t());
+    }
+
+    // Approximate bytes held: checkpoint limbs plus one index per step.
+    size_t memoryBytes() const {
+        size_t bytes = fractions.capacity() * sizeof(std::uint32_t);
+        for (const auto& c : checkpoints) bytes += sizeof(mpz_class) + mpz_size(c.get_mpz_t()) * sizeof(mp_limb_t);
+        return bytes;
+    }
+
+private:
+    size_t every = 1;
+    size_t entries = 0;
+    std::vector<mpz_class> checkpoints;
+    std::vector<std::uint32_t> fractions;
+    std::vector<mpz_class> numerators;
+    std::vector<mpz_class> denominators;
+};
+
+// Read-only, random-access view over a machine's history, whether it is
+// kept in full or as checkpoints. Elements are returned by value.
+class HistoryView {
+public:
+    class iterator {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = mpz_class;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = mpz_class;
+
+        // Sparse views replay one step per increment instead of seeking.
+        iterator(const HistoryView* view, size_t index) : view(view), index(index) {
+            if (view->sparse && index < view->size()) state = view->sparse->getState(index);
+        }
+        mpz_class operator*() const { return view->sparse ? state : (*view->full)[index]; }
+        iterator& operator++() {
+            if (view->sparse && index + 1 < view->size()) view->sparse->advance(state, index);
+            ++index;
+            return *this;
+        }
+        bool operator==(const iterator& other) const { return index == other.index; }
+        bool operator!=(const iterator& other) const { return index != other.index; }
+
+    private:
+        const HistoryView* view;
+        size_t index;
+        mpz_class state;
+    };
+
+    explicit HistoryView(const std::vector<mpz_class>& full) : full(&full) {}
+    explicit HistoryView(const CheckpointHistory& sparse) : sparse(&sparse) {}
+
+    size_t size() const { return full ? full->size() : sparse->size(); }
+    bool empty() const { return size() == 0; }
+    mpz_class operator[](size_t i) const { return full ? (*full)[i] : sparse->getState(i); }
+    iterator begin() const { return iterator(this, 0); }
+    iterator end() const { return iterator(this, size()); }
+
+private:
+    const std::vector<mpz_class>* full = nullptr;
+    const CheckpointHistory* sparse = nullptr;
+};
+
+#endif // CHECKPOINT_HISTORY_H
@@ -0,0 +1,120 @@
+#ifndef CYCLE_DETECTOR_H
+#define CYCLE_DETECTOR_H
+
+#include <cstdint>
+#include <vector>
+#include "register_program.h"
+
+// Where an exact periodic orbit starts and how long it is, in steps.
+struct CycleInfo {
+    bool found = false;
+    unsigned long long start = 0;  // step count at which the state first enters the cycle
+    unsigned long long period = 0;
+};
+
+// Brent's cycle detection over RegisterFractran states.
+//
+// States are compared through a linear hash H = sum(e_r * K_r) mod 2^64
+// that each fraction changes by a precomputed constant, so hashing costs one
+// addition per step. Registers are only compared when the hashes agree.
+// Apart from the state where detection began and Brent's saved state, no
+// memory is used. Once the period is known, the cycle start is found by
+// replaying from the starting state with two cursors `period` steps apart.
+class CycleDetector {
+public:
+    CycleDetector() = default;
+
+    explicit CycleDetector(const RegisterProgram& program) {
+        std::vector<std::uint64_t> keys(program.registerCount());
+        std::uint64_t seed = 0x9E3779B97F4A7C15ULL;
+        for (auto& k : keys) {
+            // splitmix64
+            std::uint64_t z = (seed += 0x9E3779B97F4A7C15ULL);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            k = z ^ (z >> 31);
+        }
+        for (const auto& terms : program.delta) {
+            std::uint64_t h = 0;
+            for (const auto& t : terms) h += static_cast<std::uint64_t>(t.exp) * keys[t.reg];
+            stepHash.push_back(h);
+        }
+        registerKeys = keys;
+    }
+
+    // Starts watching from the given state, reached after `steps` steps.
+    void start(const std::vector<std::int64_t>& registers, unsigned long long steps) {
+        origin = registers;
+        originSteps = steps;
+        saved = registers;
+        hash = 0;
+        for (size_t r = 0; r < registers.size(); ++r) {
+            hash += static_cast<std::uint64_t>(registers[r]) * registerKeys[r];
+        }
+        savedHash = hash;
+        power = 1;
+        lambda = 0;
+    }
+
+    // Call after each step with the fraction that fired and the new state.
+    // Returns true once the state repeats; result() then holds the cycle.
+    bool observe(const RegisterProgram& program, std::uint32_t fraction,
+                 const std::vector<std::int64_t>& registers) {
+        hash += stepHash[fraction];
+        lambda++;
+        if (hash == savedHash && registers == saved) {
+            locate(program, lambda);
+            return true;
+        }
+        if (lambda == power) {
+            saved = registers;
+            savedHash = hash;
+            power *= 2;
+            lambda = 0;
+        }
+        return false;
+    }
+
+    const CycleInfo& result() const { return info; }
+
+private:
+    static void stepFrom(const RegisterProgram& program, std::vector<std::int64_t>& regs) {
+        for (size_t f = 0; f < program.fractionCount(); ++f) {
+            bool fits = true;
+            for (const auto& t : program.require[f]) {
+                if (regs[t.reg] < t.exp) { fits = false; break; }
+            }
+            if (!fits) continue;
+            for (const auto& t : program.delta[f]) regs[t.reg] += t.exp;
+            return;
+        }
+    }
+
+    void locate(const RegisterProgram& program, unsigned long long period) {
+        std::vector<std::int64_t> tortoise = origin;
+        std::vector<std::int64_t> hare = origin;
+        for (unsigned long long i = 0; i < period; ++i) stepFrom(program, hare);
+        unsigned long long mu = 0;
+        while (tortoise != hare) {
+            stepFrom(program, tortoise);
+            stepFrom(program, hare);
+            mu++;
+        }
+        info.found = true;
+        info.start = originSteps + mu;
+        info.period = period;
+    }
+
+    std::vector<std::uint64_t> registerKeys;
+    std::vector<std::uint64_t> stepHash; // hash change of each fraction
+    std::vector<std::int64_t> origin;
+    std::vector<std::int64_t> saved;
+    unsigned long long originSteps = 0;
+    std::uint64_t hash = 0;
+    std::uint64_t savedHash = 0;
+    unsigned long long power = 1;
+    unsigned long long lambda = 0;
+    CycleInfo info;
+};
+
+#endif // CYCLE_DETECTOR_H
@@ -0,0 +1,110 @@
+#ifndef DISPATCH_INDEX_H
+#define DISPATCH_INDEX_H
+
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "register_program.h"
+
+// First-match dispatch for RegisterFractran. A fraction can only fire when
+// every register in its denominator is nonzero, so the bitmask of nonzero
+// registers selects a (much shorter) candidate list, still in program order.
+//
+// Only the first 64 registers have mask bits. Fractions that also need a
+// higher register stay in every list they could belong to and are checked
+// in full, which keeps first-match order exact for any register count.
+class DispatchIndex {
+public:
+    // Candidate lists are memoized per mask; once they hold this many fraction
+    // indices in total the table is reset. Counting entries rather than lists
+    // bounds memory for large programs, where one list can hold every fraction.
+    static constexpr size_t MAX_CANDIDATES = 1 << 22;
+    // Up to this many masked registers, masks index a flat table directly.
+    static constexpr size_t DENSE_BITS = 16;
+
+    struct Candidates {
+        std::vector<std::uint32_t> fractions;
+        std::vector<std::uint8_t> certain; // fires whenever it is a candidate (all exponents 1, all masked)
+    };
+
+    DispatchIndex() = default;
+
+    explicit DispatchIndex(const RegisterProgram& program) {
+        for (size_t f = 0; f < program.fractionCount(); ++f) {
+            std::uint64_t mask = 0;
+            bool exact = true;
+            for (const auto& t : program.require[f]) {
+                if (t.reg < 64) {
+                    mask |= std::uint64_t(1) << t.reg;
+                } else {
+                    exact = false;
+                }
+                if (t.exp != 1) exact = false;
+            }
+            required.push_back(mask);
+            single.push_back(exact);
+        }
+        if (program.registerCount() <= DENSE_BITS) {
+            dense.assign(size_t(1) << program.registerCount(), -1);
+        }
+    }
+
+    static std::uint64_t maskOf(const std::vector<std::int64_t>& registers) {
+        std::uint64_t mask = 0;
+        for (size_t r = 0; r < registers.size() && r < 64; ++r) {
+            if (registers[r] != 0) mask |= std::uint64_t(1) << r;
+        }
+        return mask;
+    }
+
+    // Fraction indices held by the memoized lists (at most MAX_CANDIDATES plus one list).
+    size_t storedCandidates() const { return stored; }
+
+    const Candidates& candidates(std::uint64_t mask) {
+        if (lastIndex >= 0 && lastMask == mask) return lists[lastIndex];
+
+        if (stored >= MAX_CANDIDATES) {
+            lists.clear();
+            sparse.clear();
+            std::fill(dense.begin(), dense.end(), -1);
+            stored = 0;
+        }
+        std::int32_t index;
+        if (!dense.empty()) {
+            index = dense[mask];
+            if (index < 0) index = dense[mask] = build(mask);
+        } else {
+            auto it = sparse.find(mask);
+            if (it == sparse.end()) it = sparse.emplace(mask, build(mask)).first;
+            index = it->second;
+        }
+        lastMask = mask;
+        lastIndex = index;
+        return lists[index];
+    }
+
+private:
+    std::int32_t build(std::uint64_t mask) {
+        Candidates list;
+        for (size_t f = 0; f < required.size(); ++f) {
+            if ((required[f] & ~mask) != 0) continue;
+            list.fractions.push_back(static_cast<std::uint32_t>(f));
+            list.certain.push_back(single[f]);
+        }
+        stored += list.fractions.size();
+        lists.push_back(std::move(list));
+        return static_cast<std::int32_t>(lists.size() - 1);
+    }
+
+    std::vector<std::uint64_t> required;
+    std::vector<bool> single;
+    std::vector<Candidates> lists;
+    std::vector<std::int32_t> dense;                        // mask -> list, when registers are few
+    std::unordered_map<std::uint64_t, std::int32_t> sparse; // mask -> list otherwise
+    size_t stored = 0;                                      // fraction indices in `lists`
+    std::uint64_t lastMask = 0;
+    std::int32_t lastIndex = -1;
+};
+
+#endif // DISPATCH_INDEX_H
@@ -0,0 +1,295 @@
+#ifndef FRAC_PARSER_H
+#define FRAC_PARSER_H
+
+#include <gmpxx.h>
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Loader for .frac program files, fast enough for generated programs with
+// hundreds of thousands of fractions. The file is memory-mapped and tokenized
+// in place; numbers that fit a machine word are read with std::from_chars and
+// only longer literals go through GMP. Big files are cut at line boundaries
+// and the pieces parsed on several threads.
+//
+// Per line: '#' starts a comment, tokens are separated by blanks or commas,
+// "Input: N" and "Steps: N" give the start integer and the step budget (the
+// last one in the file wins), and every other token is a fraction "a/b" or
+// an integer "a", i.e. a/1. Fractions are kept as written: 6/4 stays 6/4.
+
+struct FracParseError {
+    size_t line = 0;   // 1-based
+    size_t column = 0; // 1-based, in bytes
+    std::string message;
+
+    std::string describe(const std::string& path) const {
+        return path + ":" + std::to_string(line) + ":" + std::to_string(column) + ": " + message;
+    }
+};
+
+struct FracFile {
+    static constexpr size_t MAX_ERRORS = 20;
+
+    std::vector<mpq_class> fractions;
+    std::string input;                  // empty = not given
+    std::uint64_t steps = 0;            // 0 = not given
+    std::vector<FracParseError> errors; // the first MAX_ERRORS problems, in file order
+
+    bool ok() const { return errors.empty(); }
+};
+
+// A read-only view of a whole file: memory-mapped when possible, read into
+// memory otherwise (pipes, special files).
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        struct stat info;
+        if (::fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+            void* mapped = ::mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED) {
+                ::madvise(mapped, static_cast<size_t>(info.st_size), MADV_SEQUENTIAL);
+                mapping = mapped;
+                length = static_cast<size_t>(info.st_size);
+            }
+        }
+        if (!mapping) {
+            char chunk[1 << 16];
+            ssize_t n;
+            while ((n = ::read(fd, chunk, sizeof(chunk))) > 0) buffer.append(chunk, static_cast<size_t>(n));
+            if (n < 0) {
+                ::close(fd);
+                return;
+            }
+        }
+        ::close(fd);
+        open = true;
+    }
+
+    ~MappedFile() {
+        if (mapping) ::munmap(mapping, length);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool isOpen() const { return open; }
+    const char* data() const { return mapping ? static_cast<const char*>(mapping) : buffer.data(); }
+    size_t size() const { return mapping ? length : buffer.size(); }
+
+private:
+    void* mapping = nullptr;
+    size_t length = 0;
+    std::string buffer;
+    bool open = false;
+};
+
+namespace frac_detail {
+
+// Below this many bytes per thread the threads cost more than they save.
+constexpr size_t MIN_CHUNK_BYTES = 1 << 20;
+
+// One line-aligned piece of the file. Error lines count from the piece's
+// first line (0) until parseFracText shifts them.
+struct Chunk {
+    const char* begin = nullptr;
+    const char* end = nullptr;
+    size_t lines = 0; // newlines in [begin, end)
+    std::vector<mpq_class> fractions;
+    std::string input;
+    std::uint64_t steps = 0;
+    bool hasInput = false, hasSteps = false;
+    std::vector<FracParseError> errors;
+};
+
+inline bool isSeparator(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == ',' || c == '\v' || c == '\f';
+}
+
+inline bool allDigits(const char* p, const char* q) {
+    return p != q && std::all_of(p, q, [](char c) { return c >= '0' && c <= '9'; });
+}
+
+// Reads the decimal [p, q) into z: one from_chars when it fits a word, GMP
+// for longer literals. False unless [p, q) is all digits.
+inline bool readNatural(const char* p, const char* q, mpz_ptr z) {
+    unsigned long value = 0;
+    auto [last, ec] = std::from_chars(p, q, value);
+    if (ec == std::errc() && last == q) {
+        mpz_set_ui(z, value);
+        return true;
+    }
+    if (ec != std::errc::result_out_of_range || !allDigits(p, q)) return false;
+    return mpz_set_str(z, std::string(p, q).c_str(), 10) == 0;
+}
+
+// Parses "a/b", "-a/b" or "a" into `out`. Null on success, otherwise what is
+// wrong with the token.
+inline const char* readFraction(const char* p, const char* q, mpq_class& out) {
+    const char* slash = static_cast<const char*>(std::memchr(p, '/', static_cast<size_t>(q - p)));
+    bool negative = *p == '-';
+    if (!readNatural(p + negative, slash ? slash : q, mpq_numref(out.get_mpq_t()))) {
+        return "expected a fraction such as 3/2 or an integer";
+    }
+    if (negative) mpz_neg(mpq_numref(out.get_mpq_t()), mpq_numref(out.get_mpq_t()));
+    if (!slash) {
+        mpz_set_ui(mpq_denref(out.get_mpq_t()), 1);
+        return nullptr;
+    }
+    if (!readNatural(slash + 1, q, mpq_denref(out.get_mpq_t()))) return "bad denominator";
+    if (mpz_sgn(mpq_denref(out.get_mpq_t())) == 0) return "zero denominator";
+    return nullptr;
+}
+
+inline void parseChunk(Chunk& c) {
+    enum class Expect { Fraction, Input, Steps };
+    Expect expect = Expect::Fraction;
+    const char* directive = nullptr; // the "Input:" or "Steps:" waiting for its value
+    size_t directiveLine = 0;
+    const char* lineStart = c.begin;
+    const char* p = c.begin;
+    // Growing the vector moves every mpq_class, and a moved-from mpq_class
+    // allocates a fresh denominator; one per '/' is about right.
+    c.fractions.reserve(static_cast<size_t>(std::count(c.begin, c.end, '/')));
+
+    auto fail = [&](size_t line, const char* at, const char* start, std::string message) {
+        c.errors.push_back({line, static_cast<size_t>(at - start) + 1, std::move(message)});
+    };
+    auto missingValue = [&]() {
+        fail(directiveLine, directive, lineStart, std::string(expect == Expect::Input ? "Input:" : "Steps:") +
+                                                      " needs a value on the same line");
+        expect = Expect::Fraction;
+    };
+
+    while (p < c.end && c.errors.size() < FracFile::MAX_ERRORS) {
+        char ch = *p;
+        if (ch == '\n') {
+            if (expect != Expect::Fraction) missingValue();
+            ++c.lines;
+            lineStart = ++p;
+            continue;
+        }
+        if (isSeparator(ch)) {
+            ++p;
+            continue;
+        }
+        if (ch == '#') {
+            const char* newline = static_cast<const char*>(std::memchr(p, '\n', static_cast<size_t>(c.end - p)));
+            p = newline ? newline : c.end;
+            continue;
+        }
+
+        const char* token = p;
+        while (p < c.end && *p != '\n' && *p != '#' && !isSeparator(*p)) ++p;
+        size_t length = static_cast<size_t>(p - token);
+
+        if (expect == Expect::Input) {
+            if (allDigits(token, p)) {
+                c.input.assign(token, p);
+                c.hasInput = true;
+            } else {
+                fail(c.lines, token, lineStart, "Input: expects a non-negative integer");
+            }
+            expect = Expect::Fraction;
+        } else if (expect == Expect::Steps) {
+            std::uint64_t steps = 0;
+            auto [last, ec] = std::from_chars(token, p, steps);
+            if (ec == std::errc() && last == p) {
+                c.steps = steps;
+                c.hasSteps = true;
+            } else {
+                fail(c.lines, token, lineStart, "Steps: expects a step count below 2^64");
+            }
+            expect = Expect::Fraction;
+        } else if (length == 6 && std::memcmp(token, "Input:", 6) == 0) {
+            expect = Expect::Input;
+            directive = token;
+            directiveLine = c.lines;
+        } else if (length == 6 && std::memcmp(token, "Steps:", 6) == 0) {
+            expect = Expect::Steps;
+            directive = token;
+            directiveLine = c.lines;
+        } else {
+            c.fractions.emplace_back();
+            if (const char* problem = readFraction(token, p, c.fractions.back())) {
+                c.fractions.pop_back();
+                fail(c.lines, token, lineStart, std::string(problem) + ": '" + std::string(token, p) + "'");
+            }
+        }
+    }
+    if (expect != Expect::Fraction && c.errors.size() < FracFile::MAX_ERRORS) missingValue();
+    // Stopped early at MAX_ERRORS: later pieces still need the line count.
+    c.lines += static_cast<size_t>(std::count(p, c.end, '\n'));
+}
+
+} // namespace frac_detail
+
+// Parses .frac text. `threads` = 0 picks one per core, but a thread only gets
+// a piece of at least MIN_CHUNK_BYTES, so small programs parse on this thread.
+inline FracFile parseFracText(const char* data, size_t size, unsigned threads = 0) {
+    using frac_detail::Chunk;
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t pieces = std::max<size_t>(1, std::min<size_t>(threads, size / frac_detail::MIN_CHUNK_BYTES));
+
+    std::vector<Chunk> chunks(pieces);
+    const char* begin = data;
+    const char* end = data + size;
+    for (size_t i = 0; i < pieces; ++i) {
+        const char* cut = (i + 1 == pieces) ? end : data + size / pieces * (i + 1);
+        if (cut < begin) cut = begin;
+        const char* newline = static_cast<const char*>(std::memchr(cut, '\n', static_cast<size_t>(end - cut)));
+        cut = (i + 1 == pieces || !newline) ? end : newline + 1;
+        chunks[i].begin = begin;
+        chunks[i].end = cut;
+        begin = cut;
+    }
+
+    if (pieces == 1) {
+        frac_detail::parseChunk(chunks[0]);
+    } else {
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < pieces; ++i) workers.emplace_back(frac_detail::parseChunk, std::ref(chunks[i]));
+        frac_detail::parseChunk(chunks[0]);
+        for (auto& worker : workers) worker.join();
+    }
+
+    FracFile file;
+    size_t total = 0;
+    for (const auto& chunk : chunks) total += chunk.fractions.size();
+    if (pieces == 1) file.fractions.swap(chunks[0].fractions);
+    file.fractions.reserve(total);
+    size_t firstLine = 1;
+    for (auto& chunk : chunks) {
+        std::move(chunk.fractions.begin(), chunk.fractions.end(), std::back_inserter(file.fractions));
+        if (chunk.hasInput) file.input = std::move(chunk.input);
+        if (chunk.hasSteps) file.steps = chunk.steps;
+        for (auto& error : chunk.errors) {
+            if (file.errors.size() == FracFile::MAX_ERRORS) break;
+            error.line += firstLine;
+            file.errors.push_back(std::move(error));
+        }
+        firstLine += chunk.lines;
+    }
+    return file;
+}
+
+// False if the file cannot be read; syntax errors end up in out.errors.
+inline bool loadFracFile(const std::string& path, FracFile& out, unsigned threads = 0) {
+    MappedFile file(path);
+    if (!file.isOpen()) return false;
+    out = parseFracText(file.data(), file.size(), threads);
+    return true;
+}
+
+#endif // FRAC_PARSER_H
@@ -2,83 +2,561 @@
 #define FRACTRAN_H
 
 #include <gmpxx.h>
+#include <chrono>
+#include <cstdint>
 #include <iostream>
+#include <iterator>
+#include <limits>
 #include <vector>
+#include "binary_io.h"
+#include "checkpoint_history.h"
+#include "limb_pool.h"
+#include "output_writer.h"
+#include "run_control.h"
+#include "run_stats.h"
+#include "snapshot.h"
+#include "state_notation.h"
+#include "trace.h"
+
+// How runMachine does its GMP arithmetic. Both modes produce identical runs.
+enum class ArithmeticMode {
+    Reference, // original loop: num/den temporaries, then modulo, divide and multiply
+    InPlace,   // precomputed operands, divisibility test, exact division into scratch
+    Native     // uint64_t state with 128-bit overflow checks, InPlace while it does not fit
+};
+
+// Native mode moves the word in and out of GMP as one unsigned long
+// (mpz_set_ui, mpz_get_ui) and one limb (mpz_size <= 1).
+static_assert(sizeof(unsigned long) == 8 && GMP_NUMB_BITS == 64,
+              "ArithmeticMode::Native needs 64-bit unsigned long and 64-bit GMP limbs");
+
+class Fractran;
+
+// One step taken through Fractran::steps(): the fraction applied and the
+// step count including it. state() is the machine's state after the step,
+// valid until the next one.
+struct StepEvent {
+    std::uint32_t fraction = 0;
+    unsigned long long step = 0;
+    Fractran* machine = nullptr;
+
+    const mpz_class& state() const;
+};
 
 class Fractran {
 public:
-    Fractran(const std::vector<mpq_class>& fractions, mpz_class num, bool enableHistory = false) {
+    class StepIterator;
+    class StepRange;
+
+    Fractran(const std::vector<mpq_class>& fractions, mpz_class num, bool enableHistory = false,
+             ArithmeticMode arithmetic = ArithmeticMode::Native) {
         fractionList = fractions;
         integer = num;
         halted = false;
         totalSteps = 0;
         recordHistory = enableHistory;
+        mode = arithmetic;
+
+        // Split the fractions once so the step loop never builds temporaries.
+        // Operands that fit a machine word use GMP's *_ui entry points.
+        for (const auto& frac : fractionList) {
+            numerators.push_back(frac.get_num());
+            denominators.push_back(frac.get_den());
+            smallNumerator.push_back(numerators.back().fits_ulong_p());
+            smallDenominator.push_back(denominators.back().fits_ulong_p());
+        }
+
+        native = false;
+        word = 0;
+        if (mode == ArithmeticMode::Native) demoteIfSmall();
     }
 
-    void runMachine(int steps);
-    void printSequence();
+    void runMachine(std::uint64_t steps);
+    // Runs until the budget, the deadline, a halt or an observer stops it.
+    StopReason run(const RunLimits& limits);
+    // The rest of the run as a lazy range of at most `limit` steps, e.g.
+    //
+    //   for (const StepEvent& s : machine.steps(1000))
+    //       if (s.fraction == 13) { ... s.state() ... break; }
+    //
+    // Each increment takes one step, with the same history, trace and stats
+    // bookkeeping as run(); nothing is buffered or allocated per step. Leaving
+    // the loop early leaves the machine where it is. An input range: every
+    // begin() continues from the machine's current state.
+    StepRange steps(std::uint64_t limit = std::numeric_limits<std::uint64_t>::max());
+    // The state as a reference, without copying it (Native mode writes the
+    // word into the integer first). Valid until the next step.
+    const mpz_class& currentState();
+    // Factored and Binary notation factor the first state only and replay
+    // the rest on exponents (StateReplay).
+    void printSequence(Notation notation = Notation::Decimal);
     
     bool isHalted() const { return halted; }
-    mpz_class getLastNumber() const { return integer; }
-    const std::vector<mpz_class>& getHistory() const { return numberList; }
+    mpz_class getLastNumber() const { return native ? mpz_class(static_cast<unsigned long>(word)) : integer; }
+    // With sparse history this expands every entry on first use; prefer historyView().
+    const std::vector<mpz_class>& getHistory() const;
+    HistoryView historyView() const {
+        return recordSparse ? HistoryView(sparseHistory) : HistoryView(numberList);
+    }
     unsigned long long getStepCount() const { return totalSteps; }
+    // True if the state is p^exponent (exponent 0 for the state 1).
+    bool isPowerOf(unsigned long p, std::uint64_t& exponent) const;
+
+    // Keep a checkpoint every `interval` entries plus one fraction index per
+    // step instead of every state. Replaces full history for later steps.
+    // Returns false (and changes nothing) while fused chains are set: a step
+    // ending inside a chain has no fraction index to replay.
+    bool enableSparseHistory(size_t interval) {
+        if (!chains.empty()) return false;
+        sparseHistory = CheckpointHistory(fractionList, interval);
+        recordSparse = true;
+        recordHistory = false;
+        numberList.clear();
+        historyArena.reset();
+        return true;
+    }
+    const CheckpointHistory& getSparseHistory() const { return sparseHistory; }
+    // Where full history keeps its limbs when the limb pool is installed; null otherwise.
+    const limb_pool::LimbArena* getHistoryArena() const { return historyArena.peek(); }
+
+    // Runs the fused chains of optimizeProgram (program_optimizer.h): fraction
+    // f stands for prefix[f].size() + 1 steps of the original program, and
+    // prefix[f][k] is the numerator that stops after k + 1 of them, used when a
+    // budget ends inside the chain. Step counts stay those of the original
+    // program; history, stats and observers see one entry per fraction fired.
+    // Returns false (and changes nothing) while sparse history or a trace sink
+    // records the run, for the same reason as enableSparseHistory.
+    bool setFusedChains(std::vector<std::vector<mpz_class>> prefix) {
+        if (recordSparse || traceSink) return false;
+        chains = std::move(prefix);
+        chains.resize(fractionList.size());
+        longestChain = 1;
+        for (const auto& chain : chains) longestChain = std::max<std::uint64_t>(longestChain, chain.size() + 1);
+        return true;
+    }
+
+    // Streams every step to `sink` (not owned; nullptr to detach). Returns
+    // false (and changes nothing) while fused chains are set.
+    bool setTraceSink(TraceSink* sink) {
+        if (sink && !chains.empty()) return false;
+        traceSink = sink;
+        return true;
+    }
+
+    // Opt-in: count fraction hits and scan lengths on every step, and sample
+    // the state size and step latency every `sampleEvery` steps. Restarts the
+    // counts. Does nothing when built with FRACTRAN_STATS=0.
+    void enableStats(unsigned sampleEvery = 256) {
+        if (STATS_COMPILED_IN) stats.start(fractionList.size(), sampleEvery);
+    }
+    const RunStats& getStats() const { return stats; }
+
+    // The state, step count and halted flag, enough to continue the run later.
+    Snapshot snapshot() const;
+    // Continues from a snapshot of the same fractions; history restarts at the
+    // restored state. Returns false (and changes nothing) for another program
+    // or a register-engine snapshot.
+    bool restore(const Snapshot& snap);
 
 private:
+    // Each applies the first fraction that fits and returns its index, or -1.
+    long stepReference();
+    long stepInPlace();
+    long stepNative();
+    long stepTiered();
+    long step();
+    // One step with all bookkeeping (history, stats, trace, sparse history);
+    // the fraction applied, or -1 after marking the machine halted. Takes at
+    // most `allowed` steps of a fused chain.
+    long advance(std::uint64_t allowed);
+    long stepPartial(std::uint64_t allowed, std::uint64_t& taken);
+    size_t stateBits() const;
+    void promote(unsigned __int128 value);
+    void demoteIfSmall();
+
     std::vector<mpq_class> fractionList;
+    std::vector<mpz_class> numerators;
+    std::vector<mpz_class> denominators;
+    std::vector<bool> smallNumerator;
+    std::vector<bool> smallDenominator;
+    mpz_class scratch; // quotient buffer reused across steps
+    ArithmeticMode mode;
+    bool native;        // Native mode: state lives in `word`, `integer` is stale
+    std::uint64_t word;
     mpz_class integer;
+    limb_pool::ArenaHandle historyArena; // holds numberList's limbs while the limb pool is installed
     std::vector<mpz_class> numberList;
     bool halted;
     unsigned long long totalSteps;
     bool recordHistory;
+    TraceSink* traceSink = nullptr;
+    CheckpointHistory sparseHistory;
+    bool recordSparse = false;
+    mutable std::vector<mpz_class> expandedHistory; // getHistory() in sparse mode
+    RunStats stats;
+    std::vector<std::vector<mpz_class>> chains; // setFusedChains; empty = one step per fraction
+    std::uint64_t longestChain = 1;
+};
+
+class Fractran::StepIterator {
+public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = StepEvent;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const StepEvent*;
+    using reference = const StepEvent&;
+
+    StepIterator() = default; // the end of every range
+
+    reference operator*() const { return event; }
+    pointer operator->() const { return &event; }
+    StepIterator& operator++() {
+        next();
+        return *this;
+    }
+    // Only "still running" and "done" are told apart, as with istream_iterator.
+    bool operator==(const StepIterator& other) const { return event.machine == other.event.machine; }
+    bool operator!=(const StepIterator& other) const { return !(*this == other); }
+
+private:
+    friend class StepRange;
+    StepIterator(Fractran* machine, std::uint64_t limit) : left(limit) {
+        event.machine = machine;
+        next();
+    }
+
+    void next() {
+        unsigned long long before = event.machine->totalSteps;
+        long fired = left > 0 ? event.machine->advance(left) : -1;
+        if (fired < 0) {
+            event.machine = nullptr;
+            return;
+        }
+        left -= event.machine->totalSteps - before;
+        event.fraction = static_cast<std::uint32_t>(fired);
+        event.step = event.machine->totalSteps;
+    }
+
+    std::uint64_t left = 0;
+    StepEvent event;
+};
+
+class Fractran::StepRange {
+public:
+    StepRange(Fractran* machine, std::uint64_t limit) : machine(machine), limit(limit) {}
+
+    // Takes the first step.
+    StepIterator begin() { return machine->halted ? StepIterator() : StepIterator(machine, limit); }
+    StepIterator end() { return StepIterator(); }
+
+private:
+    Fractran* machine;
+    std::uint64_t limit;
 };
 
-inline void Fractran::runMachine(int steps) {
-    if (halted) return;
+inline const mpz_class& StepEvent::state() const { return machine->currentState(); }
 
-    bool match_found = true;
-    int current_batch_steps = 0;
+inline Fractran::StepRange Fractran::steps(std::uint64_t limit) { return StepRange(this, limit); }
 
-    while (current_batch_steps < steps && match_found) {
-        if (recordHistory) {
-            numberList.push_back(integer);
+inline const mpz_class& Fractran::currentState() {
+    if (native) mpz_set_ui(integer.get_mpz_t(), static_cast<unsigned long>(word));
+    return integer;
+}
+
+inline long Fractran::stepReference() {
+    long index = 0;
+    for (const auto& frac : fractionList) {
+        mpz_class num = frac.get_num();
+        mpz_class den = frac.get_den();
+
+        if (integer % den == 0) {
+            integer = (integer / den) * num;
+            return index;
         }
-        
-        match_found = false;
+        index++;
+    }
+    return -1;
+}
 
-        for (const auto& frac : fractionList) {
-            mpz_class num = frac.get_num();
-            mpz_class den = frac.get_den();
-
-            if (integer % den == 0) {
-                integer = (integer / den) * num;
-                match_found = true;
-                current_batch_steps++;
-                totalSteps++; 
-                break; 
-            }
+inline long Fractran::stepInPlace() {
+    mpz_ptr x = integer.get_mpz_t();
+    const size_t count = denominators.size();
+
+    for (size_t f = 0; f < count; ++f) {
+        if (smallDenominator[f]) {
+            unsigned long d = denominators[f].get_ui();
+            if (!mpz_divisible_ui_p(x, d)) continue;
+            mpz_divexact_ui(x, x, d);
+        } else {
+            mpz_srcptr d = denominators[f].get_mpz_t();
+            if (!mpz_divisible_p(x, d)) continue;
+            mpz_divexact(scratch.get_mpz_t(), x, d);
+            mpz_swap(x, scratch.get_mpz_t());
         }
+
+        if (smallNumerator[f]) {
+            mpz_mul_ui(x, x, numerators[f].get_ui());
+        } else {
+            mpz_mul(scratch.get_mpz_t(), x, numerators[f].get_mpz_t());
+            mpz_swap(x, scratch.get_mpz_t());
+        }
+        return static_cast<long>(f);
     }
+    return -1;
+}
 
-    if (!match_found) {
+inline void Fractran::promote(unsigned __int128 value) {
+    mpz_ptr x = integer.get_mpz_t();
+    mpz_set_ui(x, static_cast<unsigned long>(value >> 64));
+    mpz_mul_2exp(x, x, 64);
+    mpz_add_ui(x, x, static_cast<unsigned long>(value));
+    native = false;
+}
+
+inline void Fractran::demoteIfSmall() {
+    mpz_srcptr x = integer.get_mpz_t();
+    if (mpz_sgn(x) >= 0 && mpz_size(x) <= 1) {
+        word = mpz_get_ui(x);
+        native = true;
+    }
+}
+
+inline long Fractran::stepNative() {
+    const size_t count = denominators.size();
+
+    for (size_t f = 0; f < count; ++f) {
+        // A denominator wider than a word can only divide zero.
+        std::uint64_t q;
+        if (smallDenominator[f]) {
+            std::uint64_t d = denominators[f].get_ui();
+            if (word % d != 0) continue;
+            q = word / d;
+        } else {
+            if (word != 0) continue;
+            q = 0;
+        }
+
+        if (!smallNumerator[f]) {
+            // Negative or wide numerator: finish the step in GMP.
+            promote(q);
+            mpz_mul(integer.get_mpz_t(), integer.get_mpz_t(), numerators[f].get_mpz_t());
+            demoteIfSmall();
+            return static_cast<long>(f);
+        }
+
+        unsigned __int128 product = static_cast<unsigned __int128>(q) * numerators[f].get_ui();
+        if (product >> 64) {
+            promote(product);
+        } else {
+            word = static_cast<std::uint64_t>(product);
+        }
+        return static_cast<long>(f);
+    }
+    return -1;
+}
+
+inline long Fractran::stepTiered() {
+    if (native) return stepNative();
+    long matched = stepInPlace();
+    demoteIfSmall();
+    return matched;
+}
+
+inline long Fractran::step() {
+    switch (mode) {
+        case ArithmeticMode::Reference: return stepReference();
+        case ArithmeticMode::InPlace:   return stepInPlace();
+        default:                        return stepTiered();
+    }
+}
+
+inline size_t Fractran::stateBits() const {
+    if (native) return word == 0 ? 0 : 64 - static_cast<size_t>(__builtin_clzll(word));
+    return mpz_sgn(integer.get_mpz_t()) == 0 ? 0 : mpz_sizeinbase(integer.get_mpz_t(), 2);
+}
+
+inline void Fractran::runMachine(std::uint64_t steps) {
+    RunLimits limits;
+    limits.steps = steps;
+    run(limits);
+}
+
+// A step that may end inside a fused chain: the slow path for the last
+// steps of a budget.
+inline long Fractran::stepPartial(std::uint64_t allowed, std::uint64_t& taken) {
+    if (native) {
+        mpz_set_ui(integer.get_mpz_t(), static_cast<unsigned long>(word));
+        native = false;
+    }
+    mpz_ptr x = integer.get_mpz_t();
+    for (size_t f = 0; f < denominators.size(); ++f) {
+        if (!mpz_divisible_p(x, denominators[f].get_mpz_t())) continue;
+        const std::vector<mpz_class>& prefix = chains[f];
+        taken = std::min<std::uint64_t>(allowed, prefix.size() + 1);
+        mpz_divexact(x, x, denominators[f].get_mpz_t());
+        mpz_mul(x, x, (taken <= prefix.size() ? prefix[taken - 1] : numerators[f]).get_mpz_t());
+        if (mode == ArithmeticMode::Native) demoteIfSmall();
+        return static_cast<long>(f);
+    }
+    if (mode == ArithmeticMode::Native) demoteIfSmall();
+    return -1;
+}
+
+inline long Fractran::advance(std::uint64_t allowed) {
+    if (recordHistory) {
+        limb_pool::LimbArena::Scope arena(historyArena.get());
+        numberList.push_back(getLastNumber());
+    }
+    if (recordSparse) {
+        sparseHistory.record([this] { return getLastNumber(); });
+    }
+
+    const bool collect = STATS_COMPILED_IN && stats.enabled;
+    long fired;
+    std::uint64_t taken = 1;
+    if (allowed < longestChain) {
+        fired = stepPartial(allowed, taken);
+    } else if (collect && stats.sampleDue(totalSteps)) {
+        auto before = std::chrono::steady_clock::now();
+        fired = step();
+        auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - before);
+        stats.recordSample(totalSteps, stateBits(), static_cast<unsigned long long>(nanos.count()));
+    } else {
+        fired = step();
+    }
+    if (collect) stats.recordStep(fired);
+
+    if (fired < 0) {
         halted = true;
+        return -1;
+    }
+    if (!chains.empty() && allowed >= longestChain) taken = chains[static_cast<size_t>(fired)].size() + 1;
+    totalSteps += taken;
+    if (traceSink) traceSink->onStep(static_cast<std::uint32_t>(fired));
+    if (recordSparse) sparseHistory.transition(static_cast<std::uint32_t>(fired));
+    return fired;
+}
+
+inline StopReason Fractran::run(const RunLimits& limits) {
+    if (halted) return StopReason::Halted;
+
+    const bool collect = STATS_COMPILED_IN && stats.enabled;
+    std::chrono::steady_clock::time_point runStart;
+    if (collect) runStart = std::chrono::steady_clock::now();
+
+    const bool timed = limits.hasDeadline();
+    const bool observed = !limits.observers.empty();
+    StopReason reason = StopReason::Budget;
+    std::uint64_t done = 0;
+
+    if (timed && std::chrono::steady_clock::now() >= limits.deadline) return StopReason::Deadline;
+    for (const StepEvent& event : steps(limits.steps)) {
+        done++;
+        if (observed && limits.notify(event.fraction)) {
+            reason = StopReason::Predicate;
+            break;
+        }
+        if (timed && done % RunLimits::DEADLINE_CHECK_EVERY == 0 && done < limits.steps &&
+            std::chrono::steady_clock::now() >= limits.deadline) {
+            reason = StopReason::Deadline;
+            break;
+        }
+    }
+    if (reason == StopReason::Budget && halted) reason = StopReason::Halted;
+
+    if (collect) {
+        stats.runNanos += static_cast<unsigned long long>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - runStart).count());
     }
+    return reason;
 }
 
-inline void Fractran::printSequence() {
-    if (!recordHistory) {
+inline bool Fractran::isPowerOf(unsigned long p, std::uint64_t& exponent) const {
+    exponent = 0;
+    if (native) {
+        std::uint64_t w = word;
+        if (w == 0) return false;
+        while (w % p == 0) {
+            w /= p;
+            exponent++;
+        }
+        return w == 1;
+    }
+    mpz_srcptr x = integer.get_mpz_t();
+    if (mpz_sgn(x) <= 0) return false;
+    if (p == 2) {
+        if (mpz_popcount(x) != 1) return false;
+        exponent = mpz_scan1(x, 0);
+        return true;
+    }
+    if (!mpz_divisible_ui_p(x, p)) return mpz_cmp_ui(x, 1) == 0;
+    mpz_class rest, prime(p);
+    exponent = mpz_remove(rest.get_mpz_t(), x, prime.get_mpz_t());
+    return rest == 1;
+}
+
+inline Snapshot Fractran::snapshot() const {
+    Snapshot snap;
+    snap.kind = Snapshot::Kind::Integer;
+    snap.programHash = binary::programHash(fractionList);
+    snap.steps = totalSteps;
+    snap.halted = halted;
+    snap.state = getLastNumber();
+    return snap;
+}
+
+inline bool Fractran::restore(const Snapshot& snap) {
+    if (snap.kind != Snapshot::Kind::Integer || snap.programHash != binary::programHash(fractionList)) {
+        return false;
+    }
+    integer = snap.state;
+    totalSteps = snap.steps;
+    halted = snap.halted;
+    native = false;
+    if (mode == ArithmeticMode::Native) demoteIfSmall();
+    numberList.clear();
+    historyArena.reset();
+    expandedHistory.clear();
+    if (recordSparse) sparseHistory = CheckpointHistory(fractionList, sparseHistory.interval());
+    return true;
+}
+
+inline const std::vector<mpz_class>& Fractran::getHistory() const {
+    if (!recordSparse) return numberList;
+    if (expandedHistory.size() != sparseHistory.size()) {
+        expandedHistory.clear();
+        for (const auto& state : historyView()) expandedHistory.push_back(state);
+    }
+    return expandedHistory;
+}
+
+inline void Fractran::printSequence(Notation notation) {
+    bool history = recordHistory || recordSparse;
+    if (!history && notation != Notation::Binary) {
         std::cout << "History disabled for this run (pass 'true' to constructor to enable)." << std::endl;
         // Still print the final number so the user isn't completely blind
-        std::cout << "Final Value: " << integer << std::endl;
+        if (notation == Notation::Factored) {
+            StateReplay last(fractionList, getLastNumber());
+            std::cout << "Final Value: " << factoredString(last.bases(), last.exponents(), last.getCofactor()) << std::endl;
+        } else {
+            std::cout << "Final Value: " << getLastNumber() << std::endl;
+        }
         return;
     }
-    for (const auto& i : numberList) {
-        std::cout << i << ", ";
+    HistoryView view = historyView();
+    if (notation == Notation::Decimal) {
+        writeSequence(std::cout, view, halted);
+        return;
     }
-    if (halted) {
-        std::cout << "HALT" << std::endl;
-    } else {
-        std::cout << "..." << std::endl;
+    // Without history a binary stream holds just the last state.
+    size_t count = history ? view.size() : 1;
+    StateReplay replay(fractionList, count > 0 && history ? view[0] : getLastNumber());
+    StateWriter writer(std::cout, notation, replay.bases());
+    for (size_t i = 0; i < count; ++i) {
+        if (i > 0) replay.step();
+        writer.add(replay.exponents(), replay.getCofactor());
     }
+    writer.finish(halted);
 }
 
 #endif // FRACTRAN_H
@@ -1,16 +1,449 @@
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <memory>
 #include <vector>
 #include <string>
+#include <type_traits>
 #include "fractran.h"
+#include "register_fractran.h"
 #include "arg_parser.h"
+#include "limb_pool.h"
+#include "output_writer.h"
+#include "program_optimizer.h"
+#include "sweep.h"
+
+// Engine-specific settings.
+void configure(Fractran& machine, const FractranConfig& config) {
+    if (config.sparseHistory > 0 && config.history) machine.enableSparseHistory(config.sparseHistory);
+    if (config.stats) machine.enableStats();
+    if (!config.fusedChains.empty()) machine.setFusedChains(config.fusedChains);
+}
+
+void configure(RegisterFractran& machine, const FractranConfig& config) {
+    if (config.match == "linear") machine.setMatchStrategy(MatchStrategy::Linear);
+    if (config.match == "simd") machine.setMatchStrategy(MatchStrategy::Simd);
+    machine.setLoopAcceleration(config.accelerate);
+    if (config.cacheBlock > 0) machine.enableMacroCache(config.cacheBlock);
+    machine.setCycleDetection(config.detectCycles);
+    std::string error;
+    if (config.jit && !machine.enableJit(error)) {
+        std::cerr << "Warning: JIT unavailable, interpreting instead (" << error << ")" << std::endl;
+    }
+}
+
+// Where the header and summary go: stderr with --primes and with
+// --notation=binary, whose stdout is nothing but the primes or the states.
+std::ostream& console(const FractranConfig& config) {
+    return (config.primes || config.notation == "binary") ? std::cerr : std::cout;
+}
+
+Notation notation(const FractranConfig& config) {
+    if (config.notation == "factored") return Notation::Factored;
+    if (config.notation == "binary") return Notation::Binary;
+    return Notation::Decimal;
+}
+
+// A single state for the header and summary lines, factored over the
+// program's registers unless the notation is decimal.
+std::string describeState(const FractranConfig& config, const mpz_class& state) {
+    if (notation(config) == Notation::Decimal) return state.get_str();
+    StateReplay factored(config.program, state);
+    return factoredString(factored.bases(), factored.exponents(), factored.getCofactor());
+}
+
+// Engine-specific statistics printed after the run.
+void report(const Fractran& machine, const FractranConfig& config) {
+    if (!config.stats) return;
+    if (!STATS_COMPILED_IN) {
+        console(config) << "Stats:       not available (built with FRACTRAN_STATS=0)" << std::endl;
+        return;
+    }
+    machine.getStats().print(console(config), config.program);
+}
+
+void report(const RegisterFractran& machine, const FractranConfig& config) {
+    std::ostream& out = console(config);
+    if (const JitProgram* jit = machine.getJit()) {
+        out << "JIT:         " << (jit->fromCache() ? "cached " : "compiled ") << jit->libraryPath() << std::endl;
+    }
+    if (machine.getCycle().found) {
+        out << "Cycle:       enters at step " << machine.getCycle().start
+            << ", period " << machine.getCycle().period << std::endl;
+    }
+    if (config.cacheBlock == 0) return;
+    const auto& stats = machine.getMacroCacheStats();
+    out << "Cache:       " << stats.hits << " hits, " << stats.misses << " misses, "
+        << stats.evictions << " evictions, " << stats.entries << " entries ("
+        << stats.bytes << " bytes)" << std::endl;
+}
+
+// --limb-pool: GMP's heap traffic on this thread, and the history arena.
+template <typename Machine>
+void reportLimbPool(const Machine& machine, const FractranConfig& config) {
+    if (!config.limbPool) return;
+    const limb_pool::Stats& stats = limb_pool::stats();
+    std::ostream& out = console(config);
+    out << "Limb pool:   " << stats.allocations << " allocations (" << stats.bytes << " bytes), " << stats.poolHits
+        << " from free lists, " << stats.arenaAllocations << " in arenas, " << stats.systemAllocations
+        << " malloc calls (" << stats.systemBytes << " bytes)" << std::endl;
+    if constexpr (std::is_same_v<Machine, Fractran>) {
+        if (const limb_pool::LimbArena* arena = machine.getHistoryArena()) {
+            out << "History:     " << arena->bytesUsed() << " bytes in " << arena->chunkCount() << " arena chunks"
+                << std::endl;
+        }
+    }
+}
+
+// --optimize: replaces config.program with the optimized program and prints
+// the report. The input-based passes are skipped when the run does not start
+// from config.input (sweeps) or must match a snapshot (checkpoint, resume), and
+// chains are only fused where nothing needs to see every single step.
+bool optimize(FractranConfig& config, std::ostream& out) {
+    bool sweeping = !config.sweepRange.empty() || !config.sweepFile.empty();
+    OptimizerOptions options;
+    if (!sweeping && config.checkpointPath.empty() && config.resumePath.empty()) options.input = &config.input;
+    options.fuse = config.engine == "gmp" && !config.history && config.tracePath.empty() && config.sparseHistory == 0 &&
+                   !config.stats && config.stopKind.empty() && config.observePrime == 0 && !config.primes;
+
+    OptimizedProgram optimized = optimizeProgram(config.program, options);
+    optimized.print(out, config.program, options.input ? estimateSpeedup(config.program, optimized, config.input) : 0);
+    if (config.stopKind == "fraction" && config.stopValue < config.program.size()) {
+        long index = optimized.newIndex[config.stopValue];
+        if (index < 0) {
+            std::cerr << "Error: --stop-at fraction " << config.stopValue << " never fires (removed by --optimize)" << std::endl;
+            return false;
+        }
+        config.stopValue = static_cast<unsigned long>(index);
+    }
+    config.program = optimized.fractions;
+    config.fusedChains = optimized.chains;
+    config.factored.reset(); // factors the original fractions
+    return true;
+}
+
+// Loads config.resumePath into the machine. A missing file is a fresh start,
+// so the same command line can be rerun until the job finishes.
+template <typename Machine>
+bool resume(Machine& machine, const FractranConfig& config) {
+    if (!std::filesystem::exists(config.resumePath)) {
+        console(config) << "Resume:      no snapshot at " << config.resumePath << ", starting from step 0" << std::endl;
+        return true;
+    }
+    Snapshot snap;
+    std::string error;
+    if (!readSnapshot(config.resumePath, snap, error)) {
+        std::cerr << "Error: " << error << std::endl;
+        return false;
+    }
+    if (!machine.restore(snap)) {
+        std::cerr << "Error: " << config.resumePath << " was saved from a different program or engine"
+                  << (std::is_same<Machine, RegisterFractran>::value ? ", or with another register base (input)" : "")
+                  << std::endl;
+        return false;
+    }
+    console(config) << "Resume:      continuing from step " << snap.steps << std::endl;
+    return true;
+}
+
+// Runs up to config.steps in total, within `limits` otherwise. With a
+// checkpoint file the run is split into chunks and a snapshot is handed to a
+// background writer after each one.
+template <typename Machine>
+bool run(Machine& machine, const FractranConfig& config, RunLimits limits, StopReason& reason) {
+    std::uint64_t done = machine.getStepCount();
+    std::uint64_t remaining = config.steps > done ? config.steps - done : 0;
+    if (config.checkpointPath.empty()) {
+        limits.steps = remaining;
+        reason = machine.run(limits);
+        return true;
+    }
+
+    SnapshotWriter checkpoint(config.checkpointPath);
+    reason = machine.isHalted() ? StopReason::Halted : StopReason::Budget;
+    while (remaining > 0 && reason == StopReason::Budget) {
+        limits.steps = std::min(remaining, config.checkpointEvery);
+        unsigned long long before = machine.getStepCount();
+        reason = machine.run(limits);
+        remaining -= machine.getStepCount() - before;
+        checkpoint.submit(machine.snapshot());
+    }
+    if (!checkpoint.finish()) {
+        std::cerr << "Error: failed writing checkpoint " << config.checkpointPath << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// One --observe or --primes line: "step N: P^exponent", or just the exponent.
+struct PowerEvent {
+    std::uint64_t step = 0;
+    std::uint64_t exponent = 0;
+    bool observed = false; // from --observe rather than --primes
+};
+
+// The register engine starts from the program cache's factorization, if any.
+template <typename Machine>
+Machine makeMachine(const FractranConfig& config) {
+    if constexpr (std::is_same_v<Machine, RegisterFractran>) {
+        return RegisterFractran(config.program, config.input, config.history, config.factored.get());
+    } else {
+        return Machine(config.program, config.input, config.history);
+    }
+}
+
+// Runs the configured program on any engine exposing the Fractran interface.
+template <typename Machine>
+bool execute(const FractranConfig& config) {
+    Machine machine = makeMachine<Machine>(config);
+    configure(machine, config);
+    if (!config.resumePath.empty() && !resume(machine, config)) return false;
+
+    std::unique_ptr<TraceWriter> trace;
+    if (!config.tracePath.empty()) {
+        trace = std::make_unique<TraceWriter>(config.tracePath, config.program, machine.getLastNumber());
+        if (!trace->good()) {
+            std::cerr << "Error: cannot write trace " << config.tracePath << std::endl;
+            return false;
+        }
+        machine.setTraceSink(trace.get());
+    }
+
+    // --deadline, --stop-at and --observe.
+    RunLimits limits;
+    if (config.deadlineSeconds > 0) {
+        limits.deadline = std::chrono::steady_clock::now() +
+                          std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                              std::chrono::duration<double>(config.deadlineSeconds));
+    }
+    std::unique_ptr<StepObserver> stopAt;
+    if (config.stopKind == "fraction") {
+        if (config.stopValue >= config.program.size()) {
+            std::cerr << "Error: --stop-at names fraction " << config.stopValue << " of a program with "
+                      << config.program.size() << std::endl;
+            return false;
+        }
+        stopAt = std::make_unique<FractionFired>(static_cast<std::uint32_t>(config.stopValue), config.stopCount);
+    } else if (config.stopKind == "pow") {
+        stopAt = std::make_unique<PowerOfPrime<Machine>>(machine, config.program, config.stopValue, config.stopCount);
+    }
+    if (stopAt) limits.observers.push_back(stopAt.get());
+    // --observe and --primes lines are formatted and written by a thread of
+    // their own; the machine only queues the step and the exponent.
+    std::unique_ptr<AsyncWriter<PowerEvent>> emit;
+    if (config.observePrime != 0 || config.primes) {
+        emit = std::make_unique<AsyncWriter<PowerEvent>>(stdout, [&config](const PowerEvent& e, std::string& out) {
+            if (e.observed) {
+                out += "step " + std::to_string(e.step) + ": " + std::to_string(config.observePrime) + "^";
+            }
+            out += std::to_string(e.exponent);
+            out += '\n';
+        });
+        std::cout.flush();
+    }
+    std::unique_ptr<PowerOfPrime<Machine>> observe;
+    if (config.observePrime != 0) {
+        observe = std::make_unique<PowerOfPrime<Machine>>(machine, config.program, config.observePrime);
+        observe->onMatch = [&machine, &emit](std::uint64_t exponent) {
+            emit->push({machine.getStepCount(), exponent, true});
+        };
+        limits.observers.push_back(observe.get());
+    }
+    std::unique_ptr<PowerOfPrime<Machine>> primes;
+    if (config.primes) {
+        primes = std::make_unique<PowerOfPrime<Machine>>(machine, config.program, 2);
+        primes->onMatch = [&machine, &emit](std::uint64_t exponent) {
+            emit->push({machine.getStepCount(), exponent, false});
+        };
+        limits.observers.push_back(primes.get());
+    }
+
+    StopReason reason = StopReason::Budget;
+    bool ran = run(machine, config, limits, reason);
+    if (emit && !emit->close()) {
+        std::cerr << "Error: failed writing to standard output" << std::endl;
+        return false;
+    }
+    if (!ran) return false;
+    std::ostream& out = console(config);
+    if (config.primes) {
+        out << "Final Value: " << describeState(config, machine.getLastNumber()) << std::endl;
+    } else {
+        machine.printSequence(notation(config));
+    }
+
+    out << "Total Steps: " << machine.getStepCount() << std::endl;
+    if (limits.hasDeadline() || !limits.observers.empty()) {
+        out << "Stopped:     " << stopReasonName(reason) << std::endl;
+    }
+    if (primes) out << "Primes:      " << primes->matches() << std::endl;
+    report(machine, config);
+    reportLimbPool(machine, config);
+
+    if (trace) {
+        trace->close();
+        if (!trace->good()) {
+            std::cerr << "Error: failed writing trace " << config.tracePath << std::endl;
+            return false;
+        }
+        out << "Trace:       " << trace->stepsWritten() << " steps written to " << config.tracePath << std::endl;
+    }
+    if (!config.checkpointPath.empty()) {
+        out << "Checkpoint:  step " << machine.getStepCount() << " saved to " << config.checkpointPath << std::endl;
+    }
+    return true;
+}
+
+// Reads sweep inputs from a file: integers separated by whitespace, '#' comments.
+bool loadSweepFile(const std::string& path, std::vector<mpz_class>& inputs) {
+    std::ifstream file(path);
+    if (!file.is_open()) return false;
+    std::string line;
+    while (std::getline(file, line)) {
+        std::stringstream ss(line.substr(0, line.find('#')));
+        std::string token;
+        while (ss >> token) {
+            if (!isInteger(token)) return false;
+            inputs.push_back(mpz_class(token));
+        }
+    }
+    return true;
+}
+
+// Runs every input of --sweep/--sweep-file and streams one result per input.
+// Results go to stdout unless --output is given, so the summary goes to stderr.
+template <typename Machine>
+bool sweep(const FractranConfig& config) {
+    if (!config.tracePath.empty() || !config.checkpointPath.empty() || !config.resumePath.empty() ||
+        config.deadlineSeconds > 0 || !config.stopKind.empty() || config.observePrime != 0 || config.primes ||
+        config.notation != "decimal") {
+        std::cerr << "Error: --sweep cannot be combined with --trace, --checkpoint, --resume, --deadline, --stop-at,"
+                  << " --observe, --primes or --notation" << std::endl;
+        return false;
+    }
+
+    SweepInputs inputs;
+    if (!config.sweepFile.empty()) {
+        std::vector<mpz_class> values;
+        if (!loadSweepFile(config.sweepFile, values)) {
+            std::cerr << "Error: cannot read sweep inputs from " << config.sweepFile << std::endl;
+            return false;
+        }
+        inputs = SweepInputs::list(std::move(values));
+    } else {
+        size_t dots = config.sweepRange.find("..");
+        inputs = SweepInputs::range(mpz_class(config.sweepRange.substr(0, dots)),
+                                    mpz_class(config.sweepRange.substr(dots + 2)));
+    }
+
+    std::ofstream file;
+    if (!config.outputPath.empty()) {
+        file.open(config.outputPath, std::ios::binary);
+        if (!file.is_open()) {
+            std::cerr << "Error: cannot write " << config.outputPath << std::endl;
+            return false;
+        }
+    }
+    std::ostream& out = config.outputPath.empty() ? std::cout : file;
+
+    SweepOptions options;
+    options.threads = config.threads;
+    options.maxSteps = config.steps;
+    options.factored = config.factored.get();
+    FractranConfig machineConfig = config;
+    machineConfig.history = false;
+    SweepFormat format = (config.format == "binary") ? SweepFormat::Binary : SweepFormat::Csv;
+
+    // --jit: compile (or load) once for the whole sweep, not once per input.
+    std::shared_ptr<const JitProgram> jit;
+    RegisterProgram factored;
+    if (config.jit) {
+        if (!options.factored) {
+            factored = buildRegisterProgram(config.program);
+            options.factored = &factored;
+        }
+        std::string error;
+        jit = JitProgram::load(*options.factored, error);
+        if (!jit) std::cerr << "Warning: JIT unavailable, interpreting instead (" << error << ")" << std::endl;
+        machineConfig.jit = false;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    SweepStats stats;
+    if (config.engine == "batch") {
+        stats = runBatchSweep(config.program, inputs, options, format, out);
+    } else {
+        stats = runSweep<Machine>(config.program, inputs, options, format, out, [&](Machine& machine) {
+            configure(machine, machineConfig);
+            if constexpr (std::is_same_v<Machine, RegisterFractran>) {
+                // An input that refined the register base needs code of its own.
+                std::string error;
+                if (jit && !machine.useJit(jit)) machine.enableJit(error);
+            }
+        });
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    if (!out.good()) {
+        std::cerr << "Error: failed writing sweep results" << std::endl;
+        return false;
+    }
+    std::cerr << "Sweep:       " << stats.inputs << " inputs, " << stats.halted << " halted, "
+              << stats.steps << " steps on " << stats.threads << " threads (" << stats.steals
+              << " steals) in " << elapsed.count() << "s" << std::endl;
+    return true;
+}
 
 int main(int argc, char* argv[]) {
     if (argc < 2) {
-        std::cout << "Usage: " << argv[0] << " <fractions...> <input> [steps]\n";
-        std::cout << "       " << argv[0] << " <file> [input_override] [steps]\n";
+        std::cout << "Usage: " << argv[0] << " [options] <fractions...> <input> [steps]\n";
+        std::cout << "       " << argv[0] << " [options] <file> [input_override] [steps]\n";
+        std::cout << "Options:\n";
+        std::cout << "  --engine=gmp|registers|batch   state as one big integer (default), as prime exponents,\n";
+        std::cout << "                                 or (sweeps only) many machines stepped in lockstep\n";
+        std::cout << "  --match=linear|indexed|simd    first-match search of the register engine (default indexed)\n";
+        std::cout << "  --no-history                   only print the final state\n";
+        std::cout << "  --notation=decimal|factored|binary\n";
+        std::cout << "                                 print states as integers (default), as exponents over the\n";
+        std::cout << "                                 program's registers (2^3 * 5), or as a binary FRSTATE1 stream\n";
+        std::cout << "                                 on stdout (everything else goes to stderr)\n";
+        std::cout << "  --accelerate                   register engine: collapse repeating cycles (needs --no-history)\n";
+        std::cout << "  --cache[=BLOCK]                register engine: memoize BLOCK-step macro-steps (needs --no-history)\n";
+        std::cout << "  --detect-cycles                register engine: stop once the state repeats\n";
+        std::cout << "  --limb-pool                    allocate GMP limbs from size-class pools, and gmp-engine history\n";
+        std::cout << "                                 from an arena freed in one go; prints allocation counts\n";
+        std::cout << "  --no-program-cache             parse FILE.frac even if FILE.fracc is current, and do not write it\n";
+        std::cout << "  --optimize                     drop fractions that never fire and fuse chains that always\n";
+        std::cout << "                                 fire in a row (gmp engine, with --no-history); prints a report\n";
+        std::cout << "  --jit                          register engine: compile the program to native code (needs\n";
+        std::cout << "                                 a C++ compiler; cached privately in $FRACTRAN_JIT_CACHE or ~/.cache)\n";
+        std::cout << "  --trace=FILE                   stream steps to a binary trace (read it with fractran_trace)\n";
+        std::cout << "  --sparse-history=K             gmp engine: keep every K-th state, replay the rest\n";
+        std::cout << "  --stats                        gmp engine: print fraction hits, scan length, state size, latency\n";
+        std::cout << "  --deadline=SECONDS             stop once this much wall-clock time has passed\n";
+        std::cout << "  --stop-at=pow:P[:N]            stop at the N-th state (default 1st) that is a power of the prime P\n";
+        std::cout << "  --stop-at=fraction:J[:N]       stop once fraction J (from 0) has fired N times\n";
+        std::cout << "  --observe=pow:P                print the step of every state that is a power of the prime P\n";
+        std::cout << "  --primes                       print each exponent e of a state 2^e the moment it is reached\n";
+        std::cout << "                                 (Conway's prime game: the primes); everything else goes to stderr\n";
+        std::cout << "  --checkpoint=FILE              save a resumable snapshot to FILE while running\n";
+        std::cout << "  --checkpoint-every=N           steps between snapshots (default 1000000)\n";
+        std::cout << "  --resume=FILE                  continue from FILE; steps count the whole run\n";
+        std::cout << "  --sweep=FROM..TO               run every input in the range; steps are per input\n";
+        std::cout << "  --sweep-file=FILE              run every input listed in FILE\n";
+        std::cout << "  --threads=N                    sweep workers (default: one per core)\n";
+        std::cout << "  --output=FILE                  write sweep results to FILE instead of stdout\n";
+        std::cout << "  --format=csv|binary            sweep result format (default csv)\n";
         return 1;
     }
 
+    // GMP's allocator can only be swapped before its first allocation.
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "--limb-pool") limb_pool::install();
+    }
+
     // Convert argv to vector<string> (skipping argv[0])
     std::vector<std::string> args;
     for (int i = 1; i < argc; ++i) {
@@ -25,18 +458,33 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
+    bool sweeping = !config.sweepRange.empty() || !config.sweepFile.empty();
+    if (config.optimize && !optimize(config, sweeping ? std::cerr : console(config))) return 1;
+
+    if (sweeping) {
+        bool ok = (config.engine == "registers") ? sweep<RegisterFractran>(config) : sweep<Fractran>(config);
+        return ok ? 0 : 1;
+    }
+    if (config.engine == "batch") {
+        std::cerr << "Error: --engine=batch runs many inputs at once; use it with --sweep or --sweep-file" << std::endl;
+        return 1;
+    }
+    if (config.primes && config.notation == "binary") {
+        std::cerr << "Error: --primes and --notation=binary both write to stdout; pick one" << std::endl;
+        return 1;
+    }
+
     // Execution
-    std::cout << "--- FRACTRAN Interpreter ---" << std::endl;
-    std::cout << "Fractions: " << config.program.size() << std::endl;
-    std::cout << "Input:     " << config.input << std::endl;
-    std::cout << "Max Steps: " << config.steps << std::endl;
-    std::cout << "----------------------------" << std::endl;
-
-    Fractran machine(config.program, config.input, true);
-    machine.runMachine(config.steps);
-    machine.printSequence();
-    
-    std::cout << "Total Steps: " << machine.getStepCount() << std::endl;
-
-    return 0;
+    std::ostream& out = console(config);
+    out << "--- FRACTRAN Interpreter ---" << std::endl;
+    out << "Fractions: " << config.program.size() << std::endl;
+    out << "Input:     " << describeState(config, config.input) << std::endl;
+    out << "Max Steps: " << config.steps << std::endl;
+    out << "Engine:    " << config.engine << std::endl;
+    out << "----------------------------" << std::endl;
+
+    bool ok = (config.engine == "registers") ? execute<RegisterFractran>(config)
+                                             : execute<Fractran>(config);
+
+    return ok ? 0 : 1;
 }
@@ -0,0 +1,272 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+#include <dlfcn.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "binary_io.h"
+#include "register_program.h"
+
+// Where JitProgram::load keeps compiled programs and which compiler it runs.
+struct JitOptions {
+    // empty: $FRACTRAN_JIT_CACHE, $XDG_CACHE_HOME/fractran-jit, ~/.cache/fractran-jit
+    // or /tmp/fractran-jit-<uid>. It must belong to this user and be writable by no one else.
+    std::string cacheDir;
+    std::string compiler; // empty: $CXX, or "c++"
+};
+
+// What one JitProgram::run call did. `negate` is set when an odd number of
+// negative numerators fired; `zero` when a zero numerator ended the run.
+struct JitResult {
+    std::uint64_t steps = 0;
+    bool halted = false;
+    bool zero = false;
+    bool negate = false;
+};
+
+// A register program compiled to native code. Every fraction becomes one
+// straight-line test of its denominator exponents followed by the updates of
+// its delta, on registers held in locals, so a step costs a few compares and
+// adds with no data-driven loops. The source is generated as C++, built into
+// a shared library with the local compiler and loaded with dlopen. Libraries
+// are cached under a hash of the generated source, which covers the program
+// and its register layout, so later runs of the same program skip the compile.
+class JitProgram {
+public:
+    using EntryFn = std::uint64_t (*)(std::int64_t* registers, std::uint64_t budget, int* status);
+
+    ~JitProgram() {
+        if (handle) dlclose(handle);
+    }
+
+    JitProgram(const JitProgram&) = delete;
+    JitProgram& operator=(const JitProgram&) = delete;
+
+    // Compiles `program`, or loads it from the cache. Returns nullptr and
+    // describes the problem in `error` when no compiler or loader is available.
+    static std::shared_ptr<const JitProgram> load(const RegisterProgram& program, std::string& error,
+                                                  const JitOptions& options = JitOptions());
+
+    static std::string generateSource(const RegisterProgram& program);
+
+    // Runs at most `budget` steps on `registers` (program.registerCount() entries).
+    JitResult run(std::vector<std::int64_t>& registers, std::uint64_t budget) const {
+        int status[2] = {0, 0};
+        JitResult result;
+        result.steps = entry(registers.data(), budget, status);
+        result.halted = status[0] == 1;
+        result.zero = status[0] == 2;
+        result.negate = status[1] != 0;
+        return result;
+    }
+
+    const std::string& libraryPath() const { return path; }
+    bool fromCache() const { return cached; }
+    // The register base the code was generated for (RegisterProgram::primes).
+    const std::vector<mpz_class>& registerBase() const { return bases; }
+
+private:
+    JitProgram() = default;
+
+    void* handle = nullptr;
+    EntryFn entry = nullptr;
+    std::string path;
+    bool cached = false;
+    std::vector<mpz_class> bases;
+};
+
+namespace jit_detail {
+
+inline std::string defaultCacheDir() {
+    if (const char* dir = std::getenv("FRACTRAN_JIT_CACHE")) return dir;
+    if (const char* xdg = std::getenv("XDG_CACHE_HOME")) return std::string(xdg) + "/fractran-jit";
+    if (const char* home = std::getenv("HOME")) return std::string(home) + "/.cache/fractran-jit";
+    return "/tmp/fractran-jit-" + std::to_string(::geteuid());
+}
+
+// Whatever is at `path` gets loaded into this process, so it must belong to
+// this user and be writable by no one else (or anyone could plant code in it).
+inline bool ownedPrivately(const std::string& path, bool directory) {
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0) return false;
+    if (directory ? !S_ISDIR(st.st_mode) : !S_ISREG(st.st_mode)) return false;
+    return st.st_uid == ::geteuid() && (st.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+}
+
+// Creates the cache directory (0700 if it is new) and checks that it is private.
+inline bool prepareCacheDir(const std::string& dir, std::string& error) {
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    fs::path parent = fs::path(dir).parent_path();
+    if (!parent.empty()) fs::create_directories(parent, ec);
+    ::mkdir(dir.c_str(), 0700);
+    if (ownedPrivately(dir, true)) return true;
+    error = "cache directory " + dir + " is missing, not ours or writable by others";
+    return false;
+}
+
+inline std::string shellQuote(const std::string& s) {
+    std::string out = "'";
+    for (char c : s) {
+        if (c == '\'') out += "'\\''";
+        else out += c;
+    }
+    return out + "'";
+}
+
+inline std::string hex64(std::uint64_t v) {
+    char buf[17];
+    std::snprintf(buf, sizeof(buf), "%016llx", static_cast<unsigned long long>(v));
+    return buf;
+}
+
+} // namespace jit_detail
+
+// The generated entry point keeps the loop of RegisterFractran::runMachine:
+// try the fractions in order, apply the first that fires, start over. It
+// writes the stop reason to status[0] (0 budget used, 1 halted, 2 zero
+// numerator) and the sign parity to status[1].
+inline std::string JitProgram::generateSource(const RegisterProgram& program) {
+    const size_t fractionCount = program.fractionCount();
+    std::vector<bool> used(program.registerCount(), false);
+    for (size_t f = 0; f < fractionCount; ++f) {
+        for (const auto& t : program.require[f]) used[t.reg] = true;
+        for (const auto& t : program.delta[f]) used[t.reg] = true;
+    }
+    auto reg = [](std::uint32_t r) { return "r" + std::to_string(r); };
+
+    std::string src;
+    src += "// Generated FRACTRAN program: " + std::to_string(fractionCount) + " fractions over " +
+           std::to_string(program.registerCount()) + " registers.\n";
+    src += "#include <stdint.h>\n\n";
+    src += "extern \"C\" uint64_t fractran_jit_run(int64_t* reg, uint64_t budget, int* status) {\n";
+    for (std::uint32_t r = 0; r < used.size(); ++r) {
+        if (used[r]) src += "    int64_t " + reg(r) + " = reg[" + std::to_string(r) + "];\n";
+    }
+    src += "    uint64_t n = 0;\n    int stop = 0, negate = 0;\n    while (n < budget) {\n        ++n;\n";
+
+    bool reachable = true;
+    for (size_t f = 0; f < fractionCount && reachable; ++f) {
+        std::string indent = "        ";
+        if (program.require[f].empty()) {
+            reachable = false; // denominator 1: always fires, the rest is dead code
+            src += indent + "{\n";
+        } else {
+            std::string test;
+            for (const auto& t : program.require[f]) {
+                if (!test.empty()) test += " && ";
+                test += reg(t.reg) + " >= " + std::to_string(t.exp) + "LL";
+            }
+            src += indent + "if (" + test + ") {\n";
+        }
+        for (const auto& t : program.delta[f]) {
+            src += indent + "    " + reg(t.reg) + (t.exp < 0 ? " -= " : " += ") +
+                   std::to_string(t.exp < 0 ? -t.exp : t.exp) + "LL;\n";
+        }
+        if (program.scale[f] == 0) {
+            src += indent + "    stop = 2;\n" + indent + "    break;\n";
+        } else {
+            if (program.scale[f] < 0) src += indent + "    negate ^= 1;\n";
+            src += indent + "    continue;\n";
+        }
+        src += indent + "}\n";
+    }
+    if (reachable) src += "        --n;\n        stop = 1;\n        break;\n";
+    src += "    }\n";
+    for (std::uint32_t r = 0; r < used.size(); ++r) {
+        if (used[r]) src += "    reg[" + std::to_string(r) + "] = " + reg(r) + ";\n";
+    }
+    src += "    status[0] = stop;\n    status[1] = negate;\n    return n;\n}\n";
+    return src;
+}
+
+inline std::shared_ptr<const JitProgram> JitProgram::load(const RegisterProgram& program, std::string& error,
+                                                          const JitOptions& options) {
+    namespace fs = std::filesystem;
+    using namespace jit_detail;
+
+    std::string compiler = options.compiler;
+    if (compiler.empty()) compiler = std::getenv("CXX") ? std::getenv("CXX") : "c++";
+    const std::string flags = "-O2 -shared -fPIC";
+    std::string dir = options.cacheDir.empty() ? defaultCacheDir() : options.cacheDir;
+
+    std::string source = generateSource(program);
+    std::string key = source + '\n' + compiler + ' ' + flags;
+    std::string library = dir + "/fractran-" + hex64(binary::fnv1a(key.data(), key.size())) + ".so";
+
+    if (!prepareCacheDir(dir, error)) return nullptr;
+
+    std::shared_ptr<JitProgram> jit(new JitProgram());
+    jit->path = library;
+    jit->bases = program.primes;
+    // Builds under names private to this process and call, and renames into
+    // place, so concurrent runs and threads never load a half-written library.
+    auto build = [&]() {
+        std::error_code ec;
+        static std::atomic<unsigned> builds{0};
+        std::string stem = library.substr(0, library.size() - 3) + "." + std::to_string(::getpid()) + "." +
+                           std::to_string(builds.fetch_add(1));
+        std::string sourcePath = stem + ".cpp";
+        std::string logPath = stem + ".log";
+        std::string tempLibrary = stem + ".so";
+        {
+            std::ofstream out(sourcePath);
+            out << source;
+            if (!out) {
+                error = "cannot write " + sourcePath;
+                return false;
+            }
+        }
+        std::string command = shellQuote(compiler) + " " + flags + " -o " + shellQuote(tempLibrary) + " " +
+                              shellQuote(sourcePath) + " > " + shellQuote(logPath) + " 2>&1";
+        int status = std::system(command.c_str());
+        std::ifstream logFile(logPath);
+        std::string log((std::istreambuf_iterator<char>(logFile)), std::istreambuf_iterator<char>());
+        fs::remove(sourcePath, ec);
+        fs::remove(logPath, ec);
+        if (status != 0 || ::chmod(tempLibrary.c_str(), 0700) != 0 ||
+            std::rename(tempLibrary.c_str(), library.c_str()) != 0) {
+            fs::remove(tempLibrary, ec);
+            error = "compiling with " + compiler + " failed" + (log.empty() ? "" : ": " + log.substr(0, log.find('\n')));
+            return false;
+        }
+        return true;
+    };
+    auto openLibrary = [&]() {
+        if (!ownedPrivately(library, false)) {
+            error = "refusing to load " + library + ": not ours or writable by others";
+            return false;
+        }
+        jit->handle = dlopen(library.c_str(), RTLD_NOW | RTLD_LOCAL);
+        if (jit->handle) jit->entry = reinterpret_cast<EntryFn>(dlsym(jit->handle, "fractran_jit_run"));
+        if (jit->entry) return true;
+        const char* reason = dlerror();
+        error = "cannot load " + library + (reason ? std::string(": ") + reason : "");
+        if (jit->handle) dlclose(jit->handle);
+        jit->handle = nullptr;
+        return false;
+    };
+
+    jit->cached = fs::exists(library);
+    if (jit->cached) {
+        if (openLibrary()) return jit;
+        // Stale, truncated, built elsewhere or not ours: drop it and rebuild once.
+        std::error_code ec;
+        fs::remove(library, ec);
+        jit->cached = false;
+    }
+    if (!build() || !openLibrary()) return nullptr;
+    return jit;
+}
+
+#endif // JIT_H
@@ -0,0 +1,351 @@
+#ifndef LIMB_POOL_H
+#define LIMB_POOL_H
+
+#include <gmp.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Opt-in replacement for the allocator behind GMP (mp_set_memory_functions).
+// Every block starts with a 16-byte header saying where it came from:
+//
+//  - Pool: requests up to MAX_POOLED bytes are rounded up to a power of two
+//    and recycled through per-thread free lists, so the limb buffers GMP
+//    keeps creating and dropping as a state grows and shrinks rarely reach
+//    malloc. A realloc that still fits its size class keeps the block.
+//  - Arena: while a LimbArena is active on the thread (LimbArena::Scope),
+//    blocks are bump-allocated from the arena's large chunks. Freeing one
+//    does nothing; the arena hands all of its chunks back at once when it
+//    goes, to a per-thread cache that the next arena draws from first.
+//    Fractran puts its history entries there.
+//  - Large: everything else goes straight to malloc.
+//
+// GMP's rule applies: install() must run before GMP allocates anything,
+// i.e. first thing in main. (A block without the header is passed on to
+// free/realloc, but that is a fallback, not a license.)
+namespace limb_pool {
+
+// Counts of the calling thread since it started.
+struct Stats {
+    std::uint64_t allocations = 0;       // allocations and growing reallocs GMP asked for
+    std::uint64_t bytes = 0;             // bytes GMP asked for
+    std::uint64_t poolHits = 0;          // served from a free list, or resized within the block
+    std::uint64_t arenaAllocations = 0;  // bump-allocated in an arena
+    std::uint64_t systemAllocations = 0; // malloc/realloc calls made on GMP's behalf
+    std::uint64_t systemBytes = 0;
+};
+
+namespace detail {
+
+constexpr size_t HEADER = 16;
+constexpr unsigned MIN_CLASS = 5;                  // 32-byte blocks
+constexpr unsigned MAX_CLASS = 16;                 // 64 KiB blocks
+constexpr size_t MAX_POOLED = size_t(1) << MAX_CLASS;
+constexpr size_t MAX_CACHED_BYTES = size_t(4) << 20; // per size class and thread
+constexpr std::uint32_t MAGIC = 0x424d494c;        // "LIMB"
+
+enum Kind : std::uint32_t { Pool = 1, Arena = 2, Large = 3 };
+
+struct Header {
+    std::uint32_t magic;
+    std::uint32_t kind;
+    std::uint32_t sizeClass; // Pool: the block is 2^sizeClass bytes
+    std::uint32_t unused;
+};
+static_assert(sizeof(Header) == HEADER, "limb headers keep 16-byte alignment");
+
+inline thread_local Stats threadStats;
+
+inline unsigned classOf(size_t total) {
+    unsigned c = 64 - static_cast<unsigned>(__builtin_clzll(static_cast<unsigned long long>(total - 1)));
+    return std::max(c, MIN_CLASS);
+}
+
+inline Header* headerOf(void* p) { return reinterpret_cast<Header*>(static_cast<char*>(p) - HEADER); }
+
+inline void* payload(Header* h, Kind kind, unsigned sizeClass) {
+    *h = Header{MAGIC, kind, sizeClass, 0};
+    return reinterpret_cast<char*>(h) + HEADER;
+}
+
+inline void* systemAlloc(size_t bytes) {
+    void* p = std::malloc(bytes);
+    if (!p) {
+        std::fputs("limb_pool: out of memory\n", stderr);
+        std::abort();
+    }
+    threadStats.systemAllocations++;
+    threadStats.systemBytes += bytes;
+    return p;
+}
+
+// Freed pool blocks, linked through their first bytes. After the thread's
+// destructor has run, frees go back to the system.
+struct FreeLists {
+    void* head[MAX_CLASS + 1] = {};
+    size_t count[MAX_CLASS + 1] = {};
+    bool closed = false;
+
+    void* pop(unsigned c) {
+        void* block = head[c];
+        if (block) {
+            std::memcpy(&head[c], block, sizeof(void*));
+            count[c]--;
+        }
+        return block;
+    }
+
+    void push(unsigned c, void* block) {
+        if (closed || (count[c] + 1) << c > MAX_CACHED_BYTES) {
+            std::free(block);
+            return;
+        }
+        std::memcpy(block, &head[c], sizeof(void*));
+        head[c] = block;
+        count[c]++;
+    }
+
+    ~FreeLists() {
+        for (unsigned c = 0; c <= MAX_CLASS; ++c) {
+            while (void* block = pop(c)) std::free(block);
+        }
+        closed = true;
+    }
+};
+
+inline thread_local FreeLists freeLists;
+
+// Chunks of arenas that are gone, kept for the next arena on the thread so
+// that its pages are already mapped.
+struct ChunkCache {
+    static constexpr size_t MAX_BYTES = size_t(64) << 20;
+    std::vector<std::pair<char*, size_t>> chunks;
+    size_t bytes = 0;
+    bool closed = false;
+
+    char* take(size_t size) {
+        for (size_t i = chunks.size(); i-- > 0;) {
+            if (chunks[i].second != size) continue;
+            char* chunk = chunks[i].first;
+            chunks.erase(chunks.begin() + static_cast<std::ptrdiff_t>(i));
+            bytes -= size;
+            return chunk;
+        }
+        return nullptr;
+    }
+
+    void give(char* chunk, size_t size) {
+        if (closed || bytes + size > MAX_BYTES) {
+            std::free(chunk);
+            return;
+        }
+        chunks.push_back({chunk, size});
+        bytes += size;
+    }
+
+    ~ChunkCache() {
+        for (const auto& chunk : chunks) std::free(chunk.first);
+        chunks.clear();
+        closed = true;
+    }
+};
+
+inline thread_local ChunkCache chunkCache;
+
+} // namespace detail
+
+// Bump allocator for blocks that all die together. Not thread-safe: one
+// thread allocates from an arena at a time.
+class LimbArena {
+public:
+    explicit LimbArena(size_t chunkBytes = size_t(1) << 20) : chunkBytes(chunkBytes) {}
+    ~LimbArena() {
+        for (const auto& chunk : chunks) detail::chunkCache.give(chunk.first, chunk.second);
+    }
+
+    LimbArena(const LimbArena&) = delete;
+    LimbArena& operator=(const LimbArena&) = delete;
+
+    // Routes this thread's GMP allocations to `arena` (null: the pool) until
+    // the scope ends.
+    class Scope {
+    public:
+        explicit Scope(LimbArena* arena) : saved(active()) { active() = arena; }
+        ~Scope() { active() = saved; }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        LimbArena* saved;
+    };
+
+    static LimbArena*& active() {
+        static thread_local LimbArena* current = nullptr;
+        return current;
+    }
+
+    // `bytes` includes the header; the result is 16-byte aligned.
+    void* take(size_t bytes) {
+        bytes = (bytes + 15) & ~size_t(15);
+        if (static_cast<size_t>(end - cursor) < bytes) {
+            size_t size = std::max(chunkBytes, bytes);
+            char* chunk = detail::chunkCache.take(size);
+            if (!chunk) chunk = static_cast<char*>(detail::systemAlloc(size));
+            chunks.push_back({chunk, size});
+            cursor = chunk;
+            end = cursor + size;
+            reserved += size;
+        }
+        void* block = cursor;
+        cursor += bytes;
+        used += bytes;
+        return block;
+    }
+
+    size_t bytesUsed() const { return used; }
+    size_t bytesReserved() const { return reserved; }
+    size_t chunkCount() const { return chunks.size(); }
+
+private:
+    size_t chunkBytes;
+    std::vector<std::pair<char*, size_t>> chunks;
+    char* cursor = nullptr;
+    char* end = nullptr;
+    size_t used = 0;
+    size_t reserved = 0;
+};
+
+namespace detail {
+
+// A block of `size` usable bytes, from the active arena, a free list or malloc.
+inline void* obtain(size_t size) {
+    size_t total = size + HEADER;
+    if (LimbArena* arena = LimbArena::active()) {
+        threadStats.arenaAllocations++;
+        return payload(static_cast<Header*>(arena->take(total)), Arena, 0);
+    }
+    if (total <= MAX_POOLED) {
+        unsigned c = classOf(total);
+        void* block = freeLists.pop(c);
+        if (block) {
+            threadStats.poolHits++;
+        } else {
+            block = systemAlloc(size_t(1) << c);
+        }
+        return payload(static_cast<Header*>(block), Pool, c);
+    }
+    return payload(static_cast<Header*>(systemAlloc(total)), Large, 0);
+}
+
+} // namespace detail
+
+// The three functions handed to mp_set_memory_functions.
+inline void* allocate(size_t size) {
+    detail::threadStats.allocations++;
+    detail::threadStats.bytes += size;
+    return detail::obtain(size);
+}
+
+inline void release(void* p, size_t) {
+    if (!p) return;
+    detail::Header* h = detail::headerOf(p);
+    if (h->magic != detail::MAGIC) {
+        std::free(p); // allocated before install()
+        return;
+    }
+    if (h->kind == detail::Pool) {
+        detail::freeLists.push(h->sizeClass, h);
+    } else if (h->kind == detail::Large) {
+        std::free(h);
+    }
+    // Arena blocks go with their arena.
+}
+
+inline void* reallocate(void* p, size_t oldSize, size_t newSize) {
+    if (newSize > oldSize) {
+        detail::threadStats.allocations++;
+        detail::threadStats.bytes += newSize - oldSize;
+    }
+    if (!p) return detail::obtain(newSize);
+    detail::Header* h = detail::headerOf(p);
+    if (h->magic != detail::MAGIC) {
+        void* moved = std::realloc(p, newSize); // allocated before install()
+        if (!moved) {
+            std::fputs("limb_pool: out of memory\n", stderr);
+            std::abort();
+        }
+        return moved;
+    }
+    bool toArena = LimbArena::active() != nullptr;
+    if (!toArena && h->kind == detail::Pool && newSize + detail::HEADER <= (size_t(1) << h->sizeClass)) {
+        detail::threadStats.poolHits++;
+        return p;
+    }
+    if (!toArena && h->kind == detail::Large && newSize + detail::HEADER > detail::MAX_POOLED) {
+        void* moved = std::realloc(h, newSize + detail::HEADER);
+        if (!moved) {
+            std::fputs("limb_pool: out of memory\n", stderr);
+            std::abort();
+        }
+        detail::threadStats.systemAllocations++;
+        detail::threadStats.systemBytes += newSize > oldSize ? newSize - oldSize : 0;
+        return static_cast<char*>(moved) + detail::HEADER;
+    }
+    void* moved = detail::obtain(newSize);
+    std::memcpy(moved, p, std::min(oldSize, newSize));
+    release(p, oldSize);
+    return moved;
+}
+
+inline bool& installedFlag() {
+    static bool installed = false;
+    return installed;
+}
+
+// Makes GMP allocate through the pool for the rest of the process.
+inline void install() {
+    mp_set_memory_functions(allocate, reallocate, release);
+    installedFlag() = true;
+}
+
+inline bool installed() { return installedFlag(); }
+
+inline const Stats& stats() { return detail::threadStats; }
+
+// An arena owned by one machine for its history, created on first use and
+// only while the pool is installed. A copy starts without one (its entries
+// are copies, allocated anew); move-assignment swaps, so the entries the
+// target still holds outlive their arena's handover. Declare it before the
+// container whose entries live in it, so that it is destroyed after them.
+class ArenaHandle {
+public:
+    ArenaHandle() = default;
+    ArenaHandle(const ArenaHandle&) {}
+    ArenaHandle(ArenaHandle&& other) noexcept : arena(std::move(other.arena)) {}
+    ArenaHandle& operator=(const ArenaHandle&) { return *this; }
+    ArenaHandle& operator=(ArenaHandle&& other) noexcept {
+        arena.swap(other.arena);
+        return *this;
+    }
+
+    LimbArena* get() {
+        if (!arena && installed()) arena = std::make_unique<LimbArena>();
+        return arena.get();
+    }
+    const LimbArena* peek() const { return arena.get(); }
+    // Frees every block at once; nothing may still point into the arena.
+    void reset() { arena.reset(); }
+
+private:
+    std::unique_ptr<LimbArena> arena;
+};
+
+} // namespace limb_pool
+
+#endif // LIMB_POOL_H
@@ -0,0 +1,145 @@
+#ifndef LOOP_ACCELERATOR_H
+#define LOOP_ACCELERATOR_H
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include "register_program.h"
+
+// Collapses repeated fraction cycles of RegisterFractran into one update.
+//
+// The accelerator watches the sequence of fired fractions. Once the last m
+// fractions repeat the m before them (m <= MAX_PERIOD), it works out how many
+// more times k that cycle fires unchanged from the current registers:
+// one pass adds a fixed delta D, so before step i of pass j the state is
+// base + P_i + j*D, which is linear in j. Each fraction of the cycle must
+// keep matching there, and every fraction ahead of it in program order must
+// keep failing; both are intervals of j that can be solved per register.
+// The k passes are then applied at once as k*D and k*m steps.
+class LoopAccelerator {
+public:
+    static constexpr size_t MAX_PERIOD = 16;
+
+    LoopAccelerator() = default;
+
+    explicit LoopAccelerator(size_t registerCount)
+        : offset(registerCount, 0), cycleDelta(registerCount, 0) {}
+
+    // Record the fraction fired by a normal step.
+    void record(std::uint32_t fraction) {
+        for (size_t m = 1; m <= MAX_PERIOD; ++m) {
+            if (seen >= m && recent[(seen - m) % RING] == fraction) {
+                run[m]++;
+            } else {
+                run[m] = 0;
+            }
+        }
+        recent[seen % RING] = fraction;
+        seen++;
+        if (cooldown > 0) cooldown--;
+    }
+
+    // Shortest period whose cycle has just repeated in full, or 0.
+    size_t period() const {
+        if (cooldown > 0) return 0;
+        for (size_t m = 1; m <= MAX_PERIOD; ++m) {
+            if (run[m] >= m) return m;
+        }
+        return 0;
+    }
+
+    // Applies as many whole passes of the detected cycle as are safe and fit
+    // in `budget` steps. Returns the number of steps taken (a multiple of the
+    // period), 0 if nothing was applied.
+    std::uint64_t accelerate(const RegisterProgram& program, std::vector<std::int64_t>& registers,
+                             std::uint64_t budget);
+
+private:
+    static constexpr size_t RING = MAX_PERIOD + 1;
+    static constexpr std::int64_t UNBOUNDED = std::numeric_limits<std::int64_t>::max();
+
+    static std::int64_t floorDiv(std::int64_t a, std::int64_t b) {
+        std::int64_t q = a / b;
+        return (a % b != 0 && ((a < 0) != (b < 0))) ? q - 1 : q;
+    }
+    static std::int64_t ceilDiv(std::int64_t a, std::int64_t b) { return -floorDiv(-a, b); }
+
+    std::uint32_t recent[RING] = {};
+    size_t run[MAX_PERIOD + 1] = {};
+    std::uint64_t seen = 0;
+    size_t cooldown = 0;
+    std::vector<std::int64_t> offset;     // P_i relative to the registers
+    std::vector<std::int64_t> cycleDelta; // D
+};
+
+inline std::uint64_t LoopAccelerator::accelerate(const RegisterProgram& program,
+                                                 std::vector<std::int64_t>& registers,
+                                                 std::uint64_t budget) {
+    const size_t m = period();
+    if (m == 0) return 0;
+
+    std::uint32_t cycle[MAX_PERIOD];
+    for (size_t i = 0; i < m; ++i) {
+        cycle[i] = recent[(seen - m + i) % RING];
+        if (program.scale[cycle[i]] != 1) return 0;
+    }
+
+    std::fill(cycleDelta.begin(), cycleDelta.end(), 0);
+    for (size_t i = 0; i < m; ++i) {
+        for (const auto& t : program.delta[cycle[i]]) cycleDelta[t.reg] += t.exp;
+    }
+
+    // k = number of whole passes that are safe; refined downwards below.
+    std::int64_t k = static_cast<std::int64_t>(std::min<std::uint64_t>(budget / m, UNBOUNDED));
+    std::fill(offset.begin(), offset.end(), 0);
+
+    for (size_t i = 0; i < m && k > 1; ++i) {
+        const std::uint32_t fired = cycle[i];
+
+        // The cycle's own fraction must still match in every pass.
+        for (const auto& t : program.require[fired]) {
+            std::int64_t have = registers[t.reg] + offset[t.reg];
+            std::int64_t d = cycleDelta[t.reg];
+            if (have < t.exp) { k = 0; break; }
+            if (d < 0) k = std::min(k, floorDiv(have - t.exp, -d) + 1);
+        }
+
+        // Earlier fractions must keep failing: find the first pass where one matches.
+        for (std::uint32_t g = 0; g < fired && k > 1; ++g) {
+            std::int64_t lo = 0, hi = UNBOUNDED;
+            bool never = false;
+            for (const auto& t : program.require[g]) {
+                std::int64_t have = registers[t.reg] + offset[t.reg];
+                std::int64_t d = cycleDelta[t.reg];
+                if (d > 0) {
+                    if (have < t.exp) lo = std::max(lo, ceilDiv(t.exp - have, d));
+                } else if (have < t.exp) {
+                    never = true;
+                    break;
+                } else if (d < 0) {
+                    hi = std::min(hi, floorDiv(have - t.exp, -d));
+                }
+            }
+            if (!never && lo <= hi) k = std::min(k, lo);
+        }
+
+        for (const auto& t : program.delta[fired]) offset[t.reg] += t.exp;
+    }
+
+    // Stop short of overflowing a register; single steps take it from there.
+    for (size_t r = 0; r < registers.size() && k > 1; ++r) {
+        if (cycleDelta[r] > 0) k = std::min(k, (UNBOUNDED - registers[r]) / cycleDelta[r]);
+    }
+
+    if (k <= 1) {
+        // Not worth it here; let the cycle run a while before trying again.
+        cooldown = m;
+        return 0;
+    }
+
+    for (size_t r = 0; r < registers.size(); ++r) registers[r] += k * cycleDelta[r];
+    return static_cast<std::uint64_t>(k) * m;
+}
+
+#endif // LOOP_ACCELERATOR_H
@@ -0,0 +1,133 @@
+#ifndef MACRO_CACHE_H
+#define MACRO_CACHE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <vector>
+#include "register_program.h"
+
+// Memoized macro-steps for RegisterFractran, in the spirit of Hashlife.
+//
+// Over a block of B steps a register can drop by at most B times its largest
+// per-step decrease. Once it holds at least that plus its largest denominator
+// exponent, every comparison on it succeeds for the whole block, so its exact
+// value no longer matters. The key of a block is therefore each read register
+// clamped to that cap; registers no denominator reads are left out. An entry
+// stores the net register change and the steps taken (fewer than B if the
+// machine halted inside the block). Entries are evicted least recently used
+// once their estimated size passes the memory cap.
+class MacroCache {
+public:
+    struct Stats {
+        std::uint64_t hits = 0;
+        std::uint64_t misses = 0;
+        std::uint64_t evictions = 0;
+        std::uint64_t entries = 0;
+        std::uint64_t bytes = 0;
+    };
+
+    struct Entry {
+        std::vector<RegisterTerm> delta;
+        std::uint32_t steps;
+        bool halted;
+    };
+
+    MacroCache() = default;
+
+    MacroCache(const RegisterProgram& program, std::uint32_t blockSteps, size_t maxBytes)
+        : block(blockSteps), capacity(maxBytes) {
+        std::vector<std::int64_t> maxDen(program.registerCount(), 0);
+        std::vector<std::int64_t> maxDrop(program.registerCount(), 0);
+        for (size_t f = 0; f < program.fractionCount(); ++f) {
+            for (const auto& t : program.require[f]) maxDen[t.reg] = std::max(maxDen[t.reg], t.exp);
+            for (const auto& t : program.delta[f]) {
+                if (t.exp < 0) maxDrop[t.reg] = std::max(maxDrop[t.reg], -t.exp);
+            }
+        }
+        for (size_t r = 0; r < program.registerCount(); ++r) {
+            if (maxDen[r] == 0) continue;
+            keyRegisters.push_back(static_cast<std::uint32_t>(r));
+            caps.push_back(maxDen[r] + static_cast<std::int64_t>(block) * maxDrop[r]);
+        }
+    }
+
+    std::uint32_t blockSteps() const { return block; }
+    const Stats& stats() const { return counters; }
+
+    // The cached block starting from `registers`, or nullptr on a miss.
+    const Entry* find(const std::vector<std::int64_t>& registers) {
+        makeKey(registers);
+        auto it = table.find(key);
+        if (it == table.end()) {
+            counters.misses++;
+            return nullptr;
+        }
+        counters.hits++;
+        order.splice(order.begin(), order, it->second.position);
+        return &it->second.entry;
+    }
+
+    // Stores the block that ran from the registers last passed to find().
+    void insert(Entry entry) {
+        size_t size = entrySize(entry);
+        while (!order.empty() && counters.bytes + size > capacity) evictOldest();
+        if (size > capacity) return;
+
+        order.push_front(key);
+        table.emplace(key, Slot{std::move(entry), order.begin()});
+        counters.bytes += size;
+        counters.entries = table.size();
+    }
+
+private:
+    struct KeyHash {
+        size_t operator()(const std::vector<std::int64_t>& k) const {
+            std::uint64_t h = 1469598103934665603ULL;
+            for (std::int64_t v : k) {
+                h ^= static_cast<std::uint64_t>(v);
+                h *= 1099511628211ULL;
+            }
+            return static_cast<size_t>(h);
+        }
+    };
+
+    struct Slot {
+        Entry entry;
+        std::list<std::vector<std::int64_t>>::iterator position;
+    };
+
+    void makeKey(const std::vector<std::int64_t>& registers) {
+        key.resize(keyRegisters.size());
+        for (size_t i = 0; i < keyRegisters.size(); ++i) {
+            key[i] = std::min(registers[keyRegisters[i]], caps[i]);
+        }
+    }
+
+    size_t entrySize(const Entry& entry) const {
+        // Key stored twice (map and LRU list), plus node and bookkeeping overhead.
+        return 2 * key.size() * sizeof(std::int64_t) + entry.delta.size() * sizeof(RegisterTerm) + 128;
+    }
+
+    void evictOldest() {
+        auto it = table.find(order.back());
+        counters.bytes -= 2 * order.back().size() * sizeof(std::int64_t)
+                        + it->second.entry.delta.size() * sizeof(RegisterTerm) + 128;
+        table.erase(it);
+        order.pop_back();
+        counters.evictions++;
+        counters.entries = table.size();
+    }
+
+    std::uint32_t block = 0;
+    size_t capacity = 0;
+    std::vector<std::uint32_t> keyRegisters;
+    std::vector<std::int64_t> caps;
+    std::vector<std::int64_t> key;
+    std::list<std::vector<std::int64_t>> order; // most recently used first
+    std::unordered_map<std::vector<std::int64_t>, Slot, KeyHash> table;
+    Stats counters;
+};
+
+#endif // MACRO_CACHE_H
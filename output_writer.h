@@ -0,0 +1,181 @@
+#ifndef OUTPUT_WRITER_H
+#define OUTPUT_WRITER_H
+
+#include <gmpxx.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Bounded lock-free queue between exactly one producer thread and one
+// consumer thread. Each side keeps its own index on its own cache line plus
+// a cached copy of the other side's, so the shared indices are only re-read
+// when the queue looks full (producer) or empty (consumer).
+template <typename T>
+class SpscQueue {
+public:
+    // Capacity is rounded up to a power of two.
+    explicit SpscQueue(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) size <<= 1;
+        slots.resize(size);
+        mask = size - 1;
+    }
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    size_t capacity() const { return mask + 1; }
+
+    // Producer only. False if the queue is full.
+    bool tryPush(const T& value) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - headSeen > mask) {
+            headSeen = head.load(std::memory_order_acquire);
+            if (t - headSeen > mask) return false;
+        }
+        slots[t & mask] = value;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only. False if the queue is empty.
+    bool tryPop(T& value) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tailSeen) {
+            tailSeen = tail.load(std::memory_order_acquire);
+            if (h == tailSeen) return false;
+        }
+        value = std::move(slots[h & mask]);
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::vector<T> slots;
+    size_t mask = 0;
+    alignas(64) std::atomic<size_t> head{0}; // next slot to pop, written by the consumer
+    size_t tailSeen = 0;                     // consumer's copy of tail
+    alignas(64) std::atomic<size_t> tail{0}; // next slot to push, written by the producer
+    size_t headSeen = 0;                     // producer's copy of head
+};
+
+// Formats and writes events on a thread of its own, so the machine only pays
+// for a queue push. Events are formatted into one buffer that goes out in a
+// single fwrite once it holds `flushBytes`, or as soon as the queue runs dry,
+// so rare events (primes) still appear the moment they are found. A full
+// queue makes push() wait for the writer rather than drop events.
+template <typename Event>
+class AsyncWriter {
+public:
+    using Format = std::function<void(const Event&, std::string&)>;
+
+    AsyncWriter(std::FILE* out, Format format, size_t queueCapacity = 1 << 12, size_t flushBytes = 1 << 16)
+        : out(out), format(std::move(format)), queue(queueCapacity), flushBytes(flushBytes),
+          worker([this] { loop(); }) {}
+
+    ~AsyncWriter() { close(); }
+
+    AsyncWriter(const AsyncWriter&) = delete;
+    AsyncWriter& operator=(const AsyncWriter&) = delete;
+
+    // From the one producing thread only.
+    void push(const Event& event) {
+        while (!queue.tryPush(event)) std::this_thread::yield();
+        pushed++;
+    }
+
+    // Writes everything pushed so far and stops the thread. Returns good().
+    bool close() {
+        done.store(true, std::memory_order_release);
+        if (worker.joinable()) worker.join();
+        return good();
+    }
+
+    bool good() const { return ok.load(std::memory_order_acquire); }
+    std::uint64_t eventsPushed() const { return pushed; }
+    std::uint64_t batchesWritten() const { return batches.load(std::memory_order_acquire); }
+
+private:
+    void flush(std::string& buffer) {
+        if (buffer.empty()) return;
+        if (std::fwrite(buffer.data(), 1, buffer.size(), out) != buffer.size() || std::fflush(out) != 0) {
+            ok.store(false, std::memory_order_release);
+        }
+        batches.fetch_add(1, std::memory_order_release);
+        buffer.clear();
+    }
+
+    void loop() {
+        std::string buffer;
+        buffer.reserve(flushBytes + 256);
+        Event event;
+        unsigned idle = 0;
+        while (true) {
+            if (queue.tryPop(event)) {
+                format(event, buffer);
+                if (buffer.size() >= flushBytes) flush(buffer);
+                idle = 0;
+                continue;
+            }
+            flush(buffer);
+            // Read `done` before the last look at the queue: a push that
+            // came before close() is then always seen.
+            if (done.load(std::memory_order_acquire)) {
+                while (queue.tryPop(event)) format(event, buffer);
+                flush(buffer);
+                return;
+            }
+            if (++idle < 64) {
+                std::this_thread::yield();
+            } else {
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+        }
+    }
+
+    std::FILE* out;
+    Format format;
+    SpscQueue<Event> queue;
+    size_t flushBytes;
+    std::uint64_t pushed = 0;
+    std::atomic<std::uint64_t> batches{0};
+    std::atomic<bool> done{false};
+    std::atomic<bool> ok{true};
+    std::thread worker; // last: starts after the members above exist
+};
+
+// Appends the decimal digits of n without a temporary string.
+inline void appendDecimal(std::string& out, const mpz_class& n) {
+    size_t at = out.size();
+    out.resize(at + mpz_sizeinbase(n.get_mpz_t(), 10) + 2);
+    mpz_get_str(&out[at], 10, n.get_mpz_t());
+    out.resize(at + std::char_traits<char>::length(&out[at]));
+}
+
+// printSequence: "s0, s1, ..., HALT" (or "...") on one line, formatted into
+// a buffer and written in large blocks rather than one insertion per state.
+template <typename Range>
+void writeSequence(std::ostream& out, const Range& states, bool halted) {
+    const size_t block = 1 << 16;
+    std::string buffer;
+    buffer.reserve(block + 256);
+    for (const auto& state : states) {
+        appendDecimal(buffer, state);
+        buffer += ", ";
+        if (buffer.size() >= block) {
+            out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            buffer.clear();
+        }
+    }
+    buffer += halted ? "HALT\n" : "...\n";
+    out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    out.flush();
+}
+
+#endif // OUTPUT_WRITER_H
@@ -1,4 +1,5 @@
 #include "fractran.h"
+#include "output_writer.h"
 
 int main() {
   std::vector<mpq_class> conwayPrimeFractions;
@@ -19,10 +20,23 @@ int main() {
 
   mpz_class number = 2;
 
-  Fractran test {Fractran(conwayPrimeFractions, number, true)};
-  test.runMachine(100);
-  test.printSequence();
+  // Every power of 2 the machine reaches is 2^prime, in order. Print the
+  // primes as they appear, from a writer thread so the machine never waits
+  // on the terminal.
+  Fractran test {Fractran(conwayPrimeFractions, number, false)};
+  AsyncWriter<std::uint64_t> out(stdout, [](const std::uint64_t& prime, std::string& text) {
+    text += std::to_string(prime);
+    text += '\n';
+  });
+  PowerOfPrime<Fractran> primes(test, conwayPrimeFractions, 2, 25);
+  primes.onMatch = [&out](std::uint64_t exponent) { out.push(exponent); };
+
+  RunLimits limits;
+  limits.steps = 100000000;
+  limits.observers.push_back(&primes);
+  test.run(limits);
+  out.close();
 
 }
 
-//compile: g++ prime-fractran.cpp -lgmp -lgmpxx
+//compile: g++ -std=c++17 -pthread prime-fractran.cpp -lgmp -lgmpxx
@@ -0,0 +1,233 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <gmpxx.h>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "binary_io.h"
+#include "frac_parser.h"
+#include "register_program.h"
+#include "snapshot.h"
+
+// A .frac file compiled once: the parsed fractions, the Input:/Steps: lines
+// and, once a register or batch engine has asked for it, the program factored
+// over its registers (buildRegisterProgram), which those engines would
+// otherwise redo for every machine. The DispatchIndex is a single pass over
+// `factored` and is rebuilt on load.
+struct CompiledProgram {
+    std::uint64_t sourceHash = 0; // binary::fnv1a of the .frac bytes
+    std::uint64_t sourceSize = 0;
+    std::vector<mpq_class> fractions; // as written, like the .frac parser
+    std::string input;                // empty = not given
+    std::uint64_t steps = 0;          // 0 = not given
+    std::shared_ptr<const RegisterProgram> factored; // null if not factored
+    bool fromCache = false;           // loaded from the .fracc rather than parsed
+};
+
+// .fracc file layout:
+//   "FRPROG01"                       magic
+//   source hash, source size         u64 each
+//   input                            varint length, digits
+//   steps                            u64
+//   fractions                        binary::putProgram
+//   factored                         one byte, 1 if the rest up to the checksum follows
+//   registers                        varint count, binary::putMpz each
+//   per fraction: scale              zigzag varint
+//                 require, produce,  varint count, then (register varint,
+//                 delta              exponent zigzag varint) pairs
+//   checksum                         u64 FNV-1a of everything before it
+constexpr char PROGRAM_CACHE_MAGIC[8] = {'F', 'R', 'P', 'R', 'O', 'G', '0', '1'};
+
+namespace program_cache_detail {
+
+inline void putSigned(std::string& out, std::int64_t v) {
+    binary::putVarint(out, (static_cast<std::uint64_t>(v) << 1) ^ static_cast<std::uint64_t>(v >> 63));
+}
+
+inline std::int64_t getSigned(binary::Reader& in) {
+    std::uint64_t z = in.varint();
+    return static_cast<std::int64_t>((z >> 1) ^ (~(z & 1) + 1));
+}
+
+inline void putTerms(std::string& out, const std::vector<RegisterTerm>& terms) {
+    binary::putVarint(out, terms.size());
+    for (const auto& t : terms) {
+        binary::putVarint(out, t.reg);
+        putSigned(out, t.exp);
+    }
+}
+
+inline std::vector<RegisterTerm> getTerms(binary::Reader& in, size_t registers) {
+    std::vector<RegisterTerm> terms;
+    std::uint64_t count = in.varint();
+    for (std::uint64_t i = 0; i < count && !in.failed; ++i) {
+        std::uint64_t reg = in.varint();
+        std::int64_t exp = getSigned(in);
+        if (reg >= registers) in.failed = true;
+        terms.push_back({static_cast<std::uint32_t>(reg), exp});
+    }
+    return terms;
+}
+
+} // namespace program_cache_detail
+
+inline std::string encodeCompiledProgram(const CompiledProgram& program) {
+    using namespace program_cache_detail;
+    std::string out(PROGRAM_CACHE_MAGIC, sizeof(PROGRAM_CACHE_MAGIC));
+    binary::putU64(out, program.sourceHash);
+    binary::putU64(out, program.sourceSize);
+    binary::putVarint(out, program.input.size());
+    out += program.input;
+    binary::putU64(out, program.steps);
+    binary::putProgram(out, program.fractions);
+
+    out.push_back(static_cast<char>(program.factored ? 1 : 0));
+    if (program.factored) {
+        const RegisterProgram& factored = *program.factored;
+        binary::putVarint(out, factored.primes.size());
+        for (const auto& p : factored.primes) binary::putMpz(out, p);
+        for (size_t f = 0; f < factored.fractionCount(); ++f) {
+            putSigned(out, factored.scale[f]);
+            putTerms(out, factored.require[f]);
+            putTerms(out, factored.produce[f]);
+            putTerms(out, factored.delta[f]);
+        }
+    }
+    binary::putU64(out, binary::fnv1a(out.data(), out.size()));
+    return out;
+}
+
+// Without `withFactored` the factored section is skipped, not decoded.
+inline bool decodeCompiledProgram(const char* data, size_t size, CompiledProgram& program, std::string& error,
+                                  bool withFactored = true) {
+    using namespace program_cache_detail;
+    if (size < sizeof(PROGRAM_CACHE_MAGIC) + 8 || std::memcmp(data, PROGRAM_CACHE_MAGIC, sizeof(PROGRAM_CACHE_MAGIC)) != 0) {
+        error = "not a compiled FRACTRAN program";
+        return false;
+    }
+    size_t body = size - 8;
+    binary::Reader tail(data + body, 8);
+    if (tail.u64() != binary::fnv1a(data, body)) {
+        error = "checksum mismatch (corrupt program cache)";
+        return false;
+    }
+
+    binary::Reader in(data + sizeof(PROGRAM_CACHE_MAGIC), body - sizeof(PROGRAM_CACHE_MAGIC));
+    program = CompiledProgram();
+    program.sourceHash = in.u64();
+    program.sourceSize = in.u64();
+    std::uint64_t length = in.varint();
+    if (!in.failed && length <= static_cast<std::uint64_t>(in.end - in.pos)) {
+        program.input.assign(reinterpret_cast<const char*>(in.pos), length);
+        in.pos += length;
+    } else {
+        in.failed = true;
+    }
+    program.steps = in.u64();
+    program.fractions = binary::getProgram(in);
+    unsigned char hasFactored = 0;
+    in.bytes(&hasFactored, 1);
+
+    std::shared_ptr<RegisterProgram> factored;
+    if (hasFactored && withFactored) {
+        factored = std::make_shared<RegisterProgram>();
+        std::uint64_t registers = in.varint();
+        for (std::uint64_t r = 0; r < registers && !in.failed; ++r) factored->primes.push_back(in.mpz());
+        for (size_t f = 0; f < program.fractions.size() && !in.failed; ++f) {
+            factored->scale.push_back(static_cast<int>(getSigned(in)));
+            factored->require.push_back(getTerms(in, factored->primes.size()));
+            factored->produce.push_back(getTerms(in, factored->primes.size()));
+            factored->delta.push_back(getTerms(in, factored->primes.size()));
+        }
+    } else if (hasFactored) {
+        in.pos = in.end;
+    }
+    if (in.failed || !in.atEnd()) {
+        error = "malformed program cache";
+        return false;
+    }
+    program.factored = std::move(factored);
+    return true;
+}
+
+// primes.frac is cached as primes.fracc next to it.
+inline std::string programCachePath(const std::string& source) { return source + "c"; }
+
+inline bool readCompiledProgram(const std::string& path, CompiledProgram& program, std::string& error,
+                                bool withFactored = true) {
+    MappedFile file(path);
+    if (!file.isOpen()) {
+        error = "cannot open " + path;
+        return false;
+    }
+    if (!decodeCompiledProgram(file.data(), file.size(), program, error, withFactored)) {
+        error = path + ": " + error;
+        return false;
+    }
+    program.fromCache = true;
+    return true;
+}
+
+// Loads a .frac file through its .fracc. The cache is current when it
+// records the source's size and content hash; timestamps are not trusted
+// (cp -p, rsync -t and tar restore old ones), and hashing the mapped source
+// costs little next to the parse it saves. Otherwise the source is parsed
+// and the cache rewritten; failing to write it (read-only directory) is not
+// an error. With `factor` the program also comes back factored, from the
+// cache if it has the factorization, else built once and added to it. A
+// .fracc path is loaded directly, and `useCache` = false ignores the cache
+// altogether. Syntax errors come back as "file:line:column: message" lines.
+inline bool loadCompiledProgram(const std::string& source, CompiledProgram& program, std::string& error,
+                                bool useCache = true, bool factor = false) {
+    auto factorIfNeeded = [&] {
+        if (factor && !program.factored) {
+            program.factored = std::make_shared<RegisterProgram>(buildRegisterProgram(program.fractions));
+        }
+    };
+    const std::string suffix = ".fracc";
+    if (source.size() >= suffix.size() && source.compare(source.size() - suffix.size(), suffix.size(), suffix) == 0) {
+        if (!readCompiledProgram(source, program, error, factor)) return false;
+        factorIfNeeded();
+        return true;
+    }
+
+    MappedFile file(source);
+    if (!file.isOpen()) {
+        error = "Failed to read file: " + source;
+        return false;
+    }
+    std::string cachePath = programCachePath(source);
+    std::string ignored;
+    CompiledProgram cached;
+    bool cacheValid = useCache && readCompiledProgram(cachePath, cached, ignored, factor);
+    std::uint64_t hash = binary::fnv1a(file.data(), file.size());
+    bool current = cacheValid && cached.sourceHash == hash && cached.sourceSize == file.size();
+
+    if (!current) {
+        FracFile parsed = parseFracText(file.data(), file.size());
+        if (!parsed.ok()) {
+            error.clear();
+            for (const auto& problem : parsed.errors) {
+                if (!error.empty()) error += "\n";
+                error += problem.describe(source);
+            }
+            return false;
+        }
+        cached = CompiledProgram();
+        cached.sourceHash = hash;
+        cached.sourceSize = file.size();
+        cached.fractions = std::move(parsed.fractions);
+        cached.input = std::move(parsed.input);
+        cached.steps = parsed.steps;
+    }
+
+    program = std::move(cached);
+    bool rewrite = !current || (factor && !program.factored);
+    factorIfNeeded();
+    if (useCache && rewrite) writeFileAtomic(cachePath, encodeCompiledProgram(program));
+    return true;
+}
+
+#endif // PROGRAM_CACHE_H
@@ -0,0 +1,405 @@
+#ifndef PROGRAM_OPTIMIZER_H
+#define PROGRAM_OPTIMIZER_H
+
+#include <gmpxx.h>
+#include <algorithm>
+#include <cstdint>
+#include <iomanip>
+#include <limits>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "fractran.h"
+#include "register_program.h"
+
+// Rewrites a program before it runs, without changing what it computes:
+//
+//  - Shadowed fractions go: if an earlier denominator divides a later one,
+//    the earlier fraction always wins and the later never fires.
+//  - Given the input, fractions that cannot fire from it go as well (see
+//    control registers below).
+//  - Chains a -> b -> ... where b provably fires right after a are fused into
+//    one fraction at a's position that takes all their steps at once. Its
+//    denominator stays a's, so it fires exactly when a would. Fractran counts
+//    the steps of the chain (setFusedChains), so step counts stay exact.
+//
+// Registers no denominator reads and unreduced fractions are reported only:
+// the engines test the denominator as written, so 6/4 needs 4 | n and is not
+// the same instruction as 3/2.
+//
+// Control registers: a set C of registers for which "at most one exponent of
+// C in the state" holds in the input and is kept by every fraction that can
+// fire, i.e. none adds more of C than it takes. Compiled programs keep their
+// instruction pointer this way. It proves that fractions needing two of C
+// never fire, and it tells the chain analysis which other fractions are off
+// once one instruction register is known to be set.
+struct OptimizerOptions {
+    const mpz_class* input = nullptr; // start state; enables the input-based passes (not owned)
+    bool fuse = true;
+    unsigned maxChain = 16;           // longest chain fused into one fraction
+};
+
+struct OptimizedProgram {
+    std::vector<mpq_class> fractions;           // what to run
+    std::vector<std::vector<mpz_class>> chains; // for Fractran::setFusedChains; empty if nothing was fused
+    std::vector<long> newIndex;                 // original index -> index in `fractions`, -1 if removed
+
+    // What the passes found, by original index.
+    std::vector<std::pair<size_t, size_t>> shadowed; // (fraction, the earlier fraction that shadows it)
+    std::vector<size_t> unreachable;                 // cannot fire from the input
+    std::vector<size_t> unreduced;
+    std::vector<std::vector<size_t>> fused;          // each fused chain, head first
+    std::vector<mpz_class> unread;                   // registers no remaining denominator reads
+    std::vector<mpz_class> control;                  // control registers
+    bool inputPasses = false;                        // input known, nonzero, no zero numerators
+
+    size_t removed() const { return shadowed.size() + unreachable.size(); }
+
+    // `speedup` is estimateSpeedup's result, or 0 to leave it out.
+    void print(std::ostream& out, const std::vector<mpq_class>& original, double speedup) const;
+};
+
+namespace optimizer_detail {
+
+constexpr std::int64_t UNBOUNDED = std::numeric_limits<std::int64_t>::max();
+
+// A step of the program on states of the input's orbit, as exponents over the
+// register bases. The bases include the input's factors, so every reachable
+// state is exactly a product of bases (times the input's sign) and
+// "denominator divides state" is "every required exponent present".
+struct Analysis {
+    const RegisterProgram& program;
+    const std::vector<bool>& alive;
+    std::vector<bool> isControl;
+    std::vector<std::int64_t> lo, hi; // bounds on the exponents of one abstract state
+
+    std::int64_t required(size_t f, size_t r) const {
+        for (const auto& t : program.require[f]) {
+            if (t.reg == r) return t.exp;
+        }
+        return 0;
+    }
+
+    bool knownToFail(size_t f) const {
+        for (const auto& t : program.require[f]) {
+            if (hi[t.reg] < t.exp) return true;
+        }
+        return false;
+    }
+
+    bool knownToFire(size_t f) const {
+        for (const auto& t : program.require[f]) {
+            if (lo[t.reg] < t.exp) return false;
+        }
+        return true;
+    }
+
+    // At most one exponent of C in any state: once one is known present, the rest are absent.
+    void applyControl() {
+        size_t present = lo.size();
+        for (size_t r = 0; r < lo.size(); ++r) {
+            if (isControl[r] && lo[r] >= 1) present = r;
+        }
+        for (size_t r = 0; r < lo.size(); ++r) {
+            if (isControl[r]) hi[r] = std::min<std::int64_t>(hi[r], present == lo.size() || r == present ? 1 : 0);
+        }
+    }
+
+    // Bounds on the state a fires on. False if a can never fire: some earlier
+    // fraction would always fire first.
+    bool before(size_t a) {
+        lo.assign(program.registerCount(), 0);
+        hi.assign(program.registerCount(), UNBOUNDED);
+        for (const auto& t : program.require[a]) lo[t.reg] = t.exp;
+        applyControl();
+        for (size_t j = 0; j < a; ++j) {
+            if (!alive[j] || knownToFail(j)) continue;
+            // j did not fire, so one of its requirements is missing. When only
+            // one is not already known to be met, that one is.
+            size_t unknown = lo.size(), open = 0;
+            for (const auto& t : program.require[j]) {
+                if (lo[t.reg] < t.exp) {
+                    unknown = t.reg;
+                    open++;
+                }
+            }
+            if (open == 0) return false;
+            if (open == 1) {
+                hi[unknown] = std::min(hi[unknown], required(j, unknown) - 1);
+                if (hi[unknown] < lo[unknown]) return false;
+            }
+        }
+        return true;
+    }
+
+    // Whether f keeps "at most one exponent of C": true if it takes at least
+    // as much of C as it adds, or if the state it fires on holds so little
+    // of C that the total stays at one (e.g. a 55/1 that only fires once
+    // every instruction register is clear). Fractions that never fire keep it.
+    bool keepsInvariant(size_t f) {
+        std::int64_t taken = 0, produced = 0;
+        for (const auto& t : program.require[f]) {
+            if (isControl[t.reg]) taken += t.exp;
+        }
+        for (const auto& t : program.produce[f]) {
+            if (isControl[t.reg]) produced += t.exp;
+        }
+        if (taken > 1 || produced <= taken || !before(f)) return true;
+        std::int64_t most = 0;
+        for (size_t r = 0; r < hi.size() && most < 1; ++r) {
+            if (isControl[r]) most += std::min<std::int64_t>(hi[r], 1);
+        }
+        return most - taken + produced <= 1;
+    }
+
+    // Bounds on the state right after a fired.
+    void after(size_t a) {
+        for (const auto& t : program.delta[a]) {
+            lo[t.reg] += t.exp;
+            if (hi[t.reg] != UNBOUNDED) hi[t.reg] += t.exp;
+        }
+        applyControl();
+    }
+
+    // The fraction that always fires right after a, or -1 if that depends on the state.
+    long next() const {
+        for (size_t k = 0; k < program.fractionCount(); ++k) {
+            if (!alive[k] || knownToFail(k)) continue;
+            return knownToFire(k) ? static_cast<long>(k) : -1;
+        }
+        return -1; // the machine halts after a
+    }
+};
+
+// Shrinks `start` to a control set: while some fraction breaks the invariant,
+// drops one of the registers it adds, the one whose removal leaves the fewest
+// such fractions. The check is quadratic in the program, so large programs go
+// without control registers.
+inline std::vector<bool> controlRegisters(const RegisterProgram& program, const std::vector<bool>& alive,
+                                          const std::vector<bool>& start) {
+    Analysis analysis{program, alive, start, {}, {}};
+    std::vector<bool>& control = analysis.isControl;
+    auto breaking = [&](std::vector<size_t>* list) {
+        size_t count = 0;
+        for (size_t f = 0; f < program.fractionCount(); ++f) {
+            if (!alive[f] || analysis.keepsInvariant(f)) continue;
+            count++;
+            if (list) list->push_back(f);
+        }
+        return count;
+    };
+    std::vector<size_t> broken;
+    while (breaking(&broken) > 0) {
+        size_t best = control.size(), fewest = 0;
+        for (const auto& t : program.delta[broken.front()]) {
+            if (t.exp <= 0 || !control[t.reg]) continue;
+            control[t.reg] = false;
+            size_t left = breaking(nullptr);
+            control[t.reg] = true;
+            if (best == control.size() || left < fewest) {
+                best = t.reg;
+                fewest = left;
+            }
+        }
+        control[best] = false;
+        broken.clear();
+    }
+    return control;
+}
+
+// The largest control set found. Candidates are the registers a denominator
+// reads that the input holds at most once; when the input holds several of
+// them (data next to the start instruction), each is tried as the one kept.
+inline std::vector<bool> controlRegisters(const RegisterProgram& program, const std::vector<bool>& alive,
+                                          const std::vector<std::int64_t>& input) {
+    constexpr size_t MAX_FRACTIONS = 1024;
+    const size_t registers = program.registerCount();
+    std::vector<bool> candidates(registers, false);
+    if (program.fractionCount() > MAX_FRACTIONS) return candidates;
+    for (size_t f = 0; f < program.fractionCount(); ++f) {
+        if (!alive[f]) continue;
+        for (const auto& t : program.require[f]) candidates[t.reg] = input[t.reg] <= 1;
+    }
+    std::vector<size_t> held;
+    for (size_t r = 0; r < registers; ++r) {
+        if (candidates[r] && input[r] == 1) held.push_back(r);
+    }
+    if (held.size() <= 1) return controlRegisters(program, alive, candidates);
+
+    std::vector<bool> best(registers, false);
+    size_t bestSize = 0;
+    for (size_t keep = 0; keep <= held.size(); ++keep) { // keep == held.size(): none of them
+        std::vector<bool> start = candidates;
+        for (size_t i = 0; i < held.size(); ++i) {
+            if (i != keep) start[held[i]] = false;
+        }
+        std::vector<bool> control = controlRegisters(program, alive, start);
+        size_t size = static_cast<size_t>(std::count(control.begin(), control.end(), true));
+        if (size > bestSize) {
+            best = control;
+            bestSize = size;
+        }
+    }
+    return best;
+}
+
+} // namespace optimizer_detail
+
+inline OptimizedProgram optimizeProgram(const std::vector<mpq_class>& fractions,
+                                        const OptimizerOptions& options = OptimizerOptions()) {
+    using namespace optimizer_detail;
+
+    OptimizedProgram out;
+    const size_t count = fractions.size();
+    std::vector<bool> alive(count, true);
+
+    for (size_t f = 0; f < count; ++f) {
+        mpz_class g;
+        mpz_gcd(g.get_mpz_t(), fractions[f].get_num_mpz_t(), fractions[f].get_den_mpz_t());
+        if (g != 1) out.unreduced.push_back(f);
+    }
+
+    // Shadowed: an earlier denominator divides this one.
+    for (size_t j = 0; j < count; ++j) {
+        for (size_t i = 0; i < j; ++i) {
+            if (!alive[i] || !mpz_divisible_p(fractions[j].get_den_mpz_t(), fractions[i].get_den_mpz_t())) continue;
+            alive[j] = false;
+            out.shadowed.emplace_back(j, i);
+            break;
+        }
+    }
+
+    // Input-based passes. A zero state is divisible by everything, so the
+    // input must be nonzero and no fraction may zero it.
+    out.inputPasses = options.input != nullptr && *options.input != 0 &&
+                      std::none_of(fractions.begin(), fractions.end(), [](const mpq_class& f) { return f.get_num() == 0; });
+    std::vector<long> next(count, -1);
+    RegisterProgram program = out.inputPasses ? buildRegisterProgram(fractions, {*options.input})
+                                              : buildRegisterProgram(fractions);
+    if (out.inputPasses) {
+        std::vector<std::int64_t> input;
+        mpz_class cofactor;
+        program.encode(abs(*options.input), input, cofactor);
+
+        Analysis analysis{program, alive, controlRegisters(program, alive, input), {}, {}};
+        for (size_t r = 0; r < program.registerCount(); ++r) {
+            if (analysis.isControl[r]) out.control.push_back(program.primes[r]);
+        }
+        for (size_t a = 0; a < count; ++a) {
+            if (!alive[a]) continue;
+            std::int64_t taken = 0;
+            for (const auto& t : program.require[a]) {
+                if (analysis.isControl[t.reg]) taken += t.exp;
+            }
+            if (taken > 1 || !analysis.before(a)) {
+                alive[a] = false;
+                out.unreachable.push_back(a);
+                continue;
+            }
+            if (!options.fuse) continue;
+            analysis.after(a);
+            next[a] = analysis.next();
+        }
+    }
+
+    std::vector<bool> read(program.registerCount(), false);
+    for (size_t f = 0; f < count; ++f) {
+        if (!alive[f]) continue;
+        for (const auto& t : program.require[f]) read[t.reg] = true;
+    }
+    for (size_t r = 0; r < program.registerCount(); ++r) {
+        if (!read[r]) out.unread.push_back(program.primes[r]);
+    }
+
+    out.newIndex.assign(count, -1);
+    bool anyChain = false;
+    std::vector<std::vector<mpz_class>> chains;
+    for (size_t f = 0; f < count; ++f) {
+        if (!alive[f]) continue;
+        out.newIndex[f] = static_cast<long>(out.fractions.size());
+
+        // Follow the chain. Each next denominator divides the numerator so
+        // far, so the running numerator stays an integer.
+        std::vector<size_t> chain = {f};
+        std::vector<mpz_class> partial;
+        mpz_class numerator = fractions[f].get_num();
+        for (long k = next[f]; k >= 0 && chain.size() < options.maxChain && alive[k]; k = next[k]) {
+            partial.push_back(numerator);
+            mpz_divexact(numerator.get_mpz_t(), numerator.get_mpz_t(), fractions[k].get_den_mpz_t());
+            numerator *= fractions[k].get_num();
+            chain.push_back(static_cast<size_t>(k));
+        }
+        if (chain.size() > 1) {
+            mpq_class fusedFraction;
+            mpz_set(mpq_numref(fusedFraction.get_mpq_t()), numerator.get_mpz_t());
+            mpz_set(mpq_denref(fusedFraction.get_mpq_t()), fractions[f].get_den_mpz_t());
+            out.fractions.push_back(fusedFraction);
+            out.fused.push_back(chain);
+            anyChain = true;
+        } else {
+            out.fractions.push_back(fractions[f]);
+        }
+        chains.push_back(std::move(partial));
+    }
+    if (anyChain) out.chains = std::move(chains);
+    return out;
+}
+
+// Divisibility tests per original step of `optimized` relative to the
+// original, measured over a sample run of both from `input`; the number of
+// tests is what a step of the gmp engine mostly costs.
+inline double estimateSpeedup(const std::vector<mpq_class>& original, const OptimizedProgram& optimized,
+                              const mpz_class& input, std::uint64_t sampleSteps = 10000) {
+    auto testsOf = [&](Fractran& machine, size_t fractionCount) {
+        std::uint64_t tests = 0;
+        for (const StepEvent& s : machine.steps(sampleSteps)) tests += s.fraction + 1;
+        if (machine.isHalted()) tests += fractionCount;
+        return tests;
+    };
+    Fractran before(original, input);
+    Fractran after(optimized.fractions, input);
+    if (!optimized.chains.empty()) after.setFusedChains(optimized.chains);
+    std::uint64_t beforeTests = testsOf(before, original.size());
+    std::uint64_t afterTests = testsOf(after, optimized.fractions.size());
+    return afterTests == 0 ? 1.0 : static_cast<double>(beforeTests) / afterTests;
+}
+
+inline void OptimizedProgram::print(std::ostream& out, const std::vector<mpq_class>& original, double speedup) const {
+    auto name = [&](size_t f) { return "#" + std::to_string(f) + " " + original[f].get_str(); };
+    out << "--- Optimizer ---" << std::endl;
+    out << "Fractions:   " << original.size() << " -> " << fractions.size() << " (" << shadowed.size()
+        << " shadowed, " << unreachable.size() << " unreachable, " << fused.size()
+        << (fused.size() == 1 ? " chain" : " chains") << " fused)" << std::endl;
+    for (const auto& s : shadowed) {
+        out << "  removed " << name(s.first) << ": shadowed by " << name(s.second) << std::endl;
+    }
+    for (size_t f : unreachable) out << "  removed " << name(f) << ": cannot fire from this input" << std::endl;
+    for (const auto& chain : fused) {
+        out << "  fused   ";
+        for (size_t i = 0; i < chain.size(); ++i) out << (i ? " -> " : "") << name(chain[i]);
+        out << std::endl;
+    }
+    if (!inputPasses) out << "Input:       not known or zero; only shadowed fractions were looked for" << std::endl;
+    if (!control.empty()) {
+        out << "Control:    ";
+        for (const auto& p : control) out << " " << p;
+        out << " (at most one present at a time)" << std::endl;
+    }
+    if (!unread.empty()) {
+        out << "Unread:     ";
+        for (const auto& p : unread) out << " " << p;
+        out << " (no denominator reads them)" << std::endl;
+    }
+    if (!unreduced.empty()) {
+        out << "Unreduced: ";
+        for (size_t f : unreduced) out << " " << name(f);
+        out << " (kept: the written denominator is the test)" << std::endl;
+    }
+    if (speedup > 0) {
+        out << "Estimate:    " << std::fixed << std::setprecision(2) << speedup
+            << "x fewer divisibility tests per step" << std::defaultfloat << std::setprecision(6) << std::endl;
+    }
+}
+
+#endif // PROGRAM_OPTIMIZER_H
@@ -0,0 +1,462 @@
+#ifndef REGISTER_FRACTRAN_H
+#define REGISTER_FRACTRAN_H
+
+#include <gmpxx.h>
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "binary_io.h"
+#include "cycle_detector.h"
+#include "dispatch_index.h"
+#include "jit.h"
+#include "loop_accelerator.h"
+#include "macro_cache.h"
+#include "output_writer.h"
+#include "register_program.h"
+#include "run_control.h"
+#include "simd_match.h"
+#include "snapshot.h"
+#include "state_notation.h"
+#include "trace.h"
+
+// How RegisterFractran finds the first fraction that fires.
+enum class MatchStrategy {
+    Linear,  // check every fraction in order
+    Indexed, // DispatchIndex candidates for the current nonzero-register mask
+    Simd     // SimdMatcher over the whole denominator matrix
+};
+
+// Same machine as Fractran, but the state is held as a vector of prime
+// exponents ("registers") instead of one big integer. Each step is a
+// compare-and-add over the registers a fraction touches; mpz_class only
+// appears at the API boundary.
+class RegisterFractran {
+public:
+    // `factored`, if given, must be buildRegisterProgram(fractions), e.g. from
+    // the program cache; it saves factoring the fractions again.
+    RegisterFractran(const std::vector<mpq_class>& fractions, mpz_class num, bool enableHistory = false,
+                     const RegisterProgram* factored = nullptr) {
+        program = factored ? *factored : buildRegisterProgram(fractions);
+        if (!program.encode(num, registers, cofactor)) {
+            // The input shares a factor with a composite register; refine the
+            // register base with the input included so it can be represented.
+            program = buildRegisterProgram(fractions, {num});
+            program.encode(num, registers, cofactor);
+        }
+        fingerprint = binary::programHash(fractions);
+        baseFingerprint = binary::baseHash(program.primes);
+        halted = false;
+        totalSteps = 0;
+        recordHistory = enableHistory;
+        dispatch = DispatchIndex(program);
+        strategy = MatchStrategy::Indexed;
+        accelerateLoops = false;
+        useCache = false;
+        detectCycles = false;
+        nonzeroMask = DispatchIndex::maskOf(registers);
+    }
+
+    void runMachine(std::uint64_t steps);
+    // Runs until the budget, the deadline, a halt, a cycle or an observer
+    // stops it. Observers, like history and traces, need every step, so they
+    // turn off the macro cache, loop acceleration and the JIT for the call.
+    StopReason run(const RunLimits& limits);
+    // Factored and Binary notation write the registers as they are.
+    void printSequence(Notation notation = Notation::Decimal);
+
+    bool isHalted() const { return halted; }
+    mpz_class getLastNumber() const { return program.decode(registers, cofactor); }
+    std::vector<mpz_class> getHistory() const;
+    unsigned long long getStepCount() const { return totalSteps; }
+    // True if the state is p^exponent (exponent 0 for the state 1).
+    bool isPowerOf(unsigned long p, std::uint64_t& exponent) const;
+
+    const RegisterProgram& getProgram() const { return program; }
+    const std::vector<std::int64_t>& getRegisters() const { return registers; }
+
+    // Indexed by default. The SIMD matrix is only built when first selected,
+    // and programs it cannot hold fall back to the linear scan.
+    void setMatchStrategy(MatchStrategy s);
+    MatchStrategy getMatchStrategy() const { return strategy; }
+
+    // Opt-in: collapse repeating fraction cycles into single updates. Step
+    // counts, budgets and halting are exact; it is ignored while recording history.
+    void setLoopAcceleration(bool enabled);
+
+    // Opt-in: memoize blocks of `blockSteps` steps keyed on the registers that
+    // matter (see MacroCache). Takes precedence over loop acceleration, and is
+    // ignored while recording history or for programs with negative or zero numerators.
+    void enableMacroCache(std::uint32_t blockSteps = 16, size_t maxBytes = size_t(64) << 20);
+    const MacroCache::Stats& getMacroCacheStats() const { return cache.stats(); }
+
+    // Opt-in: stop runMachine as soon as the state repeats exactly (Brent's
+    // algorithm) and report the cycle through getCycle(). Detection steps one
+    // fraction at a time, bypassing the cache and loop acceleration, and
+    // switches itself off once a cycle is found. Programs with negative or
+    // zero numerators are not supported.
+    void setCycleDetection(bool enabled);
+    const CycleInfo& getCycle() const { return cycle; }
+
+    // Streams every step to `sink` (not owned; nullptr to detach). Like
+    // history, a sink needs every fraction, so macro-steps are skipped.
+    void setTraceSink(TraceSink* sink) { traceSink = sink; }
+
+    // Opt-in: run on native code generated for this program (see JitProgram).
+    // It is used whenever single steps are not needed, i.e. without history,
+    // trace, cycle detection or macro cache, and replaces loop acceleration.
+    // Returns false with a reason in `error` if the code cannot be built.
+    bool enableJit(std::string& error, const JitOptions& options = JitOptions());
+    // Shares code already loaded for this program, e.g. once for a whole
+    // sweep. False if it was built for another register base (this machine's
+    // input refined the base); the machine then keeps interpreting.
+    bool useJit(std::shared_ptr<const JitProgram> compiled);
+    const JitProgram* getJit() const { return jit.get(); }
+
+    // Saves the registers and cofactor; restore() takes them back only on the
+    // same register base, which the input can refine. It also accepts a
+    // Fractran snapshot of the same fractions if its integer fits the base.
+    // History restarts at the restored state and loop/cycle tracking starts over.
+    Snapshot snapshot() const;
+    bool restore(const Snapshot& snap);
+
+private:
+    bool matches(size_t f) const;
+    long findLinear() const;
+    long findIndexed();
+    long findFirst();
+    void addDelta(const std::vector<RegisterTerm>& delta);
+    void apply(long f);
+    bool runCachedBlock();
+
+    RegisterProgram program;
+    std::uint64_t fingerprint;     // binary::programHash of the fractions
+    std::uint64_t baseFingerprint; // binary::baseHash of program.primes
+    std::vector<std::int64_t> registers;
+    mpz_class cofactor;
+    std::vector<std::vector<std::int64_t>> registerHistory;
+    std::vector<mpz_class> cofactorHistory;
+    bool halted;
+    unsigned long long totalSteps;
+    bool recordHistory;
+    DispatchIndex dispatch;
+    SimdMatcher simd;
+    MatchStrategy strategy;
+    std::uint64_t nonzeroMask; // bit r set while register r (< 64) is nonzero
+    LoopAccelerator accelerator;
+    bool accelerateLoops;
+    MacroCache cache;
+    bool useCache;
+    std::vector<std::int64_t> blockStart;
+    CycleDetector detector;
+    CycleInfo cycle;
+    bool detectCycles;
+    TraceSink* traceSink = nullptr;
+    std::shared_ptr<const JitProgram> jit;
+};
+
+inline bool RegisterFractran::matches(size_t f) const {
+    for (const auto& t : program.require[f]) {
+        if (registers[t.reg] < t.exp) return false;
+    }
+    return true;
+}
+
+// Both return the index of the first fraction that fires, or -1.
+inline long RegisterFractran::findLinear() const {
+    const size_t fractionCount = program.fractionCount();
+    for (size_t f = 0; f < fractionCount; ++f) {
+        if (matches(f)) return static_cast<long>(f);
+    }
+    return -1;
+}
+
+inline long RegisterFractran::findIndexed() {
+    const auto& list = dispatch.candidates(nonzeroMask);
+    for (size_t i = 0; i < list.fractions.size(); ++i) {
+        if (list.certain[i] || matches(list.fractions[i])) return list.fractions[i];
+    }
+    return -1;
+}
+
+inline long RegisterFractran::findFirst() {
+    switch (strategy) {
+        case MatchStrategy::Indexed: return findIndexed();
+        case MatchStrategy::Simd:    return simd.findFirst(registers);
+        default:                     return findLinear();
+    }
+}
+
+inline void RegisterFractran::setMatchStrategy(MatchStrategy s) {
+    if (s == MatchStrategy::Simd) {
+        simd = SimdMatcher(program);
+        if (!simd.usable()) s = MatchStrategy::Linear;
+    }
+    strategy = s;
+}
+
+inline void RegisterFractran::setLoopAcceleration(bool enabled) {
+    accelerateLoops = enabled;
+    if (enabled) accelerator = LoopAccelerator(program.registerCount());
+}
+
+inline void RegisterFractran::enableMacroCache(std::uint32_t blockSteps, size_t maxBytes) {
+    bool signFree = std::all_of(program.scale.begin(), program.scale.end(), [](int v) { return v == 1; });
+    useCache = signFree && blockSteps > 0;
+    if (useCache) cache = MacroCache(program, blockSteps, maxBytes);
+}
+
+inline void RegisterFractran::setCycleDetection(bool enabled) {
+    bool signFree = std::all_of(program.scale.begin(), program.scale.end(), [](int v) { return v == 1; });
+    detectCycles = enabled && signFree;
+    if (detectCycles) {
+        detector = CycleDetector(program);
+        detector.start(registers, totalSteps);
+    }
+}
+
+inline bool RegisterFractran::enableJit(std::string& error, const JitOptions& options) {
+    jit = JitProgram::load(program, error, options);
+    return jit != nullptr;
+}
+
+inline bool RegisterFractran::useJit(std::shared_ptr<const JitProgram> compiled) {
+    if (!compiled || compiled->registerBase() != program.primes) return false;
+    jit = std::move(compiled);
+    return true;
+}
+
+inline Snapshot RegisterFractran::snapshot() const {
+    Snapshot snap;
+    snap.kind = Snapshot::Kind::Registers;
+    snap.programHash = fingerprint;
+    snap.baseHash = baseFingerprint;
+    snap.steps = totalSteps;
+    snap.halted = halted;
+    snap.registers = registers;
+    snap.cofactor = cofactor;
+    return snap;
+}
+
+inline bool RegisterFractran::restore(const Snapshot& snap) {
+    if (snap.programHash != fingerprint) return false;
+    std::vector<std::int64_t> regs = snap.registers;
+    mpz_class rest = snap.cofactor;
+    if (snap.kind == Snapshot::Kind::Integer) {
+        if (!program.encode(snap.state, regs, rest)) return false;
+    } else if (snap.baseHash != baseFingerprint || regs.size() != program.registerCount()) {
+        return false;
+    }
+
+    registers = std::move(regs);
+    cofactor = rest;
+    totalSteps = snap.steps;
+    halted = snap.halted;
+    nonzeroMask = DispatchIndex::maskOf(registers);
+    registerHistory.clear();
+    cofactorHistory.clear();
+    if (accelerateLoops) accelerator = LoopAccelerator(program.registerCount());
+    cycle = CycleInfo();
+    if (detectCycles) detector.start(registers, totalSteps);
+    return true;
+}
+
+inline void RegisterFractran::addDelta(const std::vector<RegisterTerm>& delta) {
+    for (const auto& t : delta) {
+        registers[t.reg] += t.exp;
+        if (t.reg < 64) {
+            std::uint64_t bit = std::uint64_t(1) << t.reg;
+            nonzeroMask = registers[t.reg] ? (nonzeroMask | bit) : (nonzeroMask & ~bit);
+        }
+    }
+}
+
+inline void RegisterFractran::apply(long f) {
+    addDelta(program.delta[f]);
+    if (program.scale[f] != 1) cofactor *= program.scale[f];
+}
+
+// Runs one block of cache.blockSteps() steps, from the cache when possible.
+// Returns false if the machine halted inside the block.
+inline bool RegisterFractran::runCachedBlock() {
+    if (const MacroCache::Entry* hit = cache.find(registers)) {
+        addDelta(hit->delta);
+        totalSteps += hit->steps;
+        return !hit->halted;
+    }
+
+    blockStart = registers;
+    MacroCache::Entry entry{{}, 0, false};
+    while (entry.steps < cache.blockSteps()) {
+        long f = findFirst();
+        if (f < 0) {
+            entry.halted = true;
+            break;
+        }
+        apply(f);
+        entry.steps++;
+    }
+    for (size_t r = 0; r < registers.size(); ++r) {
+        if (registers[r] != blockStart[r]) {
+            entry.delta.push_back({static_cast<std::uint32_t>(r), registers[r] - blockStart[r]});
+        }
+    }
+    totalSteps += entry.steps;
+    bool running = !entry.halted;
+    cache.insert(std::move(entry));
+    return running;
+}
+
+inline void RegisterFractran::runMachine(std::uint64_t steps) {
+    RunLimits limits;
+    limits.steps = steps;
+    run(limits);
+}
+
+inline StopReason RegisterFractran::run(const RunLimits& limits) {
+    if (halted) return StopReason::Halted;
+
+    // A JIT call runs this many steps at most between deadline checks.
+    constexpr std::uint64_t JIT_SLICE = std::uint64_t(1) << 20;
+    const size_t fractionCount = program.fractionCount();
+    const bool timed = limits.hasDeadline();
+    const bool observed = !limits.observers.empty();
+    const bool singleSteps = recordHistory || traceSink || detectCycles || observed;
+    std::uint64_t done = 0;
+    std::uint64_t nextDeadlineCheck = 0;
+    auto stop = [this] {
+        halted = true;
+        return StopReason::Halted;
+    };
+
+    while (done < limits.steps) {
+        if (timed && done >= nextDeadlineCheck) {
+            if (std::chrono::steady_clock::now() >= limits.deadline) return StopReason::Deadline;
+            nextDeadlineCheck = done + RunLimits::DEADLINE_CHECK_EVERY;
+        }
+        const std::uint64_t left = limits.steps - done;
+
+        if (recordHistory) {
+            registerHistory.push_back(registers);
+            cofactorHistory.push_back(cofactor);
+        }
+
+        if (cofactor == 0) {
+            // The state zero (RegisterProgram::encode): fraction 0 fires forever.
+            if (fractionCount == 0) return stop();
+            done++;
+            totalSteps++;
+            if (traceSink) traceSink->onStep(0);
+            if (observed && limits.notify(0)) return StopReason::Predicate;
+            continue;
+        }
+
+        if (jit && !singleSteps && !useCache) {
+            JitResult result = jit->run(registers, timed ? std::min(left, JIT_SLICE) : left);
+            done += result.steps;
+            totalSteps += result.steps;
+            if (result.negate) cofactor = -cofactor;
+            if (result.zero) cofactor = 0;
+            nonzeroMask = DispatchIndex::maskOf(registers);
+            if (result.halted) return stop();
+            continue;
+        }
+
+        if (useCache && !singleSteps && left >= cache.blockSteps()) {
+            unsigned long long before = totalSteps;
+            bool running = runCachedBlock();
+            done += totalSteps - before;
+            if (!running) return stop();
+            continue;
+        }
+
+        long f = findFirst();
+        if (f < 0) return stop();
+
+        apply(f);
+        done++;
+        totalSteps++;
+        if (traceSink) traceSink->onStep(static_cast<std::uint32_t>(f));
+        if (observed && limits.notify(static_cast<std::uint32_t>(f))) return StopReason::Predicate;
+
+        if (detectCycles) {
+            if (detector.observe(program, static_cast<std::uint32_t>(f), registers)) {
+                cycle = detector.result();
+                detectCycles = false;
+                return StopReason::Cycle;
+            }
+            continue;
+        }
+
+        if (accelerateLoops && !singleSteps && !useCache) {
+            accelerator.record(static_cast<std::uint32_t>(f));
+            if (accelerator.period() != 0) {
+                std::uint64_t skipped = accelerator.accelerate(program, registers, limits.steps - done);
+                if (skipped != 0) {
+                    done += skipped;
+                    totalSteps += skipped;
+                    nonzeroMask = DispatchIndex::maskOf(registers);
+                }
+            }
+        }
+    }
+
+    return StopReason::Budget;
+}
+
+inline bool RegisterFractran::isPowerOf(unsigned long p, std::uint64_t& exponent) const {
+    exponent = 0;
+    if (cofactor <= 0 || p < 2) return false;
+    mpz_class prime(p), rest;
+    for (size_t r = 0; r < registers.size(); ++r) {
+        if (registers[r] == 0) continue;
+        if (program.primes[r] == prime) {
+            exponent += static_cast<std::uint64_t>(registers[r]);
+            continue;
+        }
+        // Bases are pairwise coprime, but a large one may still be a power of p.
+        std::uint64_t k = mpz_remove(rest.get_mpz_t(), program.primes[r].get_mpz_t(), prime.get_mpz_t());
+        if (rest != 1) return false;
+        exponent += k * static_cast<std::uint64_t>(registers[r]);
+    }
+    if (cofactor == 1) return true;
+    exponent += mpz_remove(rest.get_mpz_t(), cofactor.get_mpz_t(), prime.get_mpz_t());
+    return rest == 1;
+}
+
+inline std::vector<mpz_class> RegisterFractran::getHistory() const {
+    std::vector<mpz_class> history;
+    history.reserve(registerHistory.size());
+    for (size_t i = 0; i < registerHistory.size(); ++i) {
+        history.push_back(program.decode(registerHistory[i], cofactorHistory[i]));
+    }
+    return history;
+}
+
+inline void RegisterFractran::printSequence(Notation notation) {
+    if (!recordHistory && notation != Notation::Binary) {
+        std::cout << "History disabled for this run (pass 'true' to constructor to enable)." << std::endl;
+        if (notation == Notation::Factored) {
+            std::cout << "Final Value: " << factoredString(program.primes, registers, cofactor) << std::endl;
+        } else {
+            std::cout << "Final Value: " << getLastNumber() << std::endl;
+        }
+        return;
+    }
+    if (notation == Notation::Decimal) {
+        writeSequence(std::cout, getHistory(), halted);
+        return;
+    }
+    // Without history a binary stream holds just the last state.
+    StateWriter writer(std::cout, notation, program.primes);
+    if (recordHistory) {
+        for (size_t i = 0; i < registerHistory.size(); ++i) writer.add(registerHistory[i], cofactorHistory[i]);
+    } else {
+        writer.add(registers, cofactor);
+    }
+    writer.finish(halted);
+}
+
+#endif // REGISTER_FRACTRAN_H
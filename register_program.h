@@ -0,0 +1,192 @@
+#ifndef REGISTER_PROGRAM_H
+#define REGISTER_PROGRAM_H
+
+#include <gmpxx.h>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// One (register, exponent) pair of a factored numerator, denominator or delta.
+struct RegisterTerm {
+    std::uint32_t reg;
+    std::int64_t exp;
+};
+
+// A FRACTRAN program factored over its registers. Every numerator and
+// denominator is written as a product of powers of `primes`, so a step
+// becomes "all required exponents present?" followed by adding a delta.
+struct RegisterProgram {
+    std::vector<mpz_class> primes;                  // register bases, pairwise coprime, ascending
+    std::vector<std::vector<RegisterTerm>> require; // denominator exponents per fraction
+    std::vector<std::vector<RegisterTerm>> produce; // numerator exponents per fraction
+    std::vector<std::vector<RegisterTerm>> delta;   // produce - require, zero entries dropped
+    std::vector<int> scale;                         // sign of the numerator: 1, -1 or 0
+
+    size_t registerCount() const { return primes.size(); }
+    size_t fractionCount() const { return require.size(); }
+
+    // Splits n into register exponents and the cofactor coprime to every register.
+    // Returns false if the cofactor shares a factor with a (composite) register.
+    // Zero encodes as cofactor 0 with no exponents; the engines special-case it,
+    // since zero is divisible by everything: the first fraction fires and the
+    // state stays zero.
+    bool encode(const mpz_class& n, std::vector<std::int64_t>& exps, mpz_class& cofactor) const;
+    mpz_class decode(const std::vector<std::int64_t>& exps, const mpz_class& cofactor) const;
+};
+
+namespace register_detail {
+
+// Primes below this bound are found by trial division; anything left over
+// is split into a pairwise coprime base with gcds instead of being factored.
+constexpr unsigned long TRIAL_LIMIT = 1UL << 16;
+
+inline const std::vector<unsigned long>& smallPrimes() {
+    static const std::vector<unsigned long> primes = [] {
+        std::vector<bool> composite(TRIAL_LIMIT, false);
+        std::vector<unsigned long> out;
+        for (unsigned long i = 2; i < TRIAL_LIMIT; ++i) {
+            if (composite[i]) continue;
+            out.push_back(i);
+            for (unsigned long j = i * i; j < TRIAL_LIMIT; j += i) composite[j] = true;
+        }
+        return out;
+    }();
+    return primes;
+}
+
+// Strips small primes from n, recording them in `found`; returns what is left.
+inline mpz_class stripSmallPrimes(mpz_class n, std::vector<unsigned long>& found) {
+    for (unsigned long p : smallPrimes()) {
+        if (n == 1) break;
+        if (n < static_cast<unsigned long>(p) * p) {
+            if (n < TRIAL_LIMIT) {
+                found.push_back(n.get_ui());
+                n = 1;
+            }
+            break;
+        }
+        if (mpz_divisible_ui_p(n.get_mpz_t(), p)) {
+            found.push_back(p);
+            // mpz_remove divides by repeated squares of p, not one p at a time.
+            mpz_class factor(p);
+            mpz_remove(n.get_mpz_t(), n.get_mpz_t(), factor.get_mpz_t());
+        }
+    }
+    return n;
+}
+
+// Refines a list of integers > 1 into a pairwise coprime base.
+inline void refineCoprime(std::vector<mpz_class>& base) {
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        std::sort(base.begin(), base.end());
+        base.erase(std::unique(base.begin(), base.end()), base.end());
+        for (size_t i = 0; i < base.size() && !changed; ++i) {
+            for (size_t j = i + 1; j < base.size() && !changed; ++j) {
+                mpz_class g;
+                mpz_gcd(g.get_mpz_t(), base[i].get_mpz_t(), base[j].get_mpz_t());
+                if (g == 1) continue;
+                mpz_class a = base[i] / g;
+                mpz_class b = base[j] / g;
+                base.erase(base.begin() + j);
+                base.erase(base.begin() + i);
+                for (const mpz_class& part : {a, b, g}) {
+                    if (part > 1) base.push_back(part);
+                }
+                changed = true;
+            }
+        }
+    }
+}
+
+inline std::vector<RegisterTerm> factorOver(mpz_class n, const std::vector<mpz_class>& primes) {
+    std::vector<RegisterTerm> terms;
+    for (size_t r = 0; r < primes.size() && n != 1; ++r) {
+        if (!mpz_divisible_p(n.get_mpz_t(), primes[r].get_mpz_t())) continue;
+        std::int64_t e = static_cast<std::int64_t>(
+            mpz_remove(n.get_mpz_t(), n.get_mpz_t(), primes[r].get_mpz_t()));
+        terms.push_back({static_cast<std::uint32_t>(r), e});
+    }
+    return terms;
+}
+
+} // namespace register_detail
+
+// Factors every fraction once. `extra` lists further values (typically the
+// input) whose factors must be representable as registers as well.
+inline RegisterProgram buildRegisterProgram(const std::vector<mpq_class>& fractions,
+                                            const std::vector<mpz_class>& extra = {}) {
+    using namespace register_detail;
+
+    std::vector<unsigned long> small;
+    std::vector<mpz_class> large;
+    auto collect = [&](mpz_class n) {
+        n = abs(n);
+        if (n <= 1) return;
+        mpz_class rest = stripSmallPrimes(n, small);
+        if (rest > 1) large.push_back(rest);
+    };
+    for (const auto& frac : fractions) {
+        collect(frac.get_num());
+        collect(frac.get_den());
+    }
+    for (const auto& n : extra) collect(n);
+
+    std::sort(small.begin(), small.end());
+    small.erase(std::unique(small.begin(), small.end()), small.end());
+    refineCoprime(large);
+
+    RegisterProgram prog;
+    for (unsigned long p : small) prog.primes.emplace_back(p);
+    for (const auto& p : large) prog.primes.push_back(p);
+
+    for (const auto& frac : fractions) {
+        mpz_class num = frac.get_num();
+        prog.scale.push_back(sgn(num));
+        prog.produce.push_back(num == 0 ? std::vector<RegisterTerm>{}
+                                        : factorOver(abs(num), prog.primes));
+        prog.require.push_back(factorOver(frac.get_den(), prog.primes));
+
+        std::vector<std::int64_t> net(prog.primes.size(), 0);
+        for (const auto& t : prog.produce.back()) net[t.reg] += t.exp;
+        for (const auto& t : prog.require.back()) net[t.reg] -= t.exp;
+        std::vector<RegisterTerm> delta;
+        for (size_t r = 0; r < net.size(); ++r) {
+            if (net[r] != 0) delta.push_back({static_cast<std::uint32_t>(r), net[r]});
+        }
+        prog.delta.push_back(delta);
+    }
+    return prog;
+}
+
+inline bool RegisterProgram::encode(const mpz_class& n, std::vector<std::int64_t>& exps,
+                                    mpz_class& cofactor) const {
+    exps.assign(primes.size(), 0);
+    cofactor = n;
+    if (n == 0) return true;
+    for (size_t r = 0; r < primes.size(); ++r) {
+        exps[r] = static_cast<std::int64_t>(
+            mpz_remove(cofactor.get_mpz_t(), cofactor.get_mpz_t(), primes[r].get_mpz_t()));
+    }
+    for (const auto& p : primes) {
+        mpz_class g;
+        mpz_gcd(g.get_mpz_t(), cofactor.get_mpz_t(), p.get_mpz_t());
+        if (g != 1) return false;
+    }
+    return true;
+}
+
+inline mpz_class RegisterProgram::decode(const std::vector<std::int64_t>& exps,
+                                         const mpz_class& cofactor) const {
+    mpz_class result = cofactor;
+    mpz_class power;
+    for (size_t r = 0; r < exps.size(); ++r) {
+        if (exps[r] == 0) continue;
+        mpz_pow_ui(power.get_mpz_t(), primes[r].get_mpz_t(), static_cast<unsigned long>(exps[r]));
+        result *= power;
+    }
+    return result;
+}
+
+#endif // REGISTER_PROGRAM_H
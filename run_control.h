@@ -0,0 +1,119 @@
+#ifndef RUN_CONTROL_H
+#define RUN_CONTROL_H
+
+#include <gmpxx.h>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <vector>
+
+// Why a run returned.
+enum class StopReason {
+    Budget,    // took every step it was given
+    Halted,    // no fraction applies
+    Deadline,  // the wall-clock deadline passed
+    Predicate, // a StepObserver asked to stop
+    Cycle      // register engine: cycle detection found a repeat
+};
+
+inline const char* stopReasonName(StopReason reason) {
+    switch (reason) {
+        case StopReason::Budget:    return "budget";
+        case StopReason::Halted:    return "halted";
+        case StopReason::Deadline:  return "deadline";
+        case StopReason::Predicate: return "predicate";
+        default:                    return "cycle";
+    }
+}
+
+// Called after every step with the index of the fraction applied, once the
+// step count includes it. Returning true stops the run right there. Engines
+// step one fraction at a time while observers are attached, so keep
+// afterStep cheap: look at the fraction first and the state only if needed.
+class StepObserver {
+public:
+    virtual ~StepObserver() = default;
+    virtual bool afterStep(std::uint32_t fraction) = 0;
+};
+
+// Limits of one run() call. The deadline is checked every
+// DEADLINE_CHECK_EVERY steps, so a run may overshoot it by that many.
+struct RunLimits {
+    static constexpr std::uint64_t DEADLINE_CHECK_EVERY = 1024;
+
+    std::uint64_t steps = std::numeric_limits<std::uint64_t>::max();
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+    std::vector<StepObserver*> observers; // not owned
+
+    bool hasDeadline() const { return deadline != std::chrono::steady_clock::time_point::max(); }
+
+    bool notify(std::uint32_t fraction) const {
+        bool stop = false;
+        for (StepObserver* observer : observers) stop |= observer->afterStep(fraction);
+        return stop;
+    }
+};
+
+// Stops when fraction `target` has fired `times` times.
+class FractionFired : public StepObserver {
+public:
+    explicit FractionFired(std::uint32_t target, std::uint64_t times = 1) : target(target), remaining(times) {}
+
+    bool afterStep(std::uint32_t fraction) override {
+        return fraction == target && remaining > 0 && --remaining == 0;
+    }
+
+private:
+    std::uint32_t target;
+    std::uint64_t remaining;
+};
+
+// Matches states that are p^k with k >= 1, e.g. the primes of Conway's prime
+// game as the exponents of 2. Only a fraction whose numerator is 1 or a power
+// of p can produce such a state, so the machine's state is examined after
+// those fractions alone; everywhere else the check is one table lookup.
+// Machine needs isPowerOf(p, exponent). `onMatch` (optional) sees each
+// exponent; with `stopAfter` > 0 the run stops at that many matches.
+template <typename Machine>
+class PowerOfPrime : public StepObserver {
+public:
+    PowerOfPrime(const Machine& machine, const std::vector<mpq_class>& fractions, unsigned long prime,
+                 std::uint64_t stopAfter = 0)
+        : machine(machine), prime(prime), stopAfter(stopAfter) {
+        mpz_class p(prime), rest;
+        for (const auto& frac : fractions) {
+            if (frac.get_num() <= 0 || prime < 2) {
+                candidate.push_back(false);
+                continue;
+            }
+            mpz_remove(rest.get_mpz_t(), frac.get_num().get_mpz_t(), p.get_mpz_t());
+            candidate.push_back(rest == 1);
+        }
+    }
+
+    std::function<void(std::uint64_t exponent)> onMatch;
+
+    std::uint64_t matches() const { return count; }
+    std::uint64_t lastExponent() const { return last; }
+
+    bool afterStep(std::uint32_t fraction) override {
+        if (!candidate[fraction]) return false;
+        std::uint64_t exponent = 0;
+        if (!machine.isPowerOf(prime, exponent) || exponent == 0) return false;
+        count++;
+        last = exponent;
+        if (onMatch) onMatch(exponent);
+        return stopAfter != 0 && count >= stopAfter;
+    }
+
+private:
+    const Machine& machine;
+    unsigned long prime;
+    std::uint64_t stopAfter;
+    std::vector<bool> candidate;
+    std::uint64_t count = 0;
+    std::uint64_t last = 0;
+};
+
+#endif // RUN_CONTROL_H
@@ -0,0 +1,142 @@
+#ifndef RUN_STATS_H
+#define RUN_STATS_H
+
+#include <gmpxx.h>
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <iomanip>
+#include <limits>
+#include <numeric>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+// Build with -DFRACTRAN_STATS=0 to compile every instrumentation hook out of
+// the step loops. When compiled in, collection is still off until enabled.
+#ifndef FRACTRAN_STATS
+#define FRACTRAN_STATS 1
+#endif
+constexpr bool STATS_COMPILED_IN = FRACTRAN_STATS != 0;
+
+// What a run spent its steps on. Hits and scan counts cover every step; state
+// size and step latency are sampled every `sampleEvery` steps. Latencies are
+// bucketed by powers of two and include the cost of reading the clock.
+struct RunStats {
+    static constexpr size_t BUCKETS = 64;
+    static constexpr size_t MAX_GROWTH_POINTS = 512;
+
+    bool enabled = false;
+    unsigned sampleEvery = 256;
+    unsigned long long steps = 0;
+    unsigned long long scans = 0;                // first-match searches, including one that halted
+    unsigned long long fractionsScanned = 0;     // fractions tested, including the one that fired
+    unsigned long long runNanos = 0;             // wall time inside runMachine
+    std::vector<unsigned long long> fractionHits;
+    std::array<unsigned long long, BUCKETS> bitsHistogram = {};   // bucket b: state of [2^b, 2^(b+1)) bits
+    std::array<unsigned long long, BUCKETS> latencyHistogram = {}; // bucket b: [2^b, 2^(b+1)) ns
+    unsigned long long latencySamples = 0;
+    unsigned long long latencyNanos = 0;
+    // (step, bits) pairs. When full every other point is dropped and the
+    // spacing doubles, so the whole run stays covered.
+    std::vector<std::pair<unsigned long long, size_t>> growth;
+    unsigned long long growthEvery = 1;
+
+    void start(size_t fractionCount, unsigned every) {
+        *this = RunStats();
+        enabled = true;
+        sampleEvery = every == 0 ? 1 : every;
+        fractionHits.assign(fractionCount, 0);
+    }
+
+    bool sampleDue(unsigned long long step) const { return step % sampleEvery == 0; }
+
+    // `fired` is the index of the fraction applied, or -1 if the machine halted.
+    void recordStep(long fired) {
+        scans++;
+        if (fired < 0) {
+            fractionsScanned += fractionHits.size();
+            return;
+        }
+        steps++;
+        fractionHits[static_cast<size_t>(fired)]++;
+        fractionsScanned += static_cast<unsigned long long>(fired) + 1;
+    }
+
+    void recordSample(unsigned long long step, size_t bits, unsigned long long nanos) {
+        bitsHistogram[bucketOf(bits)]++;
+        latencyHistogram[bucketOf(nanos)]++;
+        latencySamples++;
+        latencyNanos += nanos;
+        if ((step / sampleEvery) % growthEvery != 0) return;
+        growth.emplace_back(step, bits);
+        if (growth.size() == MAX_GROWTH_POINTS) {
+            for (size_t i = 0; i < MAX_GROWTH_POINTS / 2; ++i) growth[i] = growth[2 * i];
+            growth.resize(MAX_GROWTH_POINTS / 2);
+            growthEvery *= 2;
+        }
+    }
+
+    double averageScanned() const { return scans == 0 ? 0.0 : static_cast<double>(fractionsScanned) / scans; }
+
+    // Upper bound of the bucket holding quantile q of the sampled latencies.
+    unsigned long long latencyQuantile(double q) const {
+        unsigned long long seen = 0;
+        for (size_t b = 0; b < BUCKETS; ++b) {
+            seen += latencyHistogram[b];
+            if (latencySamples > 0 && seen >= q * latencySamples) {
+                // The last bucket reaches the top of the range; 2 << 63 would overflow.
+                return b + 1 < BUCKETS ? 2ULL << b : std::numeric_limits<unsigned long long>::max();
+            }
+        }
+        return 0;
+    }
+
+    static size_t bucketOf(unsigned long long v) {
+        return v == 0 ? 0 : static_cast<size_t>(63 - __builtin_clzll(v));
+    }
+
+    void print(std::ostream& out, const std::vector<mpq_class>& fractions, size_t topFractions = 10) const;
+};
+
+inline void RunStats::print(std::ostream& out, const std::vector<mpq_class>& fractions, size_t topFractions) const {
+    out << "--- Run Statistics ---" << std::endl;
+    out << "Steps:          " << steps << " (" << std::fixed << std::setprecision(2) << averageScanned()
+        << " fractions scanned per step)" << std::endl;
+    out << "Time:           " << std::setprecision(3) << runNanos / 1e6 << " ms in runMachine" << std::endl;
+    if (latencySamples > 0) {
+        out << "Step latency:   mean " << std::setprecision(0) << static_cast<double>(latencyNanos) / latencySamples
+            << " ns, p50 < " << latencyQuantile(0.5) << " ns, p99 < " << latencyQuantile(0.99) << " ns ("
+            << latencySamples << " samples, 1 in " << sampleEvery << ")" << std::endl;
+    }
+
+    std::vector<size_t> order(fractionHits.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(),
+                     [this](size_t a, size_t b) { return fractionHits[a] > fractionHits[b]; });
+    out << "Fraction hits:" << std::endl;
+    for (size_t i = 0; i < order.size() && i < topFractions && fractionHits[order[i]] > 0; ++i) {
+        size_t f = order[i];
+        out << "  #" << std::setw(4) << std::left << f << std::right << std::setw(16)
+            << (f < fractions.size() ? fractions[f].get_str() : "?") << std::setw(14) << fractionHits[f] << "  "
+            << std::setprecision(1) << 100.0 * fractionHits[f] / std::max(1ULL, steps) << "%" << std::endl;
+    }
+
+    out << "State size (sampled):" << std::endl;
+    for (size_t b = 0; b < BUCKETS; ++b) {
+        if (bitsHistogram[b] == 0) continue;
+        out << "  " << std::setw(12) << (1ULL << b) << " .. " << std::setw(12) << ((2ULL << b) - 1) << " bits"
+            << std::setw(12) << bitsHistogram[b] << std::endl;
+    }
+    if (!growth.empty()) {
+        out << "State growth:  ";
+        size_t stride = std::max<size_t>(1, growth.size() / 8);
+        for (size_t i = 0; i < growth.size(); i += stride) {
+            out << " step " << growth[i].first << ": " << growth[i].second << " bits;";
+        }
+        out << std::endl;
+    }
+    out << std::defaultfloat << std::setprecision(6);
+}
+
+#endif // RUN_STATS_H
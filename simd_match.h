@@ -0,0 +1,187 @@
+#ifndef SIMD_MATCH_H
+#define SIMD_MATCH_H
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include "register_program.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FRACTRAN_X86 1
+#endif
+
+// Tests every denominator of a RegisterProgram against the state at once.
+// The denominator exponents are stored as a padded structure of arrays:
+// fractions are grouped in blocks of LANES, and each block keeps one row of
+// LANES int16 exponents per register that any of its fractions reads (absent
+// exponents are 0, padding lanes are PAD). A block matches in the lanes where
+// no row exceeds the clamped register, so the first match is the lowest lane
+// of the first block with a lane left. Rows are tested until every lane of
+// the block has failed.
+class SimdMatcher {
+public:
+    enum class Kernel { Scalar, Sse4, Avx2 };
+
+    static constexpr size_t LANES = 16;
+    // Exponents are compared as int16: denominators rarely need more than a
+    // handful of copies of a prime. Registers are clamped to LIMIT, one below
+    // the padding value, so padding lanes never match.
+    static constexpr std::int16_t PAD = std::numeric_limits<std::int16_t>::max();
+    static constexpr std::int16_t LIMIT = PAD - 1;
+
+    SimdMatcher() = default;
+
+    explicit SimdMatcher(const RegisterProgram& program, Kernel forced) {
+        build(program);
+        active = forced;
+    }
+
+    explicit SimdMatcher(const RegisterProgram& program) {
+        build(program);
+        active = detect();
+    }
+
+    static Kernel detect() {
+#ifdef FRACTRAN_X86
+        if (__builtin_cpu_supports("avx2")) return Kernel::Avx2;
+        if (__builtin_cpu_supports("sse4.1")) return Kernel::Sse4;
+#endif
+        return Kernel::Scalar;
+    }
+
+    static const char* kernelName(Kernel k) {
+        switch (k) {
+            case Kernel::Avx2: return "avx2";
+            case Kernel::Sse4: return "sse4";
+            default:           return "scalar";
+        }
+    }
+
+    Kernel kernel() const { return active; }
+    // False if some denominator exponent does not fit the int16 matrix.
+    bool usable() const { return representable; }
+
+    // Index of the first fraction whose denominator divides the state, or -1.
+    long findFirst(const std::vector<std::int64_t>& registers) const {
+        // Without registers every denominator is 1.
+        if (registers.empty()) return fractions > 0 ? 0 : -1;
+        const std::int64_t* regs = registers.data();
+        switch (active) {
+#ifdef FRACTRAN_X86
+            case Kernel::Avx2: return findAvx2(regs);
+            case Kernel::Sse4: return findSse4(regs);
+#endif
+            default: return findScalar(regs);
+        }
+    }
+
+private:
+    static std::int16_t clamp(std::int64_t e) {
+        return e > LIMIT ? LIMIT : static_cast<std::int16_t>(e);
+    }
+
+    void build(const RegisterProgram& program) {
+        fractions = program.fractionCount();
+        const size_t blocks = (fractions + LANES - 1) / LANES;
+        std::vector<std::int64_t> rowOf(program.registerCount(), -1);
+
+        blockBegin.push_back(0);
+        for (size_t b = 0; b < blocks; ++b) {
+            size_t first = rowRegister.size();
+            for (size_t lane = 0; lane < LANES; ++lane) {
+                size_t f = b * LANES + lane;
+                if (f >= fractions) {
+                    // Padding lane: give it a row it can never pass.
+                    if (rowRegister.size() == first) addRow(0);
+                    for (size_t row = first; row < rowRegister.size(); ++row) {
+                        rows[row * LANES + lane] = PAD;
+                    }
+                    continue;
+                }
+                for (const auto& t : program.require[f]) {
+                    if (t.exp > LIMIT) representable = false;
+                    if (rowOf[t.reg] < static_cast<std::int64_t>(first)) {
+                        rowOf[t.reg] = static_cast<std::int64_t>(addRow(t.reg));
+                    }
+                    rows[rowOf[t.reg] * LANES + lane] = static_cast<std::int16_t>(t.exp);
+                }
+            }
+            blockBegin.push_back(rowRegister.size());
+        }
+    }
+
+    // New all-zero row for `reg`: lanes placed before it do not read the
+    // register. Padding lanes come last, so none of them precede a new row.
+    size_t addRow(std::uint32_t reg) {
+        rowRegister.push_back(reg);
+        rows.resize(rows.size() + LANES, 0);
+        return rowRegister.size() - 1;
+    }
+
+    long findScalar(const std::int64_t* regs) const {
+        for (size_t b = 0; b + 1 < blockBegin.size(); ++b) {
+            unsigned fits = (1u << LANES) - 1;
+            for (size_t row = blockBegin[b]; row < blockBegin[b + 1] && fits; ++row) {
+                std::int16_t e = clamp(regs[rowRegister[row]]);
+                for (size_t lane = 0; lane < LANES; ++lane) {
+                    if (rows[row * LANES + lane] > e) fits &= ~(1u << lane);
+                }
+            }
+            if (fits) return static_cast<long>(b * LANES + __builtin_ctz(fits));
+        }
+        return -1;
+    }
+
+#ifdef FRACTRAN_X86
+    // Lane masks below have two bits per int16 lane (movemask works on bytes).
+    static constexpr unsigned ALL_FAIL = 0xFFFFFFFFu;
+
+    static long firstLane(size_t block, unsigned fail) {
+        return static_cast<long>(block * LANES + __builtin_ctz(~fail) / 2);
+    }
+
+    __attribute__((target("avx2"))) long findAvx2(const std::int64_t* regs) const {
+        for (size_t b = 0; b + 1 < blockBegin.size(); ++b) {
+            unsigned fail = 0;
+            __m256i acc = _mm256_setzero_si256();
+            for (size_t row = blockBegin[b]; row < blockBegin[b + 1]; ++row) {
+                __m256i den = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&rows[row * LANES]));
+                acc = _mm256_or_si256(acc, _mm256_cmpgt_epi16(den, _mm256_set1_epi16(clamp(regs[rowRegister[row]]))));
+                fail = static_cast<unsigned>(_mm256_movemask_epi8(acc));
+                if (fail == ALL_FAIL) break;
+            }
+            if (fail != ALL_FAIL) return firstLane(b, fail);
+        }
+        return -1;
+    }
+
+    __attribute__((target("sse4.1"))) long findSse4(const std::int64_t* regs) const {
+        for (size_t b = 0; b + 1 < blockBegin.size(); ++b) {
+            unsigned fail = 0;
+            __m128i lo = _mm_setzero_si128();
+            __m128i hi = _mm_setzero_si128();
+            for (size_t row = blockBegin[b]; row < blockBegin[b + 1]; ++row) {
+                __m128i e = _mm_set1_epi16(clamp(regs[rowRegister[row]]));
+                const __m128i* den = reinterpret_cast<const __m128i*>(&rows[row * LANES]);
+                lo = _mm_or_si128(lo, _mm_cmpgt_epi16(_mm_loadu_si128(den), e));
+                hi = _mm_or_si128(hi, _mm_cmpgt_epi16(_mm_loadu_si128(den + 1), e));
+                fail = static_cast<unsigned>(_mm_movemask_epi8(lo))
+                     | static_cast<unsigned>(_mm_movemask_epi8(hi)) << 16;
+                if (fail == ALL_FAIL) break;
+            }
+            if (fail != ALL_FAIL) return firstLane(b, fail);
+        }
+        return -1;
+    }
+#endif
+
+    std::vector<size_t> blockBegin;          // first row of each block, plus an end marker
+    std::vector<std::uint32_t> rowRegister;  // register behind each row
+    std::vector<std::int16_t> rows;          // [row][lane] denominator exponents
+    size_t fractions = 0;
+    bool representable = true;
+    Kernel active = Kernel::Scalar;
+};
+
+#endif // SIMD_MATCH_H
@@ -0,0 +1,223 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <gmpxx.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "binary_io.h"
+
+// Everything needed to continue a run: the machine state, the step count and
+// whether it halted. `programHash` (binary::programHash) ties a snapshot to
+// the fractions it was taken from, and `baseHash` (binary::baseHash) a
+// register snapshot to the register base its exponents count.
+struct Snapshot {
+    enum class Kind : unsigned char {
+        Integer = 0,   // Fractran: the state as one integer
+        Registers = 1  // RegisterFractran: prime exponents plus the cofactor
+    };
+
+    Kind kind = Kind::Integer;
+    std::uint64_t programHash = 0;
+    unsigned long long steps = 0;
+    bool halted = false;
+    mpz_class state;                      // Integer
+    std::uint64_t baseHash = 0;           // Registers
+    std::vector<std::int64_t> registers;  // Registers
+    mpz_class cofactor;                   // Registers
+};
+
+// Snapshot file layout:
+//   "FRSNAP02"                       magic
+//   kind                             one byte
+//   program hash, steps              u64 each
+//   halted                           one byte
+//   Integer:   state                 binary::putMpz (mpz_export of the limbs)
+//   Registers: base hash             u64
+//              count, exponents      varint, zigzag varints
+//              cofactor              binary::putMpz
+//   checksum                         u64 FNV-1a of everything before it
+// The checksum catches torn or corrupted files; writes are atomic anyway.
+constexpr char SNAPSHOT_MAGIC[8] = {'F', 'R', 'S', 'N', 'A', 'P', '0', '2'};
+
+inline std::string encodeSnapshot(const Snapshot& snap) {
+    std::string out(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    out.push_back(static_cast<char>(snap.kind));
+    binary::putU64(out, snap.programHash);
+    binary::putU64(out, snap.steps);
+    out.push_back(static_cast<char>(snap.halted ? 1 : 0));
+    if (snap.kind == Snapshot::Kind::Integer) {
+        binary::putMpz(out, snap.state);
+    } else {
+        binary::putU64(out, snap.baseHash);
+        binary::putVarint(out, snap.registers.size());
+        for (std::int64_t e : snap.registers) {
+            binary::putVarint(out, (static_cast<std::uint64_t>(e) << 1) ^ static_cast<std::uint64_t>(e >> 63));
+        }
+        binary::putMpz(out, snap.cofactor);
+    }
+    binary::putU64(out, binary::fnv1a(out.data(), out.size()));
+    return out;
+}
+
+inline bool decodeSnapshot(const std::string& bytes, Snapshot& snap, std::string& error) {
+    if (bytes.size() < sizeof(SNAPSHOT_MAGIC) + 8 ||
+        bytes.compare(0, sizeof(SNAPSHOT_MAGIC), SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0) {
+        error = "not a FRACTRAN snapshot";
+        return false;
+    }
+    size_t body = bytes.size() - 8;
+    binary::Reader tail(bytes.data() + body, 8);
+    if (tail.u64() != binary::fnv1a(bytes.data(), body)) {
+        error = "checksum mismatch (corrupt snapshot)";
+        return false;
+    }
+
+    binary::Reader in(bytes.data() + sizeof(SNAPSHOT_MAGIC), body - sizeof(SNAPSHOT_MAGIC));
+    unsigned char header[1] = {0};
+    in.bytes(header, 1);
+    snap = Snapshot();
+    snap.kind = static_cast<Snapshot::Kind>(header[0]);
+    snap.programHash = in.u64();
+    snap.steps = in.u64();
+    in.bytes(header, 1);
+    snap.halted = header[0] != 0;
+    if (snap.kind == Snapshot::Kind::Integer) {
+        snap.state = in.mpz();
+    } else if (snap.kind == Snapshot::Kind::Registers) {
+        snap.baseHash = in.u64();
+        std::uint64_t count = in.varint();
+        for (std::uint64_t r = 0; r < count && !in.failed; ++r) {
+            std::uint64_t z = in.varint();
+            snap.registers.push_back(static_cast<std::int64_t>((z >> 1) ^ (~(z & 1) + 1)));
+        }
+        snap.cofactor = in.mpz();
+    } else {
+        error = "unknown snapshot kind";
+        return false;
+    }
+    if (in.failed || !in.atEnd()) {
+        error = "malformed snapshot";
+        return false;
+    }
+    return true;
+}
+
+inline bool readSnapshot(const std::string& path, Snapshot& snap, std::string& error) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        error = "cannot open " + path;
+        return false;
+    }
+    std::string bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (!decodeSnapshot(bytes, snap, error)) {
+        error = path + ": " + error;
+        return false;
+    }
+    return true;
+}
+
+// Writes `bytes` to `path` so that readers see either the old file or the
+// new one, never a partial write: a temporary file is synced, then renamed over.
+// The temporary is private to this process and call, so concurrent writers of
+// one path (several runs refreshing the same program cache) never mix bytes.
+inline bool writeFileAtomic(const std::string& path, const std::string& bytes) {
+    static std::atomic<unsigned> writes{0};
+    std::string temp = path + "." + std::to_string(::getpid()) + "." + std::to_string(writes.fetch_add(1)) + ".tmp";
+    int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) return false;
+    size_t done = 0;
+    while (done < bytes.size()) {
+        ssize_t n = ::write(fd, bytes.data() + done, bytes.size() - done);
+        if (n <= 0) break;
+        done += static_cast<size_t>(n);
+    }
+    bool ok = done == bytes.size() && ::fsync(fd) == 0;
+    ok = ::close(fd) == 0 && ok;
+    if (!ok || std::rename(temp.c_str(), path.c_str()) != 0) {
+        ::unlink(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Saves snapshots to one file from a background thread, so the machine only
+// pauses long enough to copy its state. If snapshots arrive faster than they
+// can be written, the older pending one is dropped: only the latest matters.
+class SnapshotWriter {
+public:
+    explicit SnapshotWriter(const std::string& path) : path(path), worker([this] { loop(); }) {}
+
+    ~SnapshotWriter() { finish(); }
+
+    SnapshotWriter(const SnapshotWriter&) = delete;
+    SnapshotWriter& operator=(const SnapshotWriter&) = delete;
+
+    void submit(Snapshot snap) {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending = std::move(snap);
+        hasPending = true;
+        wake.notify_one();
+    }
+
+    // Writes whatever is still pending and stops the thread. Returns good().
+    bool finish() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            wake.notify_one();
+        }
+        if (worker.joinable()) worker.join();
+        return good();
+    }
+
+    bool good() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return ok;
+    }
+
+    // Step count of the last snapshot on disk (0 if none was written).
+    unsigned long long lastSteps() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return writtenSteps;
+    }
+
+private:
+    void loop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait(lock, [this] { return hasPending || stopping; });
+            if (!hasPending) return;
+            Snapshot snap = std::move(pending);
+            hasPending = false;
+            lock.unlock();
+            bool written = writeFileAtomic(path, encodeSnapshot(snap));
+            lock.lock();
+            if (written) {
+                writtenSteps = snap.steps;
+            } else {
+                ok = false;
+            }
+        }
+    }
+
+    std::string path;
+    mutable std::mutex mutex;
+    std::condition_variable wake;
+    Snapshot pending;
+    bool hasPending = false;
+    bool stopping = false;
+    bool ok = true;
+    unsigned long long writtenSteps = 0;
+    std::thread worker; // last: starts after the members above exist
+};
+
+#endif // SNAPSHOT_H
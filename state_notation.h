@@ -0,0 +1,223 @@
+#ifndef STATE_NOTATION_H
+#define STATE_NOTATION_H
+
+#include <gmpxx.h>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "binary_io.h"
+#include "register_program.h"
+
+// How printSequence writes states. Decimal is the integer itself; the other
+// two write a state as exponents over the program's registers, so printing
+// costs time in the number of registers rather than in the size of a state
+// with millions of digits.
+enum class Notation {
+    Decimal,  // 2250
+    Factored, // 2 * 3^2 * 5^3; a cofactor outside the registers in brackets: 2^3 * [143]
+    Binary    // FRSTATE1 records, see below
+};
+
+// FRSTATE1 stream, written to stdout by --notation=binary:
+//   "FRSTATE1"                        magic
+//   registers                         varint count, binary::putMpz each
+//   per state: 0                      one byte
+//              nonzero registers      varint count, then (register varint, exponent varint) pairs
+//              cofactor               binary::putMpz (1 unless the state has other factors; 0, negative)
+//   end:       1, halted              one byte each
+constexpr char STATE_STREAM_MAGIC[8] = {'F', 'R', 'S', 'T', 'A', 'T', 'E', '1'};
+
+// "2^3 * 5 * [143]": registers at exponent 0 left out, exponent 1 unwritten,
+// the cofactor last. 1 is "1", the state 0 is "0", a negative state "-...".
+inline void appendFactored(std::string& out, const std::vector<std::string>& bases,
+                           const std::vector<std::int64_t>& exps, const mpz_class& cofactor) {
+    if (cofactor == 0) {
+        out += '0';
+        return;
+    }
+    if (cofactor < 0) out += '-';
+    size_t start = out.size();
+    for (size_t r = 0; r < exps.size(); ++r) {
+        if (exps[r] == 0) continue;
+        if (out.size() != start) out += " * ";
+        out += bases[r];
+        if (exps[r] != 1) {
+            out += '^';
+            out += std::to_string(exps[r]);
+        }
+    }
+    if (mpz_cmpabs_ui(cofactor.get_mpz_t(), 1) != 0) {
+        if (out.size() != start) out += " * ";
+        out += '[';
+        out += mpz_class(abs(cofactor)).get_str();
+        out += ']';
+    } else if (out.size() == start) {
+        out += '1';
+    }
+}
+
+inline std::vector<std::string> registerNames(const std::vector<mpz_class>& bases) {
+    std::vector<std::string> names;
+    for (const auto& base : bases) names.push_back(base.get_str());
+    return names;
+}
+
+inline std::string factoredString(const std::vector<mpz_class>& bases, const std::vector<std::int64_t>& exps,
+                                  const mpz_class& cofactor) {
+    std::string out;
+    appendFactored(out, registerNames(bases), exps, cofactor);
+    return out;
+}
+
+// printSequence in Factored or Binary notation: "s0, s1, ..., HALT" (or
+// "...") in the text form, the FRSTATE1 stream otherwise. Output is buffered
+// and written in large blocks.
+class StateWriter {
+public:
+    StateWriter(std::ostream& out, Notation notation, const std::vector<mpz_class>& bases)
+        : out(out), notation(notation) {
+        buffer.reserve(BLOCK + 256);
+        if (notation == Notation::Binary) {
+            buffer.assign(STATE_STREAM_MAGIC, sizeof(STATE_STREAM_MAGIC));
+            binary::putVarint(buffer, bases.size());
+            for (const auto& base : bases) binary::putMpz(buffer, base);
+        } else {
+            names = registerNames(bases);
+        }
+    }
+
+    void add(const std::vector<std::int64_t>& exps, const mpz_class& cofactor) {
+        if (notation == Notation::Binary) {
+            buffer.push_back(0);
+            size_t nonzero = 0;
+            if (cofactor != 0) { // the registers of the state 0 mean nothing
+                for (auto e : exps) nonzero += e != 0;
+            }
+            binary::putVarint(buffer, nonzero);
+            for (size_t r = 0; r < exps.size() && nonzero != 0; ++r) {
+                if (exps[r] == 0) continue;
+                binary::putVarint(buffer, r);
+                binary::putVarint(buffer, static_cast<std::uint64_t>(exps[r]));
+            }
+            binary::putMpz(buffer, cofactor);
+        } else {
+            appendFactored(buffer, names, exps, cofactor);
+            buffer += ", ";
+        }
+        if (buffer.size() >= BLOCK) flush();
+    }
+
+    void finish(bool halted) {
+        if (notation == Notation::Binary) {
+            buffer.push_back(1);
+            buffer.push_back(static_cast<char>(halted ? 1 : 0));
+        } else {
+            buffer += halted ? "HALT\n" : "...\n";
+        }
+        flush();
+        out.flush();
+    }
+
+private:
+    static constexpr size_t BLOCK = 1 << 16;
+
+    void flush() {
+        out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        buffer.clear();
+    }
+
+    std::ostream& out;
+    Notation notation;
+    std::vector<std::string> names;
+    std::string buffer;
+};
+
+// Reads an FRSTATE1 stream back. Each state comes back with one exponent per
+// register; false at a malformed or truncated stream.
+struct StateStream {
+    std::vector<mpz_class> bases;
+    std::vector<std::vector<std::int64_t>> exps;
+    std::vector<mpz_class> cofactors;
+    bool halted = false;
+};
+
+inline bool readStateStream(const char* data, size_t size, StateStream& stream) {
+    if (size < sizeof(STATE_STREAM_MAGIC) || std::memcmp(data, STATE_STREAM_MAGIC, sizeof(STATE_STREAM_MAGIC)) != 0) {
+        return false;
+    }
+    binary::Reader in(data + sizeof(STATE_STREAM_MAGIC), size - sizeof(STATE_STREAM_MAGIC));
+    stream = StateStream();
+    std::uint64_t registers = in.varint();
+    for (std::uint64_t r = 0; r < registers && !in.failed; ++r) stream.bases.push_back(in.mpz());
+    while (!in.failed) {
+        unsigned char kind = 0;
+        if (!in.bytes(&kind, 1)) return false;
+        if (kind == 1) {
+            unsigned char halted = 0;
+            in.bytes(&halted, 1);
+            stream.halted = halted != 0;
+            return !in.failed && in.atEnd();
+        }
+        if (kind != 0) return false;
+        std::vector<std::int64_t> exps(stream.bases.size(), 0);
+        std::uint64_t nonzero = in.varint();
+        for (std::uint64_t i = 0; i < nonzero && !in.failed; ++i) {
+            std::uint64_t reg = in.varint();
+            std::uint64_t exp = in.varint();
+            if (reg >= exps.size()) return false;
+            exps[reg] = static_cast<std::int64_t>(exp);
+        }
+        stream.exps.push_back(std::move(exps));
+        stream.cofactors.push_back(in.mpz());
+    }
+    return false;
+}
+
+// Follows a big-integer machine's run on exponents: the start state is
+// factored once over the program's registers, and each step() then applies
+// the first fraction whose denominator exponents are present, exactly as the
+// machine did. Lets Fractran print its history factored without dividing a
+// single history entry.
+class StateReplay {
+public:
+    StateReplay(const std::vector<mpq_class>& fractions, const mpz_class& start)
+        : program(buildRegisterProgram(fractions)) {
+        if (!program.encode(start, exps, cofactor)) {
+            // The state shares a factor with a composite register; refine the base.
+            program = buildRegisterProgram(fractions, {start});
+            program.encode(start, exps, cofactor);
+        }
+    }
+
+    const std::vector<mpz_class>& bases() const { return program.primes; }
+    const std::vector<std::int64_t>& exponents() const { return exps; }
+    const mpz_class& getCofactor() const { return cofactor; }
+
+    // False if no fraction applies (the machine halts here).
+    bool step() {
+        if (cofactor == 0) return program.fractionCount() != 0;
+        for (size_t f = 0; f < program.fractionCount(); ++f) {
+            bool fits = true;
+            for (const auto& t : program.require[f]) {
+                if (exps[t.reg] < t.exp) {
+                    fits = false;
+                    break;
+                }
+            }
+            if (!fits) continue;
+            for (const auto& t : program.delta[f]) exps[t.reg] += t.exp;
+            if (program.scale[f] != 1) cofactor *= program.scale[f];
+            return true;
+        }
+        return false;
+    }
+
+private:
+    RegisterProgram program;
+    std::vector<std::int64_t> exps;
+    mpz_class cofactor;
+};
+
+#endif // STATE_NOTATION_H
@@ -0,0 +1,202 @@
+#ifndef STATIC_FRACTRAN_H
+#define STATIC_FRACTRAN_H
+
+#include <gmpxx.h>
+#include <array>
+#include <cstdint>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+// One fraction of a program fixed at build time.
+template <unsigned long long N, unsigned long long D>
+struct Frac {
+    static_assert(N > 0 && D > 0, "StaticFractran fractions must be positive");
+    static constexpr unsigned long long num = N;
+    static constexpr unsigned long long den = D;
+};
+
+namespace static_detail {
+
+// Distinct primes of a 64-bit number, by trial division. Meant for the small
+// terms of hand-written programs: a term with a prime factor far beyond 2^32
+// runs into the compiler's constexpr evaluation limit.
+constexpr size_t MAX_FACTORS = 15; // 2*3*5*...*47 already exceeds 2^64
+
+struct Factors {
+    unsigned long long prime[MAX_FACTORS] = {};
+    size_t count = 0;
+};
+
+constexpr Factors factor(unsigned long long n) {
+    Factors out;
+    for (unsigned long long d = 2; d * d <= n; d += (d == 2 ? 1 : 2)) {
+        if (n % d != 0) continue;
+        out.prime[out.count++] = d;
+        while (n % d == 0) n /= d;
+    }
+    if (n > 1) out.prime[out.count++] = n;
+    return out;
+}
+
+constexpr std::int64_t exponentOf(unsigned long long n, unsigned long long p) {
+    std::int64_t e = 0;
+    while (n % p == 0) {
+        n /= p;
+        ++e;
+    }
+    return e;
+}
+
+template <size_t FRACTIONS>
+struct PrimeSet {
+    unsigned long long prime[2 * FRACTIONS * MAX_FACTORS] = {};
+    size_t count = 0;
+};
+
+// Every prime of every term, ascending.
+template <size_t FRACTIONS>
+constexpr PrimeSet<FRACTIONS> collectPrimes(const std::array<unsigned long long, FRACTIONS>& nums,
+                                            const std::array<unsigned long long, FRACTIONS>& dens) {
+    PrimeSet<FRACTIONS> set;
+    for (size_t f = 0; f < 2 * FRACTIONS; ++f) {
+        Factors fs = factor(f < FRACTIONS ? nums[f] : dens[f - FRACTIONS]);
+        for (size_t i = 0; i < fs.count; ++i) {
+            size_t at = 0;
+            while (at < set.count && set.prime[at] < fs.prime[i]) ++at;
+            if (at < set.count && set.prime[at] == fs.prime[i]) continue;
+            for (size_t j = set.count; j > at; --j) set.prime[j] = set.prime[j - 1];
+            set.prime[at] = fs.prime[i];
+            set.count++;
+        }
+    }
+    return set;
+}
+
+} // namespace static_detail
+
+// FRACTRAN with the program as template parameters, e.g.
+//
+//   using PrimeGame = StaticFractran<Frac<17, 91>, Frac<78, 85>, ..., Frac<55, 1>>;
+//
+// The factorization and register layout are computed at compile time, and a
+// step is the fractions' tests unrolled in order: every exponent compared and
+// every delta added is a constant, and registers a fraction does not touch do
+// not appear in its code at all. Same registers-plus-cofactor state as
+// RegisterFractran, without history, tracing or acceleration.
+template <typename... Fs>
+class StaticFractran {
+    static constexpr size_t FRACTIONS = sizeof...(Fs);
+    static_assert(FRACTIONS > 0, "StaticFractran needs at least one fraction");
+
+    // Reduced, as mpq_class would hold them.
+    static constexpr std::array<unsigned long long, FRACTIONS> NUMS = {Fs::num / std::gcd(Fs::num, Fs::den)...};
+    static constexpr std::array<unsigned long long, FRACTIONS> DENS = {Fs::den / std::gcd(Fs::num, Fs::den)...};
+
+public:
+    static constexpr size_t REGISTERS = static_detail::collectPrimes(NUMS, DENS).count;
+
+private:
+    using Table = std::array<std::array<std::int64_t, REGISTERS == 0 ? 1 : REGISTERS>, FRACTIONS>;
+
+    static constexpr std::array<unsigned long long, REGISTERS == 0 ? 1 : REGISTERS> PRIMES = [] {
+        std::array<unsigned long long, REGISTERS == 0 ? 1 : REGISTERS> primes = {};
+        auto set = static_detail::collectPrimes(NUMS, DENS);
+        for (size_t r = 0; r < REGISTERS; ++r) primes[r] = set.prime[r];
+        return primes;
+    }();
+
+    static constexpr Table REQUIRE = [] {
+        Table t = {};
+        for (size_t f = 0; f < FRACTIONS; ++f)
+            for (size_t r = 0; r < REGISTERS; ++r) t[f][r] = static_detail::exponentOf(DENS[f], PRIMES[r]);
+        return t;
+    }();
+
+    static constexpr Table DELTA = [] {
+        Table t = {};
+        for (size_t f = 0; f < FRACTIONS; ++f)
+            for (size_t r = 0; r < REGISTERS; ++r)
+                t[f][r] = static_detail::exponentOf(NUMS[f], PRIMES[r]) - REQUIRE[f][r];
+        return t;
+    }();
+
+public:
+    explicit StaticFractran(const mpz_class& num) : cofactor(num) {
+        if (cofactor == 0) return;
+        mpz_class p;
+        for (size_t r = 0; r < REGISTERS; ++r) {
+            p = static_cast<unsigned long>(PRIMES[r]);
+            registers[r] = static_cast<std::int64_t>(
+                mpz_remove(cofactor.get_mpz_t(), cofactor.get_mpz_t(), p.get_mpz_t()));
+        }
+    }
+
+    void runMachine(std::uint64_t steps) {
+        if (halted) return;
+        for (std::uint64_t i = 0; i < steps; ++i) {
+            if (cofactor != 0 && !step(std::make_index_sequence<FRACTIONS>{})) {
+                halted = true;
+                return;
+            }
+            totalSteps++;
+        }
+    }
+
+    bool isHalted() const { return halted; }
+    unsigned long long getStepCount() const { return totalSteps; }
+    const std::array<std::int64_t, REGISTERS == 0 ? 1 : REGISTERS>& getRegisters() const { return registers; }
+
+    mpz_class getLastNumber() const {
+        mpz_class result = cofactor;
+        mpz_class power;
+        for (size_t r = 0; r < REGISTERS; ++r) {
+            if (registers[r] == 0) continue;
+            mpz_ui_pow_ui(power.get_mpz_t(), PRIMES[r], static_cast<unsigned long>(registers[r]));
+            result *= power;
+        }
+        return result;
+    }
+
+    // The program as a fraction list, for the runtime engines.
+    static std::vector<mpq_class> fractions() {
+        std::vector<mpq_class> out;
+        for (size_t f = 0; f < FRACTIONS; ++f) {
+            out.push_back(mpq_class(mpz_class(static_cast<unsigned long>(NUMS[f])),
+                                    mpz_class(static_cast<unsigned long>(DENS[f]))));
+        }
+        return out;
+    }
+
+private:
+    template <size_t F, size_t R>
+    bool has() const {
+        if constexpr (REQUIRE[F][R] == 0) return true;
+        else return registers[R] >= REQUIRE[F][R];
+    }
+
+    template <size_t F, size_t R>
+    void add() {
+        if constexpr (DELTA[F][R] != 0) registers[R] += DELTA[F][R];
+    }
+
+    template <size_t F, size_t... Rs>
+    bool fire(std::index_sequence<Rs...>) {
+        if (!(has<F, Rs>() && ...)) return false;
+        (add<F, Rs>(), ...);
+        return true;
+    }
+
+    // The first fraction that fires, in program order; false if none does.
+    template <size_t... Is>
+    bool step(std::index_sequence<Is...>) {
+        return (fire<Is>(std::make_index_sequence<REGISTERS>{}) || ...);
+    }
+
+    std::array<std::int64_t, REGISTERS == 0 ? 1 : REGISTERS> registers = {};
+    mpz_class cofactor;
+    bool halted = false;
+    unsigned long long totalSteps = 0;
+};
+
+#endif // STATIC_FRACTRAN_H
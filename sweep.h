@@ -0,0 +1,340 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <gmpxx.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "batch_fractran.h"
+#include "binary_io.h"
+
+// Outcome of running one input: halted within the budget or not, after how
+// many steps, and on which value. `index` is the input's position in the sweep.
+struct SweepResult {
+    std::uint64_t index = 0;
+    mpz_class input;
+    unsigned long long steps = 0;
+    bool halted = false;
+    mpz_class final;
+};
+
+// The inputs of a sweep: an inclusive range, generated on demand, or a list.
+class SweepInputs {
+public:
+    static SweepInputs range(const mpz_class& from, const mpz_class& to) {
+        SweepInputs inputs;
+        inputs.first = from;
+        inputs.count = (to >= from) ? mpz_class(to - from + 1).get_ui() : 0;
+        return inputs;
+    }
+
+    static SweepInputs list(std::vector<mpz_class> values) {
+        SweepInputs inputs;
+        inputs.count = values.size();
+        inputs.values = std::move(values);
+        return inputs;
+    }
+
+    std::uint64_t size() const { return count; }
+    mpz_class at(std::uint64_t i) const {
+        return values.empty() ? mpz_class(first + static_cast<unsigned long>(i)) : values[i];
+    }
+
+private:
+    mpz_class first;
+    std::uint64_t count = 0;
+    std::vector<mpz_class> values;
+};
+
+enum class SweepFormat { Csv, Binary };
+
+// Sweep output. CSV is "input,steps,halted,final" with a header row. Binary is
+// "FRSWEEP1", the program (binary::putProgram), then per input: varint index,
+// mpz input, varint steps, halted byte, mpz final value. Rows are in completion
+// order, not input order, so nothing is held back behind a slow input.
+constexpr char SWEEP_MAGIC[8] = {'F', 'R', 'S', 'W', 'E', 'E', 'P', '1'};
+
+inline void putSweepRecord(std::string& out, SweepFormat format, const SweepResult& r) {
+    if (format == SweepFormat::Csv) {
+        out += r.input.get_str();
+        out += ',';
+        out += std::to_string(r.steps);
+        out += r.halted ? ",1," : ",0,";
+        out += r.final.get_str();
+        out += '\n';
+        return;
+    }
+    binary::putVarint(out, r.index);
+    binary::putMpz(out, r.input);
+    binary::putVarint(out, r.steps);
+    out.push_back(static_cast<char>(r.halted ? 1 : 0));
+    binary::putMpz(out, r.final);
+}
+
+// Reads one binary record; false at the end or on a truncated record.
+inline bool getSweepRecord(binary::Reader& in, SweepResult& r) {
+    if (in.atEnd()) return false;
+    r.index = in.varint();
+    r.input = in.mpz();
+    r.steps = in.varint();
+    unsigned char halted = 0;
+    in.bytes(&halted, 1);
+    r.halted = halted != 0;
+    r.final = in.mpz();
+    return !in.failed;
+}
+
+inline void writeSweepHeader(std::ostream& out, SweepFormat format, const std::vector<mpq_class>& program) {
+    std::string header;
+    if (format == SweepFormat::Csv) {
+        header = "input,steps,halted,final\n";
+    } else {
+        header.assign(SWEEP_MAGIC, sizeof(SWEEP_MAGIC));
+        binary::putProgram(header, program);
+    }
+    out.write(header.data(), static_cast<std::streamsize>(header.size()));
+}
+
+struct SweepOptions {
+    unsigned threads = 0;                 // 0 = std::thread::hardware_concurrency()
+    std::uint64_t maxSteps = 1000;        // step budget per input
+    std::uint64_t sliceSteps = 1 << 16;   // steps a worker runs before yielding a long input
+    size_t flushBytes = size_t(1) << 16;  // per-worker output buffer
+    size_t batchLanes = 1024;             // runBatchSweep: inputs stepped together per batch
+    unsigned parkedPerThread = 4;         // parked runs per worker before parked work goes first
+    const RegisterProgram* factored = nullptr; // register and batch engines: the program already
+                                               // factored (program_cache.h); null: factored once
+                                               // by the sweep. Shared by every machine.
+};
+
+struct SweepStats {
+    std::uint64_t inputs = 0;
+    std::uint64_t halted = 0;
+    unsigned long long steps = 0;
+    std::uint64_t steals = 0;
+    unsigned threads = 0;
+};
+
+// Runs `Machine(program, input)` for every input on a pool of workers.
+//
+// Fresh inputs are handed out from a shared counter. An input that is still
+// running after `sliceSteps` steps is parked at the back of its worker's
+// deque, and the worker moves on to fresh inputs, so one long run never holds
+// up the short ones. Once fresh inputs run out, or more than
+// `parkedPerThread` runs per worker are parked (each holds a whole machine),
+// workers take their own parked runs and steal the ones parked by others, so
+// the long tail is spread over every thread and memory stays bounded. Each
+// worker formats its results into a private buffer and appends it to `out`
+// under a lock when it fills. `setup(Machine&)` is called on each new machine
+// to apply engine settings.
+template <typename Machine, typename Setup>
+SweepStats runSweep(const std::vector<mpq_class>& program, const SweepInputs& inputs,
+                    const SweepOptions& options, SweepFormat format, std::ostream& out, Setup setup) {
+    struct Task {
+        std::uint64_t index;
+        mpz_class input;
+        std::unique_ptr<Machine> machine;
+    };
+    struct Worker {
+        std::mutex lock;
+        std::deque<Task> parked;
+    };
+
+    unsigned threads = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    std::vector<Worker> workers(threads);
+    std::atomic<std::uint64_t> nextInput{0};
+    std::atomic<std::uint64_t> remaining{inputs.size()};
+    std::atomic<std::uint64_t> halted{0};
+    std::atomic<unsigned long long> steps{0};
+    std::atomic<std::uint64_t> steals{0};
+    std::atomic<std::uint64_t> parkedRuns{0};
+    std::mutex outputLock;
+    const std::uint64_t slice = std::max<std::uint64_t>(1, std::min(options.sliceSteps, options.maxSteps));
+    const std::uint64_t parkLimit = std::uint64_t(std::max(1u, options.parkedPerThread)) * threads;
+
+    constexpr bool takesFactored =
+        std::is_constructible_v<Machine, const std::vector<mpq_class>&, mpz_class, bool, const RegisterProgram*>;
+    RegisterProgram ownFactored;
+    const RegisterProgram* factored = options.factored;
+    if constexpr (takesFactored) {
+        if (!factored) {
+            ownFactored = buildRegisterProgram(program);
+            factored = &ownFactored;
+        }
+    }
+
+    writeSweepHeader(out, format, program);
+
+    auto work = [&](unsigned self) {
+        std::string buffer;
+        auto flush = [&] {
+            std::lock_guard<std::mutex> guard(outputLock);
+            out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            buffer.clear();
+        };
+
+        while (remaining.load(std::memory_order_acquire) > 0) {
+            Task task;
+            auto takeFresh = [&] {
+                if (nextInput.load(std::memory_order_relaxed) >= inputs.size()) return false;
+                std::uint64_t i = nextInput.fetch_add(1, std::memory_order_relaxed);
+                if (i >= inputs.size()) return false;
+                task.index = i;
+                task.input = inputs.at(i);
+                if constexpr (takesFactored) {
+                    task.machine = std::make_unique<Machine>(program, task.input, false, factored);
+                } else {
+                    task.machine = std::make_unique<Machine>(program, task.input);
+                }
+                setup(*task.machine);
+                return true;
+            };
+            auto takeParked = [&] {
+                for (unsigned k = 0; k < threads; ++k) {
+                    Worker& victim = workers[(self + k) % threads];
+                    std::lock_guard<std::mutex> guard(victim.lock);
+                    if (victim.parked.empty()) continue;
+                    if (k == 0) {
+                        task = std::move(victim.parked.front());
+                        victim.parked.pop_front();
+                    } else {
+                        task = std::move(victim.parked.back());
+                        victim.parked.pop_back();
+                        steals.fetch_add(1, std::memory_order_relaxed);
+                    }
+                    parkedRuns.fetch_sub(1, std::memory_order_relaxed);
+                    return true;
+                }
+                return false;
+            };
+            bool crowded = parkedRuns.load(std::memory_order_relaxed) >= parkLimit;
+            bool found = crowded ? (takeParked() || takeFresh()) : (takeFresh() || takeParked());
+            if (!found) {
+                // The last runs are busy on other threads; one may be parked again soon.
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+                continue;
+            }
+
+            Machine& machine = *task.machine;
+            unsigned long long before = machine.getStepCount();
+            std::uint64_t left = options.maxSteps - before;
+            std::uint64_t budget = std::min(left, slice);
+            machine.runMachine(budget);
+            unsigned long long ran = machine.getStepCount() - before;
+            steps.fetch_add(ran, std::memory_order_relaxed);
+
+            // Done when it halted, used its whole budget, or stopped early (cycle detection).
+            bool finished = machine.isHalted() || budget == left || ran < budget;
+            if (!finished) {
+                std::lock_guard<std::mutex> guard(workers[self].lock);
+                workers[self].parked.push_back(std::move(task));
+                parkedRuns.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+
+            SweepResult result;
+            result.index = task.index;
+            result.input = task.input;
+            result.steps = machine.getStepCount();
+            result.halted = machine.isHalted();
+            result.final = machine.getLastNumber();
+            if (result.halted) halted.fetch_add(1, std::memory_order_relaxed);
+            putSweepRecord(buffer, format, result);
+            if (buffer.size() >= options.flushBytes) flush();
+            remaining.fetch_sub(1, std::memory_order_release);
+        }
+        if (!buffer.empty()) flush();
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < threads; ++t) pool.emplace_back(work, t);
+    work(0);
+    for (auto& thread : pool) thread.join();
+    out.flush();
+
+    SweepStats stats;
+    stats.inputs = inputs.size();
+    stats.halted = halted.load();
+    stats.steps = steps.load();
+    stats.steals = steals.load();
+    stats.threads = threads;
+    return stats;
+}
+
+// The same sweep on BatchFractran: each worker claims `batchLanes` inputs at
+// a time and steps them together in lockstep for the whole budget. There is
+// nothing to steal: a batch shrinks as its machines halt, so a long input
+// only keeps its own lane busy. Output is as for runSweep.
+inline SweepStats runBatchSweep(const std::vector<mpq_class>& program, const SweepInputs& inputs,
+                                const SweepOptions& options, SweepFormat format, std::ostream& out) {
+    unsigned threads = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    const std::uint64_t lanes = std::max<size_t>(1, options.batchLanes);
+    std::atomic<std::uint64_t> nextInput{0};
+    std::atomic<std::uint64_t> halted{0};
+    std::atomic<unsigned long long> steps{0};
+    std::mutex outputLock;
+    RegisterProgram ownFactored;
+    const RegisterProgram* factored = options.factored;
+    if (!factored) {
+        ownFactored = buildRegisterProgram(program);
+        factored = &ownFactored;
+    }
+
+    writeSweepHeader(out, format, program);
+
+    auto work = [&] {
+        std::string buffer;
+        while (true) {
+            std::uint64_t first = nextInput.fetch_add(lanes, std::memory_order_relaxed);
+            if (first >= inputs.size()) break;
+            std::uint64_t count = std::min<std::uint64_t>(lanes, inputs.size() - first);
+            std::vector<mpz_class> batchInputs;
+            for (std::uint64_t i = 0; i < count; ++i) batchInputs.push_back(inputs.at(first + i));
+
+            BatchFractran batch(program, batchInputs, factored);
+            batch.runMachine(options.maxSteps);
+            for (std::uint64_t i = 0; i < count; ++i) {
+                SweepResult result;
+                result.index = first + i;
+                result.input = batchInputs[i];
+                result.steps = batch.getStepCount(i);
+                result.halted = batch.isHalted(i);
+                result.final = batch.getLastNumber(i);
+                if (result.halted) halted.fetch_add(1, std::memory_order_relaxed);
+                steps.fetch_add(result.steps, std::memory_order_relaxed);
+                putSweepRecord(buffer, format, result);
+            }
+            if (buffer.size() >= options.flushBytes) {
+                std::lock_guard<std::mutex> guard(outputLock);
+                out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+                buffer.clear();
+            }
+        }
+        std::lock_guard<std::mutex> guard(outputLock);
+        out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < threads; ++t) pool.emplace_back(work);
+    work();
+    for (auto& thread : pool) thread.join();
+    out.flush();
+
+    SweepStats stats;
+    stats.inputs = inputs.size();
+    stats.halted = halted.load();
+    stats.steps = steps.load();
+    stats.threads = threads;
+    return stats;
+}
+
+#endif // SWEEP_H
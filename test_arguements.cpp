@@ -2,6 +2,7 @@
 #include <fstream>
 #include <cassert>
 #include <filesystem>
+#include <chrono>
 #include "arg_parser.h"
 
 namespace fs = std::filesystem;
@@ -63,6 +64,7 @@ void test_file_parsing() {
 
     // 3. Cleanup
     fs::remove(filename);
+    fs::remove(filename + "c");
 
     // 4. Assertions
     assert(conf.success);
@@ -86,6 +88,7 @@ void test_file_override() {
 
     // 3. Cleanup
     fs::remove(filename);
+    fs::remove(filename + "c");
 
     assert(conf.success);
     assert(conf.input == 200); 
@@ -107,6 +110,7 @@ void test_file_override_steps() {
 
     // 3. Cleanup
     fs::remove(filename);
+    fs::remove(filename + "c");
 
     assert(conf.success);
     assert(conf.input == 100); // Kept from file
@@ -125,6 +129,7 @@ void test_file_embedded_steps() {
     FractranConfig conf = parseFractranArgs(args);
 
     fs::remove(filename);
+    fs::remove(filename + "c");
     assert(conf.success);
     assert(conf.input == 10);
     assert(conf.steps == 500); // Should read 500 from file, not default 1000
@@ -144,11 +149,210 @@ void test_file_steps_priority() {
     FractranConfig conf = parseFractranArgs(args);
 
     fs::remove(filename);
+    fs::remove(filename + "c");
     assert(conf.success);
     assert(conf.steps == 50); // CLI (50) overrides File (500)
     pass("File Parsing (CLI Steps override Embedded Steps)");
 }
 
+void test_file_errors() {
+    // Bad tokens are reported with line and column instead of being dropped.
+    std::string filename = "temp_errors.frac";
+    std::ofstream out(filename);
+    out << "3/2, 5/4  # commas separate too\n";
+    out << "7/0 x/3\n";
+    out << "\tSteps:\n";
+    out.close();
+
+    FractranConfig conf = parseFractranArgs({filename, "10"});
+    fs::remove(filename);
+
+    assert(!conf.success);
+    assert(conf.errorMessage == "temp_errors.frac:2:1: zero denominator: '7/0'\n"
+                                "temp_errors.frac:2:5: expected a fraction such as 3/2 or an integer: 'x/3'\n"
+                                "temp_errors.frac:3:2: Steps: needs a value on the same line");
+    pass("File Parsing (errors with line:column)");
+}
+
+void test_file_large_parallel() {
+    // Big literals go through GMP; a text cut into pieces parses the same as
+    // in one piece, error lines included.
+    std::string text = "Input: 2\n123456789012345678901234567890/3 6/4 -5\n";
+    for (int i = 0; i < 150000; ++i) text += std::to_string(i + 1) + "/" + std::to_string(i % 97 + 1) + " 17/91\n";
+    text += "Steps: 99\n1/2 1//2\n";
+
+    FracFile serial = parseFracText(text.data(), text.size(), 1);
+    FracFile parallel = parseFracText(text.data(), text.size(), 4);
+    assert(serial.fractions.size() == 300004 && serial.fractions == parallel.fractions);
+    assert(serial.fractions[0] == mpq_class(mpz_class("123456789012345678901234567890"), 3));
+    assert(serial.fractions[1].get_num() == 6 && serial.fractions[1].get_den() == 4);
+    assert(serial.fractions[2] == -5);
+    assert(parallel.input == "2" && parallel.steps == 99);
+    assert(parallel.errors.size() == 1 && parallel.errors[0].line == 150004 && parallel.errors[0].column == 5);
+    assert(serial.errors[0].describe("big.frac") == parallel.errors[0].describe("big.frac"));
+    pass("File Parsing (big literals, parallel pieces)");
+}
+
+void test_file_program_cache() {
+    // First load writes temp_cached.fracc; later loads read it while it is current.
+    std::string filename = "temp_cached.frac";
+    std::string cached = filename + "c";
+    fs::remove(cached);
+    std::ofstream out(filename);
+    out << "17/91 78/85 19/51 6/4\nInput: 2\nSteps: 77\n";
+    out.close();
+    auto sourceTime = fs::last_write_time(filename);
+
+    FractranConfig first = parseFractranArgs({filename});
+    assert(first.success && fs::exists(cached) && !first.factored);
+    CompiledProgram program;
+    std::string error;
+    assert(loadCompiledProgram(filename, program, error) && program.fromCache);
+    assert(program.fractions == first.program && program.input == "2" && program.steps == 77);
+
+    // The register engine adds the factorization to the cache; the gmp engine skips it.
+    FractranConfig registers = parseFractranArgs({"--engine=registers", filename});
+    assert(registers.success && registers.factored && registers.factored->fractionCount() == 4);
+    assert(loadCompiledProgram(filename, program, error, true, true) && program.fromCache && program.factored);
+    assert(loadCompiledProgram(filename, program, error) && program.fromCache && !program.factored);
+
+    // The .fracc itself can be given in place of the source.
+    FractranConfig direct = parseFractranArgs({cached, "5"});
+    assert(direct.success && direct.program == first.program && direct.input == 2 && direct.steps == 5);
+
+    // Edited source: rebuilt. The same bytes merely touched: reused.
+    out.open(filename);
+    out << "3/2\nInput: 9\n";
+    out.close();
+    fs::last_write_time(filename, sourceTime + std::chrono::hours(1));
+    FractranConfig edited = parseFractranArgs({filename});
+    assert(edited.success && edited.program.size() == 1 && edited.input == 9);
+    fs::last_write_time(filename, sourceTime + std::chrono::hours(2));
+    assert(loadCompiledProgram(filename, program, error) && program.fromCache && program.input == "9");
+
+    // Same size, older time (cp -p, rsync -t, tar x): still rebuilt, since the content hash differs.
+    out.open(filename);
+    out << "5/2\nInput: 9\n";
+    out.close();
+    fs::last_write_time(filename, sourceTime - std::chrono::hours(1));
+    assert(loadCompiledProgram(filename, program, error) && !program.fromCache);
+    assert(program.fractions.size() == 1 && program.fractions[0] == mpq_class(5, 2));
+
+    // A damaged cache is rebuilt; --no-program-cache neither reads nor factors.
+    out.open(cached, std::ios::app);
+    out << "junk";
+    out.close();
+    assert(loadCompiledProgram(filename, program, error) && !program.fromCache && program.fractions.size() == 1);
+    FractranConfig uncached = parseFractranArgs({"--no-program-cache", filename});
+    assert(uncached.success && !uncached.programCache && !uncached.factored && uncached.input == 9);
+
+    fs::remove(filename);
+    fs::remove(cached);
+    pass("File Parsing (.fracc program cache: reuse, staleness, direct load)");
+}
+
+void test_engine_option() {
+    // Scenario: ./fractran --engine=registers 3/2 5
+    std::vector<std::string> args = {"--engine=registers", "3/2", "5"};
+    FractranConfig conf = parseFractranArgs(args);
+
+    assert(conf.success);
+    assert(conf.engine == "registers");
+    assert(conf.program.size() == 1);
+    assert(conf.input == 5);
+
+    FractranConfig batch = parseFractranArgs({"--engine=batch", "--sweep=1..10", "3/2", "20"});
+    assert(batch.success && batch.engine == "batch" && batch.steps == 20);
+
+    FractranConfig jit = parseFractranArgs({"--engine=registers", "--jit", "3/2", "5"});
+    assert(jit.success && jit.jit);
+    assert(!parseFractranArgs({"3/2", "5", "--jit=yes"}).success);
+
+    FractranConfig stats = parseFractranArgs({"--stats", "3/2", "5"});
+    assert(stats.success && stats.stats);
+
+    FractranConfig bad = parseFractranArgs({"3/2", "5", "--engine=abacus"});
+    assert(!bad.success);
+
+    FractranConfig simd = parseFractranArgs({"3/2", "5", "--match=simd"});
+    assert(simd.success);
+    assert(simd.match == "simd");
+    assert(!simd.accelerate && simd.history);
+
+    FractranConfig fast = parseFractranArgs({"--engine=registers", "--accelerate", "--no-history", "3/2", "5"});
+    assert(fast.success);
+    assert(fast.accelerate && !fast.history);
+    assert(fast.cacheBlock == 0);
+
+    assert(parseFractranArgs({"--engine=registers", "--cache", "3/2", "5"}).cacheBlock == 16);
+    assert(parseFractranArgs({"--engine=registers", "--cache=64", "3/2", "5"}).cacheBlock == 64);
+    assert(!parseFractranArgs({"--engine=registers", "--cache=0", "3/2", "5"}).success);
+    assert(parseFractranArgs({"--engine=registers", "--detect-cycles", "3/2", "5"}).detectCycles);
+    // Register-engine options are errors on the other engines, not silently dropped.
+    FractranConfig ignored = parseFractranArgs({"3/2", "2/3", "2", "100", "--detect-cycles"});
+    assert(!ignored.success && ignored.errorMessage == "--detect-cycles needs --engine=registers");
+    assert(!parseFractranArgs({"--accelerate", "--no-history", "3/2", "5"}).success);
+    assert(!parseFractranArgs({"--cache", "3/2", "5"}).success);
+    assert(!parseFractranArgs({"--jit", "3/2", "5"}).success);
+    assert(!parseFractranArgs({"--engine=batch", "--sweep=1..10", "--jit", "3/2", "20"}).success);
+    // And gmp-engine options on the others.
+    FractranConfig sparseOnRegisters = parseFractranArgs({"--engine=registers", "--sparse-history=8", "3/2", "5"});
+    assert(!sparseOnRegisters.success && sparseOnRegisters.errorMessage == "--sparse-history needs --engine=gmp");
+    FractranConfig statsOnRegisters = parseFractranArgs({"--engine=registers", "--stats", "3/2", "5"});
+    assert(!statsOnRegisters.success && statsOnRegisters.errorMessage == "--stats needs --engine=gmp");
+    assert(!parseFractranArgs({"--engine=batch", "--sweep=1..10", "--stats", "3/2", "20"}).success);
+
+    FractranConfig traced = parseFractranArgs({"--trace=run.frtr", "3/2", "5"});
+    assert(traced.success && traced.tracePath == "run.frtr" && !traced.history);
+
+    assert(parseFractranArgs({"--sparse-history=64", "3/2", "5"}).sparseHistory == 64);
+    assert(!parseFractranArgs({"--sparse-history", "3/2", "5"}).success);
+
+    FractranConfig resumed = parseFractranArgs({"--checkpoint=run.snap", "--checkpoint-every=500", "--resume=run.snap", "3/2", "5"});
+    assert(resumed.success && resumed.checkpointPath == "run.snap" && resumed.resumePath == "run.snap");
+    assert(resumed.checkpointEvery == 500);
+    assert(!parseFractranArgs({"--checkpoint-every=0", "3/2", "5"}).success);
+
+    // In sweep mode the inputs come from the sweep, so a lone integer is the step budget.
+    FractranConfig swept = parseFractranArgs({"--sweep=10..20", "--threads=8", "--format=binary", "--output=out.bin", "3/2", "500"});
+    assert(swept.success && swept.sweepRange == "10..20" && swept.steps == 500);
+    assert(swept.threads == 8 && swept.format == "binary" && swept.outputPath == "out.bin");
+    assert(parseFractranArgs({"--sweep-file=inputs.txt", "3/2"}).sweepFile == "inputs.txt");
+    assert(!parseFractranArgs({"--sweep=20..10", "3/2"}).success);
+    assert(!parseFractranArgs({"--sweep=10", "3/2"}).success);
+    assert(!parseFractranArgs({"--format=xml", "3/2", "5"}).success);
+
+    // Step budgets are 64-bit; one that does not fit is an error.
+    assert(parseFractranArgs({"3/2", "5", "5000000000"}).steps == 5000000000ULL);
+    assert(parseFractranArgs({"3/2", "5", "18446744073709551615"}).steps == 18446744073709551615ULL);
+    FractranConfig tooMany = parseFractranArgs({"3/2", "5", "99999999999999999999999"});
+    assert(!tooMany.success && tooMany.errorMessage == "Invalid step count: 99999999999999999999999");
+    assert(!parseFractranArgs({"3/2", "5", "18446744073709551616"}).success);
+
+    FractranConfig limited = parseFractranArgs({"--deadline=0.5", "--stop-at=pow:2:4", "--observe=pow:3", "3/2", "5"});
+    assert(limited.success && limited.deadlineSeconds == 0.5 && limited.observePrime == 3);
+    assert(limited.stopKind == "pow" && limited.stopValue == 2 && limited.stopCount == 4);
+    FractranConfig fired = parseFractranArgs({"--stop-at=fraction:0", "3/2", "5"});
+    assert(fired.success && fired.stopKind == "fraction" && fired.stopValue == 0 && fired.stopCount == 1);
+    assert(!parseFractranArgs({"--deadline=0", "3/2", "5"}).success);
+    assert(!parseFractranArgs({"--deadline=1.2.3", "3/2", "5"}).success);
+    assert(!parseFractranArgs({"--stop-at=pow:4", "3/2", "5"}).success);
+    assert(!parseFractranArgs({"--stop-at=fraction:1:0", "3/2", "5"}).success);
+    assert(!parseFractranArgs({"--stop-at=state:2", "3/2", "5"}).success);
+    assert(!parseFractranArgs({"--observe=2", "3/2", "5"}).success);
+    assert(parseFractranArgs({"--optimize", "3/2", "5"}).optimize);
+    assert(!parseFractranArgs({"--no-program-cache", "3/2", "5"}).programCache);
+    FractranConfig primes = parseFractranArgs({"--primes", "--stop-at=pow:2:10", "3/2", "5"});
+    assert(primes.success && primes.primes && !primes.history && primes.stopCount == 10);
+    assert(!parseFractranArgs({"--primes=2", "3/2", "5"}).success);
+    assert(parseFractranArgs({"3/2", "5"}).notation == "decimal");
+    assert(parseFractranArgs({"--notation=factored", "3/2", "5"}).notation == "factored");
+    assert(parseFractranArgs({"--notation=binary", "3/2", "5"}).notation == "binary");
+    assert(!parseFractranArgs({"--notation=hex", "3/2", "5"}).success);
+    assert(parseFractranArgs({"--limb-pool", "3/2", "5"}).limbPool);
+    pass("Options --engine, --match, --accelerate, --no-history, --cache, --detect-cycles, --jit, --stats, --trace, --sparse-history, --checkpoint, --resume, --sweep, --deadline, --stop-at, --observe, --optimize, --no-program-cache, --primes, --notation, --limb-pool");
+}
+
 int main() {
     std::cout << "--- Testing Argument Parser ---\n";
     test_cli_simple();
@@ -159,6 +363,10 @@ int main() {
     test_file_override_steps();
     test_file_embedded_steps();
     test_file_steps_priority();
+    test_file_errors();
+    test_file_large_parallel();
+    test_file_program_cache();
+    test_engine_option();
     std::cout << "-------------------------------\n";
     std::cout << "All Argument tests passed.\n";
     return 0;
@@ -1,13 +1,35 @@
 #include <iostream>
 #include <vector>
 #include <cassert>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <thread>
 #include "fractran.h"
+#include "register_fractran.h"
+#include "batch_fractran.h"
+#include "static_fractran.h"
+#include "program_optimizer.h"
+#include "sweep.h"
+#include "program_cache.h"
+#include "limb_pool.h"
 
 // Helper to print checkmarks
 void pass(std::string name) {
     std::cout << "[PASS] " << name << std::endl;
 }
 
+// Conway's prime game, the long-running workload most engine tests share.
+std::vector<mpq_class> primeGame() {
+    return { mpq_class(17, 91), mpq_class(78, 85), mpq_class(19, 51), mpq_class(23, 38),
+             mpq_class(29, 33), mpq_class(77, 29), mpq_class(95, 23), mpq_class(77, 19),
+             mpq_class(1, 17),  mpq_class(11, 13), mpq_class(13, 11), mpq_class(15, 2),
+             mpq_class(1, 7),   mpq_class(55, 1) };
+}
+
 void test_basic_multiplication() {
     // Program: Multiply by 3/2
     // Input: 2
@@ -177,7 +199,1238 @@ void test_BBf21() {
 
   pass("BBf21");
 }
-  
+
+void test_register_engine_matches_gmp() {
+  // Same BB programs as above, run on the prime-exponent engine.
+  std::vector<std::vector<mpq_class>> programs = {
+    { mpq_class(1, 45), mpq_class(4, 5), mpq_class(3, 2), mpq_class(25, 3) },
+    { mpq_class(5, 6), mpq_class(49, 2), mpq_class(3, 5), mpq_class(40, 7) },
+    { mpq_class(7, 15), mpq_class(22, 3), mpq_class(6, 77), mpq_class(5, 2), mpq_class(9, 5) }
+  };
+  for (const auto& prog : programs) {
+    Fractran reference(prog, 2, true);
+    RegisterFractran machine(prog, 2, true);
+    reference.runMachine(1000);
+    machine.runMachine(1000);
+
+    assert(machine.getStepCount() == reference.getStepCount());
+    assert(machine.isHalted() == reference.isHalted());
+    assert(machine.getLastNumber() == reference.getLastNumber());
+    assert(machine.getHistory() == reference.getHistory());
+  }
+
+  pass("Register Engine (matches GMP engine)");
+}
+
+void test_register_engine_cofactor() {
+  // Input carries a prime (11) the program never touches, and the program
+  // uses a non-reduced fraction: 6/4 needs 2^2, not just 2.
+  std::vector<mpq_class> prog = { mpq_class(6, 4), mpq_class(5, 3) };
+  mpz_class input = 8 * 11;
+  Fractran reference(prog, input);
+  RegisterFractran machine(prog, input);
+  reference.runMachine(100);
+  machine.runMachine(100);
+
+  assert(machine.getStepCount() == reference.getStepCount());
+  assert(machine.getLastNumber() == reference.getLastNumber());
+  pass("Register Engine (untouched cofactor, non-reduced fraction)");
+}
+
+void test_register_engine_large_primes() {
+  // Registers above the trial-division bound are split with gcds.
+  mpz_class p {"1000000007"};
+  mpz_class q {"998244353"};
+  std::vector<mpq_class> prog = { mpq_class(p, q * 3), mpq_class(q, 2) };
+  Fractran reference(prog, 12);
+  RegisterFractran machine(prog, 12);
+  reference.runMachine(100);
+  machine.runMachine(100);
+
+  assert(machine.getProgram().registerCount() == 4);
+  assert(machine.getLastNumber() == reference.getLastNumber());
+  assert(machine.getLastNumber() == p * q);
+  pass("Register Engine (large prime registers)");
+}
+
+void test_arithmetic_modes_agree() {
+  // Prime game, plus a fraction whose operands do not fit a machine word.
+  mpz_class big {"340282366920938463463374607431768211457"};
+  std::vector<mpq_class> prog = primeGame();
+  prog.insert(prog.begin(), mpq_class(big * 3, big * 7));
+  for (mpz_class input : {mpz_class(2), mpz_class(big * 2)}) {
+    Fractran reference(prog, input, true, ArithmeticMode::Reference);
+    Fractran inPlace(prog, input, true, ArithmeticMode::InPlace);
+    Fractran native(prog, input, true, ArithmeticMode::Native);
+    reference.runMachine(5000);
+    inPlace.runMachine(5000);
+    native.runMachine(5000);
+
+    assert(inPlace.getStepCount() == reference.getStepCount());
+    assert(inPlace.getHistory() == reference.getHistory());
+    assert(native.getStepCount() == reference.getStepCount());
+    assert(native.getHistory() == reference.getHistory());
+  }
+  pass("Arithmetic Modes (reference == in-place == native)");
+}
+
+void test_native_promotion_and_demotion() {
+  // While 3 is present, 6/3 doubles the state: it climbs past 2^64.
+  // Without the 3, 5/1 and 1/10 take the twos away again one by one.
+  std::vector<mpq_class> prog = { mpq_class(1, 10), mpq_class(6, 3), mpq_class(5, 1) };
+  Fractran reference(prog, 3, true, ArithmeticMode::Reference);
+  Fractran native(prog, 3, true, ArithmeticMode::Native);
+  reference.runMachine(90);  // 2^89 * 3: well beyond a word
+  native.runMachine(90);
+  assert(native.getLastNumber() == reference.getLastNumber());
+
+  // Dropping the 3 marker lets 1/10 strip the twos again
+  Fractran shrinkRef(prog, reference.getLastNumber() / 3, true, ArithmeticMode::Reference);
+  Fractran shrink(prog, reference.getLastNumber() / 3, true, ArithmeticMode::Native);
+  shrinkRef.runMachine(1000);
+  shrink.runMachine(1000);
+  assert(shrink.getStepCount() == shrinkRef.getStepCount());
+  assert(shrink.getHistory() == shrinkRef.getHistory());
+  assert(shrink.isHalted() == shrinkRef.isHalted());
+  pass("Native Tier (promotion past 64 bits and demotion)");
+}
+
+void test_dispatch_index() {
+  // 70 registers: the top ones have no mask bit and must be checked in full.
+  std::vector<mpz_class> primes;
+  for (mpz_class p = 2; primes.size() < 70; mpz_nextprime(p.get_mpz_t(), p.get_mpz_t())) {
+    primes.push_back(p);
+  }
+  std::vector<mpq_class> prog;
+  for (size_t i = primes.size() - 1; i > 0; --i) {
+    prog.push_back(mpq_class(primes[i] * primes[0], primes[i - 1] * primes[i - 1]));
+  }
+  prog.push_back(mpq_class(primes[1], primes[69]));
+  prog.push_back(mpq_class(3, 1));
+  mpz_class input = primes[0] * primes[0] * primes[0] * primes[68];
+
+  Fractran reference(prog, input, true);
+  RegisterFractran indexed(prog, input, true);
+  RegisterFractran linear(prog, input, true);
+  linear.setMatchStrategy(MatchStrategy::Linear);
+  reference.runMachine(2000);
+  indexed.runMachine(2000);
+  linear.runMachine(2000);
+
+  assert(indexed.getHistory() == reference.getHistory());
+  assert(linear.getHistory() == reference.getHistory());
+
+  // Denominator 1 needs no register, so it sits in every list: the memo is
+  // bounded by the fraction indices it holds, not by the number of lists.
+  std::vector<mpq_class> wide = prog;
+  wide.insert(wide.end(), 5000, mpq_class(3, 1));
+  RegisterProgram factored = buildRegisterProgram(wide);
+  DispatchIndex index(factored);
+  for (std::uint64_t mask = 0; mask < 2000; ++mask) {
+    assert(index.candidates(mask << 1).fractions.size() >= 5000);
+    assert(index.storedCandidates() <= DispatchIndex::MAX_CANDIDATES + wide.size());
+  }
+  pass("Dispatch Index (first-match order, more than 64 registers, bounded memo)");
+}
+
+void test_simd_kernels() {
+  // BBf20 has 5 fractions (one partial block); padded to 21 for one full block of dead fractions and a partial one.
+  std::vector<mpq_class> prog = { mpq_class(7, 15), mpq_class(22, 3), mpq_class(6, 77),
+                                  mpq_class(5, 2), mpq_class(9, 5) };
+  for (int round = 0; round < 2; ++round) {
+    Fractran reference(prog, 2, true);
+    reference.runMachine(1000);
+
+    RegisterFractran machine(prog, 2);
+    RegisterProgram program = machine.getProgram();
+    for (auto kernel : { SimdMatcher::Kernel::Scalar, SimdMatcher::detect() }) {
+      SimdMatcher matcher(program, kernel);
+      for (const auto& state : reference.getHistory()) {
+        std::vector<std::int64_t> regs;
+        mpz_class cofactor;
+        program.encode(state, regs, cofactor);
+
+        long expected = -1;
+        for (size_t f = 0; f < prog.size() && expected < 0; ++f) {
+          if (mpz_divisible_p(state.get_mpz_t(), prog[f].get_den_mpz_t())) expected = f;
+        }
+        assert(matcher.findFirst(regs) == expected);
+      }
+    }
+
+    RegisterFractran simd(prog, 2, true);
+    simd.setMatchStrategy(MatchStrategy::Simd);
+    simd.runMachine(1000);
+    assert(simd.getHistory() == reference.getHistory());
+
+    std::vector<mpq_class> padded(16, mpq_class(1, 11 * 13));
+    padded.insert(padded.end(), prog.begin(), prog.end());
+    prog = padded;
+  }
+  pass("SIMD Kernels (scalar and detected kernel agree with GMP)");
+}
+
+void test_loop_acceleration() {
+  std::vector<mpq_class> primes = primeGame();
+  std::vector<std::vector<mpq_class>> programs = {
+    primes,
+    { mpq_class(7, 15), mpq_class(22, 3), mpq_class(6, 77), mpq_class(5, 2), mpq_class(9, 5) },
+    { mpq_class(7, 15), mpq_class(4, 3), mpq_class(27, 14), mpq_class(5, 2), mpq_class(9, 5) }
+  };
+  for (const auto& prog : programs) {
+    // Odd budgets split across calls so acceleration has to stop mid-cycle.
+    for (int budget : {1, 7, 1000, 123457}) {
+      RegisterFractran plain(prog, 2);
+      RegisterFractran fast(prog, 2);
+      fast.setLoopAcceleration(true);
+      for (int call = 0; call < 3; ++call) {
+        plain.runMachine(budget);
+        fast.runMachine(budget);
+        assert(fast.getStepCount() == plain.getStepCount());
+        assert(fast.getRegisters() == plain.getRegisters());
+        assert(fast.isHalted() == plain.isHalted());
+      }
+    }
+  }
+
+  // BBf21 halts after 31957632 steps; accelerated it is quick enough to run here.
+  RegisterFractran bb21(programs[2], 2);
+  bb21.setLoopAcceleration(true);
+  bb21.runMachine(100000000);
+  assert(bb21.isHalted());
+  assert(bb21.getStepCount() == 31957632);
+
+  // A 64-bit budget never pushes a register past INT64_MAX: passes stop just short of it.
+  RegisterProgram doubling = buildRegisterProgram({ mpq_class(2, 1) });
+  LoopAccelerator accelerator(doubling.registerCount());
+  std::vector<std::int64_t> regs(doubling.registerCount(), 0);
+  regs[0] = std::numeric_limits<std::int64_t>::max() - 10;
+  accelerator.record(0);
+  accelerator.record(0);
+  assert(accelerator.accelerate(doubling, regs, std::numeric_limits<std::uint64_t>::max()) == 10);
+  assert(regs[0] == std::numeric_limits<std::int64_t>::max());
+  accelerator.record(0);
+  accelerator.record(0);
+  assert(accelerator.accelerate(doubling, regs, std::numeric_limits<std::uint64_t>::max()) == 0);
+  pass("Loop Acceleration (exact steps, budgets and halting, no register overflow)");
+}
+
+void test_macro_cache() {
+  std::vector<mpq_class> primes = primeGame();
+  std::vector<mpq_class> bb20 = { mpq_class(7, 15), mpq_class(22, 3), mpq_class(6, 77),
+                                  mpq_class(5, 2), mpq_class(9, 5) };
+  for (const auto& prog : {primes, bb20}) {
+    for (std::uint32_t block : {1u, 16u, 100u}) {
+      RegisterFractran plain(prog, 2);
+      RegisterFractran cached(prog, 2);
+      cached.enableMacroCache(block, 1 << 16); // small cap: forces evictions
+      for (int call = 0; call < 4; ++call) {
+        plain.runMachine(250007);
+        cached.runMachine(250007);
+        assert(cached.getStepCount() == plain.getStepCount());
+        assert(cached.getRegisters() == plain.getRegisters());
+        assert(cached.isHalted() == plain.isHalted());
+      }
+      const auto& stats = cached.getMacroCacheStats();
+      assert(stats.bytes <= (1 << 16));
+      assert(stats.hits + stats.misses > 0);
+    }
+  }
+
+  RegisterFractran prime(primes, 2);
+  prime.enableMacroCache(16);
+  prime.runMachine(2000000);
+  assert(prime.getMacroCacheStats().hits > prime.getMacroCacheStats().misses);
+  pass("Macro-step Cache (exact runs, memory cap, hits)");
+}
+
+void test_cycle_detection() {
+  // 1/3 drains five 3s, then 2 -> 7 -> 2 -> ... forever.
+  std::vector<mpq_class> prog = { mpq_class(1, 3), mpq_class(7, 2), mpq_class(2, 7) };
+  RegisterFractran machine(prog, 2 * 243);
+  machine.setCycleDetection(true);
+  machine.runMachine(1000000);
+
+  assert(machine.getCycle().found);
+  assert(machine.getCycle().start == 5);
+  assert(machine.getCycle().period == 2);
+  assert(machine.getStepCount() < 100);
+  assert(!machine.isHalted());
+
+  // Detection started after some steps already ran; longer period.
+  std::vector<mpq_class> rotate = { mpq_class(3, 2), mpq_class(5, 3), mpq_class(7, 5), mpq_class(2, 7) };
+  RegisterFractran rotating(rotate, 2);
+  rotating.runMachine(10);
+  rotating.setCycleDetection(true);
+  rotating.runMachine(1000000);
+  assert(rotating.getCycle().found);
+  assert(rotating.getCycle().start == 10);
+  assert(rotating.getCycle().period == 4);
+
+  // A halting program and a diverging one never report a cycle.
+  std::vector<mpq_class> bb17 = { mpq_class(5, 6), mpq_class(49, 2), mpq_class(3, 5), mpq_class(40, 7) };
+  RegisterFractran halting(bb17, 2);
+  halting.setCycleDetection(true);
+  halting.runMachine(1000);
+  assert(halting.isHalted() && !halting.getCycle().found);
+  assert(halting.getStepCount() == 107);
+
+  RegisterFractran growing({ mpq_class(2, 1) }, 1);
+  growing.setCycleDetection(true);
+  growing.runMachine(10000);
+  assert(!growing.getCycle().found && growing.getStepCount() == 10000);
+  pass("Cycle Detection (Brent, start and period)");
+}
+
+void test_trace_round_trip() {
+  std::vector<mpq_class> prog = { mpq_class(7, 15), mpq_class(22, 3), mpq_class(6, 77),
+                                  mpq_class(5, 2), mpq_class(9, 5) };
+  Fractran reference(prog, 2, true);
+  reference.runMachine(1000);
+  std::vector<mpz_class> states = reference.getHistory();
+  states.push_back(reference.getLastNumber());
+
+  for (int engine = 0; engine < 2; ++engine) {
+    std::string filename = "temp_trace.frtr";
+    {
+      TraceWriter writer(filename, prog, 2, 16); // tiny buffer: many flushes
+      assert(writer.good());
+      if (engine == 0) {
+        Fractran machine(prog, 2);
+        machine.setTraceSink(&writer);
+        machine.runMachine(1000);
+      } else {
+        RegisterFractran machine(prog, 2);
+        machine.setTraceSink(&writer);
+        machine.runMachine(1000);
+      }
+      assert(writer.stepsWritten() == reference.getStepCount());
+    }
+
+    TraceReader trace(filename);
+    assert(trace.good());
+    assert(trace.program() == prog);
+    mpz_class state = trace.initialState();
+    size_t step = 0;
+    std::uint32_t fraction;
+    assert(state == states[0]);
+    while (trace.next(fraction)) {
+      trace.apply(state, fraction);
+      assert(state == states[++step]);
+    }
+    assert(trace.good());
+    assert(step == reference.getStepCount());
+    std::remove(filename.c_str());
+  }
+
+  // A fraction with a zero denominator is refused when the header is read, not divided by.
+  std::string filename = "temp_bad.frtr";
+  std::string bytes(TRACE_MAGIC, sizeof(TRACE_MAGIC));
+  binary::putVarint(bytes, 1);
+  binary::putMpz(bytes, 3);
+  binary::putMpz(bytes, 0);
+  binary::putMpz(bytes, 2);
+  binary::putVarint(bytes, 0);
+  std::ofstream(filename, std::ios::binary) << bytes;
+  TraceReader bad(filename);
+  std::uint32_t fraction;
+  assert(!bad.good() && !bad.next(fraction));
+  assert(bad.errorMessage().find("corrupt trace") != std::string::npos);
+  std::remove(filename.c_str());
+  pass("Trace Sink (stream, mmap, replay)");
+}
+
+void test_sparse_history() {
+  std::vector<mpq_class> prog = { mpq_class(7, 15), mpq_class(22, 3), mpq_class(6, 77),
+                                  mpq_class(5, 2), mpq_class(9, 5) };
+  Fractran reference(prog, 2, true);
+  reference.runMachine(1000);
+  const std::vector<mpz_class>& full = reference.getHistory();
+
+  for (size_t interval : {1, 7, 64, 5000}) {
+    Fractran machine(prog, 2);
+    machine.enableSparseHistory(interval);
+    machine.runMachine(300);
+    machine.runMachine(1000);
+
+    HistoryView view = machine.historyView();
+    assert(view.size() == full.size());
+    for (size_t i = full.size(); i-- > 0; ) {
+      assert(view[i] == full[i]); // random access, backwards
+    }
+    size_t i = 0;
+    for (const auto& state : view) {
+      assert(state == full[i++]);  // sequential replay
+    }
+    assert(machine.getHistory() == full); // adapter for existing consumers
+  }
+  pass("Sparse Checkpoint History (getState, view, getHistory)");
+}
+
+void test_snapshot_resume() {
+  std::vector<mpq_class> prog = primeGame();
+  Fractran reference(prog, 2);
+  reference.runMachine(5000);
+
+  // Interrupted after 1234 steps, saved, decoded and continued elsewhere.
+  for (ArithmeticMode mode : {ArithmeticMode::InPlace, ArithmeticMode::Native}) {
+    Fractran first(prog, 2, false, mode);
+    first.runMachine(1234);
+    Snapshot decoded;
+    std::string error;
+    assert(decodeSnapshot(encodeSnapshot(first.snapshot()), decoded, error));
+    assert(decoded.steps == 1234 && decoded.state == first.getLastNumber());
+
+    Fractran second(prog, 2, false, mode);
+    assert(second.restore(decoded));
+    second.runMachine(5000 - 1234);
+    assert(second.getLastNumber() == reference.getLastNumber());
+    assert(second.getStepCount() == reference.getStepCount());
+  }
+
+  // Register engine: its own snapshots, and integer snapshots of the same program.
+  RegisterFractran regs(prog, 2);
+  regs.runMachine(1234);
+  Snapshot saved;
+  std::string error;
+  assert(decodeSnapshot(encodeSnapshot(regs.snapshot()), saved, error));
+  RegisterFractran resumed(prog, 2);
+  assert(resumed.restore(saved));
+  resumed.runMachine(5000 - 1234);
+  assert(resumed.getLastNumber() == reference.getLastNumber());
+  RegisterFractran crossed(prog, 2);
+  Fractran gmpAt1234(prog, 2);
+  gmpAt1234.runMachine(1234);
+  assert(crossed.restore(gmpAt1234.snapshot()));
+  assert(crossed.getRegisters() == regs.getRegisters());
+
+  // The input refines composite registers, so exponents saved on one base are
+  // refused by a machine whose input split the registers differently.
+  const mpz_class p = 65537, q = 65539, r = 65543, s = 65551;
+  std::vector<mpq_class> composite = { mpq_class(mpz_class(3), p * q), mpq_class(mpz_class(5), r * s) };
+  RegisterFractran fromA(composite, p * p * q * r * r * s * s);
+  fromA.runMachine(1);
+  RegisterFractran fromB(composite, r * r * s * p * q);
+  assert(!fromB.restore(fromA.snapshot()));
+  assert(decodeSnapshot(encodeSnapshot(fromA.snapshot()), saved, error) && !fromB.restore(saved));
+  RegisterFractran sameBase(composite, p * p * q * r * r * s * s);
+  assert(sameBase.restore(saved));
+  sameBase.runMachine(10);
+  fromA.runMachine(10);
+  assert(sameBase.getLastNumber() == fromA.getLastNumber());
+
+  // Wrong program, wrong engine, corrupt and truncated files are rejected.
+  std::vector<mpq_class> other = { mpq_class(3, 2) };
+  Fractran stranger(other, 2);
+  assert(!stranger.restore(gmpAt1234.snapshot()));
+  assert(!gmpAt1234.restore(regs.snapshot()));
+  std::string bytes = encodeSnapshot(gmpAt1234.snapshot());
+  std::string corrupt = bytes;
+  corrupt[20] ^= 1;
+  assert(!decodeSnapshot(corrupt, saved, error));
+  assert(!decodeSnapshot(bytes.substr(0, bytes.size() - 3), saved, error));
+
+  // The background writer leaves only the latest snapshot, and no temporary.
+  std::string filename = "temp_snapshot.frsnap";
+  {
+    SnapshotWriter writer(filename);
+    Fractran machine(prog, 2);
+    for (int i = 0; i < 50; ++i) {
+      machine.runMachine(100);
+      writer.submit(machine.snapshot());
+    }
+    assert(writer.finish());
+    assert(writer.lastSteps() == 5000);
+  }
+  assert(readSnapshot(filename, saved, error));
+  assert(saved.steps == 5000 && saved.state == reference.getLastNumber());
+  for (const auto& entry : std::filesystem::directory_iterator(".")) {
+    assert(entry.path().filename().string().rfind(filename + ".", 0) != 0);
+  }
+  std::remove(filename.c_str());
+  assert(!readSnapshot(filename, saved, error));
+  pass("Snapshot and Resume (both engines, atomic background writes)");
+}
+
+void test_parallel_sweep() {
+  std::vector<mpq_class> prog = { mpq_class(7, 15), mpq_class(22, 3), mpq_class(6, 77),
+                                  mpq_class(5, 2), mpq_class(9, 5), mpq_class(3, 2) };
+  const int budget = 3000;
+  std::vector<SweepResult> expected;
+  for (unsigned long n = 1; n <= 200; ++n) {
+    Fractran machine(prog, n);
+    machine.runMachine(budget);
+    SweepResult r;
+    r.index = n - 1;
+    r.input = n;
+    r.steps = machine.getStepCount();
+    r.halted = machine.isHalted();
+    r.final = machine.getLastNumber();
+    expected.push_back(r);
+  }
+
+  // Tiny slices force long inputs to be parked and stolen between workers.
+  SweepOptions options;
+  options.threads = 4;
+  options.maxSteps = budget;
+  options.sliceSteps = 7;
+  options.flushBytes = 64;
+  options.batchLanes = 48;
+  // Engines 3 and 4 rerun the register and batch sweeps on a shared factorization.
+  RegisterProgram factored = buildRegisterProgram(prog);
+  for (int run = 0; run < 5; ++run) {
+    int engine = run < 3 ? run : run - 2;
+    options.factored = run < 3 ? nullptr : &factored;
+    // Odd runs cap the parked runs at one per worker, so parked work goes before fresh inputs.
+    options.parkedPerThread = run % 2 ? 1 : 4;
+    std::ostringstream out;
+    SweepStats stats = engine == 0
+        ? runSweep<Fractran>(prog, SweepInputs::range(1, 200), options, SweepFormat::Binary, out, [](Fractran&) {})
+        : engine == 1
+        ? runSweep<RegisterFractran>(prog, SweepInputs::range(1, 200), options, SweepFormat::Binary, out,
+                                     [](RegisterFractran&) {})
+        : runBatchSweep(prog, SweepInputs::range(1, 200), options, SweepFormat::Binary, out);
+    assert(stats.inputs == 200 && stats.threads == 4);
+
+    std::string bytes = out.str();
+    binary::Reader in(bytes.data(), bytes.size());
+    char magic[sizeof(SWEEP_MAGIC)];
+    assert(in.bytes(magic, sizeof(magic)) && std::string(magic, sizeof(magic)) == std::string(SWEEP_MAGIC, sizeof(SWEEP_MAGIC)));
+    assert(binary::getProgram(in) == prog);
+    std::vector<bool> seen(200, false);
+    SweepResult r;
+    size_t count = 0;
+    while (getSweepRecord(in, r)) {
+      const SweepResult& e = expected[r.index];
+      assert(!seen[r.index]);
+      seen[r.index] = true;
+      assert(r.input == e.input && r.steps == e.steps && r.halted == e.halted && r.final == e.final);
+      count++;
+    }
+    assert(count == 200 && in.atEnd() && !in.failed);
+  }
+
+  // CSV from a list of inputs, on one thread without slicing: rows in input order.
+  std::ostringstream csv;
+  options.threads = 1;
+  options.sliceSteps = budget;
+  options.factored = nullptr;
+  runSweep<Fractran>(prog, SweepInputs::list({mpz_class(5), mpz_class(12)}), options, SweepFormat::Csv, csv,
+                     [](Fractran&) {});
+  std::string rows = "input,steps,halted,final\n";
+  for (unsigned long n : {5UL, 12UL}) {
+    const SweepResult& e = expected[n - 1];
+    rows += e.input.get_str() + "," + std::to_string(e.steps) + (e.halted ? ",1," : ",0,") + e.final.get_str() + "\n";
+  }
+  assert(csv.str() == rows);
+  pass("Parallel Sweep (work stealing, batches, CSV and binary output)");
+}
+
+void test_batch_engine() {
+  // Negative and zero numerators, a denominator with more than four primes,
+  // and inputs that halt, run forever, are zero or negative.
+  std::vector<std::vector<mpq_class>> programs = {
+    { mpq_class(7, 15), mpq_class(22, 3), mpq_class(6, 77), mpq_class(5, 2), mpq_class(9, 5), mpq_class(3, 2) },
+    { mpq_class(13, 2 * 3 * 5 * 7 * 11), mpq_class(-1, 13), mpq_class(3, 2), mpq_class(0, 17) },
+    primeGame()
+  };
+  std::vector<mpz_class> inputs;
+  for (long n = -20; n <= 300; ++n) inputs.push_back(n);
+  inputs.push_back(mpz_class(2 * 3 * 5 * 7 * 11) * 4);
+  inputs.push_back(mpz_class(2) * 17 * 1000003);
+
+  for (const auto& prog : programs) {
+    for (bool vectorized : {true, false}) {
+      BatchFractran batch(prog, inputs);
+      batch.setVectorized(vectorized);
+      std::vector<Fractran> machines;
+      for (const auto& n : inputs) machines.emplace_back(prog, n);
+      for (int chunk : {1, 37, 400}) {
+        batch.runMachine(chunk);
+        for (size_t m = 0; m < inputs.size(); ++m) {
+          machines[m].runMachine(chunk);
+          assert(batch.getStepCount(m) == machines[m].getStepCount());
+          assert(batch.isHalted(m) == machines[m].isHalted());
+          assert(batch.getLastNumber(m) == machines[m].getLastNumber());
+        }
+      }
+      assert(batch.spilledCount() == 0);
+    }
+  }
+
+  // Exponents past the int32 lane range move the machine to RegisterFractran.
+  mpz_class big;
+  mpz_ui_pow_ui(big.get_mpz_t(), 2, 1UL << 18);
+  std::vector<mpq_class> wide = { mpq_class(big, 5), mpq_class(mpz_class(1), big * 7) };
+  mpz_class input;
+  mpz_ui_pow_ui(input.get_mpz_t(), 35, 5000);
+  BatchFractran batch(wide, {input, mpz_class(35)});
+  batch.runMachine(6000);
+  batch.runMachine(6000);
+  assert(batch.spilledCount() == 1 && batch.liveCount() == 0);
+  assert(batch.getStepCount(0) == 10000 && batch.isHalted(0) && batch.getLastNumber(0) == 1);
+  assert(batch.getStepCount(1) == 2 && batch.isHalted(1) && batch.getLastNumber(1) == 1);
+  pass("Batch Engine (lockstep lanes match Fractran, spill to registers)");
+}
+
+void test_jit() {
+  namespace fs = std::filesystem;
+  JitOptions options;
+  options.cacheDir = (fs::temp_directory_path() / ("fractran-jit-test-" + std::to_string(::getpid()))).string();
+
+  std::vector<std::vector<mpq_class>> programs = {
+    primeGame(),
+    { mpq_class(13, 2 * 3 * 5 * 7 * 11), mpq_class(-1, 13), mpq_class(3, 2), mpq_class(0, 17) }
+  };
+  std::vector<mpz_class> inputs = { 2, mpz_class(2 * 3 * 5 * 7 * 11) * 4, mpz_class(-8) * 17, 0 };
+  for (const auto& prog : programs) {
+    for (const auto& input : inputs) {
+      RegisterFractran interpreted(prog, input);
+      RegisterFractran compiled(prog, input);
+      std::string error;
+      assert(compiled.enableJit(error, options) && error.empty());
+      for (int chunk : {1, 5, 1000, 20000}) {
+        interpreted.runMachine(chunk);
+        compiled.runMachine(chunk);
+        assert(compiled.getStepCount() == interpreted.getStepCount());
+        assert(compiled.isHalted() == interpreted.isHalted());
+        assert(compiled.getLastNumber() == interpreted.getLastNumber());
+      }
+    }
+  }
+
+  // The second load of a program finds the library built by the first.
+  std::string error;
+  RegisterProgram prog = buildRegisterProgram(programs[0]);
+  auto first = JitProgram::load(prog, error, options);
+  auto second = JitProgram::load(prog, error, options);
+  assert(first && second && second->fromCache() && first->libraryPath() == second->libraryPath());
+
+  // Threads building the same program at once (a sweep's first inputs) must not share build files.
+  JitOptions fresh = options;
+  fresh.cacheDir += "/concurrent";
+  std::vector<std::shared_ptr<const JitProgram>> loaded(8);
+  std::vector<std::thread> builders;
+  for (size_t t = 0; t < loaded.size(); ++t) {
+    builders.emplace_back([&, t] {
+      std::string reason;
+      loaded[t] = JitProgram::load(prog, reason, fresh);
+    });
+  }
+  for (auto& builder : builders) builder.join();
+  for (const auto& jit : loaded) assert(jit && jit->libraryPath() == loaded[0]->libraryPath());
+  assert(std::distance(fs::directory_iterator(fresh.cacheDir), fs::directory_iterator()) == 1);
+
+  // A cached library that does not load (truncated, another arch) is rebuilt, not trusted.
+  JitOptions stale = options;
+  stale.cacheDir += "/stale";
+  std::string stalePath = JitProgram::load(prog, error, stale)->libraryPath();
+  std::ofstream(stalePath, std::ios::trunc) << "not a shared object";
+  auto rebuilt = JitProgram::load(prog, error, stale);
+  assert(rebuilt && !rebuilt->fromCache() && rebuilt->libraryPath() == stalePath);
+  // A library others could have written is rebuilt too, and a cache directory others can write is refused.
+  rebuilt.reset();
+  fs::permissions(stalePath, fs::perms::others_write, fs::perm_options::add);
+  assert(!JitProgram::load(prog, error, stale)->fromCache());
+  JitOptions exposed = options;
+  exposed.cacheDir += "/exposed";
+  fs::create_directories(exposed.cacheDir);
+  fs::permissions(exposed.cacheDir, fs::perms::group_write | fs::perms::others_write, fs::perm_options::add);
+  assert(!JitProgram::load(prog, error, exposed) && error.find("writable by others") != std::string::npos);
+
+  // Shared code runs any machine on the same register base, and is refused by one whose input refined it.
+  RegisterFractran shared(programs[0], 2), alone(programs[0], 2);
+  assert(shared.useJit(first) && shared.getJit() == first.get());
+  shared.runMachine(5000);
+  alone.runMachine(5000);
+  assert(shared.getLastNumber() == alone.getLastNumber());
+  // 65537 * 65539 is one register until an input of 65537 splits it.
+  std::vector<mpq_class> composite = { mpq_class(mpz_class(3), mpz_class(65537) * 65539), mpq_class(7, 5) };
+  auto coarse = JitProgram::load(buildRegisterProgram(composite), error, options);
+  RegisterFractran refined(composite, 65537 * 5);
+  assert(coarse && !refined.useJit(coarse) && !refined.getJit());
+
+  // No compiler: load fails with a reason, and the machine keeps interpreting.
+  JitOptions broken = options;
+  broken.cacheDir += "/empty";
+  broken.compiler = "/nonexistent/c++";
+  RegisterFractran machine(programs[0], 2);
+  assert(!machine.enableJit(error, broken) && !error.empty() && !machine.getJit());
+  machine.runMachine(100);
+  assert(machine.getStepCount() == 100);
+
+  fs::remove_all(options.cacheDir);
+  pass("JIT (compiled code matches the interpreter, cached by program, built concurrently, shared)");
+}
+
+void test_static_engine() {
+  using PrimeGame = StaticFractran<Frac<17, 91>, Frac<78, 85>, Frac<19, 51>, Frac<23, 38>, Frac<29, 33>,
+                                   Frac<77, 29>, Frac<95, 23>, Frac<77, 19>, Frac<1, 17>, Frac<11, 13>,
+                                   Frac<13, 11>, Frac<15, 2>, Frac<1, 7>, Frac<55, 1>>;
+  static_assert(PrimeGame::REGISTERS == 10, "2, 3, 5, ..., 29");
+  // 6/4 is used as 3/2, like mpq_class would.
+  using Addition = StaticFractran<Frac<6, 4>>;
+
+  for (const mpz_class& input : {mpz_class(2), mpz_class(2 * 31), mpz_class(0)}) {
+    PrimeGame fast(input);
+    Fractran reference(PrimeGame::fractions(), input);
+    for (int chunk : {1, 10, 5000}) {
+      fast.runMachine(chunk);
+      reference.runMachine(chunk);
+      assert(fast.getStepCount() == reference.getStepCount());
+      assert(fast.getLastNumber() == reference.getLastNumber());
+      assert(!fast.isHalted());
+    }
+  }
+
+  Addition add(mpz_class(32 * 27 * 7));
+  add.runMachine(100);
+  assert(add.isHalted() && add.getStepCount() == 5 && add.getLastNumber() == 6561 * 7);
+  assert(Addition::fractions() == std::vector<mpq_class>{mpq_class(3, 2)});
+  pass("Static Engine (compile-time program matches Fractran)");
+}
+
+void test_run_stats() {
+  std::vector<mpq_class> prog = primeGame();
+  for (ArithmeticMode mode : {ArithmeticMode::Reference, ArithmeticMode::Native}) {
+    Fractran plain(prog, 2, false, mode);
+    Fractran machine(prog, 2, false, mode);
+    machine.enableStats(16);
+    plain.runMachine(3000);
+    machine.runMachine(1000);
+    machine.runMachine(2000);
+    assert(machine.getLastNumber() == plain.getLastNumber());
+
+    const RunStats& stats = machine.getStats();
+    if (!STATS_COMPILED_IN) continue;
+    assert(stats.enabled && stats.steps == 3000 && stats.scans == 3000);
+    unsigned long long hits = 0;
+    for (auto h : stats.fractionHits) hits += h;
+    assert(hits == 3000 && stats.fractionHits.size() == prog.size());
+    // Scanning stops at the fraction that fires.
+    unsigned long long scanned = 0;
+    for (size_t f = 0; f < prog.size(); ++f) scanned += stats.fractionHits[f] * (f + 1);
+    assert(stats.fractionsScanned == scanned && stats.averageScanned() > 1);
+    assert(stats.latencySamples == 3000 / 16 + 1 && !stats.growth.empty());
+    unsigned long long sampled = 0;
+    for (auto b : stats.bitsHistogram) sampled += b;
+    assert(sampled == stats.latencySamples);
+  }
+
+  // A halting search scans every fraction once.
+  Fractran halting({mpq_class(3, 2)}, 8);
+  halting.enableStats(1);
+  halting.runMachine(10);
+  if (STATS_COMPILED_IN) {
+    assert(halting.getStats().steps == 3 && halting.getStats().scans == 4 && halting.getStats().fractionsScanned == 4);
+  }
+
+  // Quantile bounds are the bucket tops; the last bucket's is the top of the range.
+  RunStats latencies;
+  latencies.latencyHistogram[3] = 1;
+  latencies.latencyHistogram[RunStats::BUCKETS - 1] = 1;
+  latencies.latencySamples = 2;
+  assert(latencies.latencyQuantile(0.5) == 16);
+  assert(latencies.latencyQuantile(1.0) == std::numeric_limits<unsigned long long>::max());
+  pass("Run Statistics (hits, scan length, sampled size and latency)");
+}
+
+void test_run_limits() {
+  std::vector<mpq_class> prog = primeGame();
+  // The prime game reaches 2^2, 2^3, 2^5 and 2^7 at steps 19, 69, 281 and 710.
+  auto primes = [&](auto& machine) {
+    std::vector<std::uint64_t> exponents, steps;
+    PowerOfPrime<std::decay_t<decltype(machine)>> pow2(machine, prog, 2, 4);
+    pow2.onMatch = [&](std::uint64_t e) {
+      exponents.push_back(e);
+      steps.push_back(machine.getStepCount());
+    };
+    RunLimits limits;
+    limits.observers.push_back(&pow2);
+    assert(machine.run(limits) == StopReason::Predicate);
+    assert((exponents == std::vector<std::uint64_t>{2, 3, 5, 7}));
+    assert((steps == std::vector<std::uint64_t>{19, 69, 281, 710}));
+    assert(machine.getStepCount() == 710 && machine.getLastNumber() == 128);
+  };
+  for (ArithmeticMode mode : {ArithmeticMode::Reference, ArithmeticMode::InPlace, ArithmeticMode::Native}) {
+    Fractran machine(prog, 2, false, mode);
+    primes(machine);
+  }
+  RegisterFractran registers(prog, 2, false);
+  registers.setLoopAcceleration(true); // ignored while observed
+  primes(registers);
+
+  // A run stops right after the third firing of 55/1; history keeps the state before each step.
+  Fractran fired(prog, 2, true);
+  FractionFired third(13, 3);
+  RunLimits limits;
+  limits.steps = 100000;
+  limits.observers.push_back(&third);
+  assert(fired.run(limits) == StopReason::Predicate);
+  std::vector<mpz_class> history = fired.getHistory();
+  history.push_back(fired.getLastNumber());
+  int fires = 0;
+  for (size_t i = 1; i < history.size(); ++i) {
+    if (history[i] == history[i - 1] * 55) fires++;
+  }
+  assert(fires == 3 && history.back() == history[history.size() - 2] * 55);
+  // Without observers the budget or a halt ends the run.
+  limits.observers.clear();
+  limits.steps = 10;
+  assert(fired.run(limits) == StopReason::Budget);
+  Fractran halting({mpq_class(3, 2)}, 8);
+  assert(halting.run(limits) == StopReason::Halted && halting.getStepCount() == 3);
+  assert(halting.run(limits) == StopReason::Halted);
+
+  // Deadlines: one already passed stops before the first step, a near one ends an endless run.
+  auto deadlines = [](auto& machine) {
+    RunLimits timed;
+    timed.deadline = std::chrono::steady_clock::now() - std::chrono::seconds(1);
+    assert(machine.run(timed) == StopReason::Deadline && machine.getStepCount() == 0);
+    timed.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(20);
+    assert(machine.run(timed) == StopReason::Deadline && machine.getStepCount() > 0);
+  };
+  std::vector<mpq_class> forever = {mpq_class(5, 3), mpq_class(3, 5)};
+  Fractran gmpForever(forever, 3, false);
+  RegisterFractran registerForever(forever, 3, false);
+  deadlines(gmpForever);
+  deadlines(registerForever);
+
+  // Budgets past 2^32: 3/2 on 2^5000000000, collapsed by loop acceleration.
+  RegisterFractran adder({mpq_class(3, 2)}, 6, false);
+  adder.setLoopAcceleration(true);
+  Snapshot snap = adder.snapshot();
+  snap.registers[0] = 5000000000LL;
+  assert(adder.restore(snap));
+  adder.runMachine(3000000000ULL);
+  assert(!adder.isHalted() && adder.getStepCount() == 3000000000ULL);
+  assert(adder.run(RunLimits()) == StopReason::Halted && adder.getStepCount() == 5000000000ULL);
+  assert(adder.getRegisters()[0] == 0 && adder.getRegisters()[1] == 5000000001LL);
+  std::uint64_t exponent = 0;
+  assert(adder.isPowerOf(3, exponent) && exponent == 5000000001ULL && !adder.isPowerOf(2, exponent));
+  pass("Run Limits (64-bit budgets, deadlines, power-of-prime and fraction stops)");
+}
+
+void test_step_range() {
+  std::vector<mpq_class> prog = primeGame();
+  for (ArithmeticMode mode : {ArithmeticMode::Reference, ArithmeticMode::InPlace, ArithmeticMode::Native}) {
+    // The lazy states match the recorded history of a batch run.
+    Fractran batch(prog, 2, true, mode);
+    batch.runMachine(500);
+    Fractran lazy(prog, 2, false, mode);
+    size_t i = 0;
+    for (const StepEvent& s : lazy.steps(500)) {
+      i++;
+      assert(s.step == i && s.fraction < prog.size());
+      assert(s.state() == (i < batch.getHistory().size() ? batch.getHistory()[i] : batch.getLastNumber()));
+    }
+    assert(i == 500 && lazy.getStepCount() == 500);
+
+    // Filter and stop as we go: the first three primes, then the machine waits at that step.
+    Fractran primes(prog, 2, false, mode);
+    std::vector<size_t> found;
+    for (const StepEvent& s : primes.steps()) {
+      const mpz_class& state = s.state();
+      if (mpz_popcount(state.get_mpz_t()) != 1) continue;
+      found.push_back(mpz_scan1(state.get_mpz_t(), 0));
+      if (found.size() == 3) break;
+    }
+    assert((found == std::vector<size_t>{2, 3, 5}) && primes.getStepCount() == 281);
+    // A new range continues from there.
+    auto next = primes.steps(10).begin();
+    assert(next->step == 282);
+  }
+
+  // The range ends when the machine halts, and a halted machine yields nothing.
+  Fractran halting({mpq_class(3, 2)}, 8, true);
+  std::vector<std::uint32_t> fired;
+  for (const StepEvent& s : halting.steps()) fired.push_back(s.fraction);
+  assert(fired.size() == 3 && halting.isHalted() && halting.getLastNumber() == 27);
+  assert(halting.getHistory().size() == 4);
+  assert(halting.steps().begin() == halting.steps().end());
+  pass("Step Range (lazy steps and states, early exit, halting)");
+}
+
+void test_program_optimizer() {
+  // Shadowed: 2 divides 6 and the denominator 1 takes everything after it.
+  std::vector<mpq_class> shadowing = { mpq_class(3, 2), mpq_class("9/6"), mpq_class(5, 1), mpq_class(7, 3) };
+  OptimizedProgram pruned = optimizeProgram(shadowing);
+  assert(!pruned.inputPasses && pruned.fractions.size() == 2 && pruned.chains.empty());
+  assert((pruned.shadowed == std::vector<std::pair<size_t, size_t>>{{1, 0}, {3, 2}}));
+  assert((pruned.newIndex == std::vector<long>{0, -1, 1, -1}) && (pruned.unreduced == std::vector<size_t>{1}));
+
+  // Same runs, step counts included, for budgets ending anywhere, inside fused chains too.
+  auto same = [](const std::vector<mpq_class>& prog, const mpz_class& input, const OptimizedProgram& optimized) {
+    for (ArithmeticMode mode : {ArithmeticMode::Reference, ArithmeticMode::InPlace, ArithmeticMode::Native}) {
+      Fractran original(prog, input, false, mode);
+      Fractran fused(optimized.fractions, input, false, mode);
+      if (!optimized.chains.empty()) fused.setFusedChains(optimized.chains);
+      for (std::uint64_t budget : {1, 2, 3, 5, 8, 13, 100, 997, 5000}) {
+        original.runMachine(budget);
+        fused.runMachine(budget);
+        assert(original.getLastNumber() == fused.getLastNumber());
+        assert(original.getStepCount() == fused.getStepCount() && original.isHalted() == fused.isHalted());
+      }
+    }
+  };
+
+  // Prime game: the instruction registers are found and two chains fuse.
+  std::vector<mpq_class> primes = primeGame();
+  mpz_class two = 2;
+  OptimizerOptions options;
+  options.input = &two;
+  OptimizedProgram game = optimizeProgram(primes, options);
+  assert(game.inputPasses && game.removed() == 0 && game.fractions.size() == primes.size());
+  assert((game.control == std::vector<mpz_class>{11, 13, 17, 19, 23, 29}));
+  assert((game.fused == std::vector<std::vector<size_t>>{{3, 6}, {4, 5}}));
+  assert(game.fractions[3] == mpq_class(95, 38) && game.fractions[3].get_den() == 38);
+  same(primes, two, game);
+  assert(estimateSpeedup(primes, game, two) > 1.0);
+
+  // A budget ending inside a chain has no fraction index to record, so sparse
+  // history and traces refuse chains (either way round); full history stays exact.
+  {
+    Fractran original(primes, two, true);
+    original.runMachine(200);
+    Fractran fused(game.fractions, two, true);
+    assert(fused.setFusedChains(game.chains));
+    assert(!fused.enableSparseHistory(4));
+    struct : TraceSink { void onStep(std::uint32_t) override {} } sink;
+    assert(!fused.setTraceSink(&sink) && fused.setTraceSink(nullptr));
+    while (fused.getStepCount() < 200) fused.runMachine(1);
+    assert(fused.getLastNumber() == original.getLastNumber());
+    const std::vector<mpz_class>& reached = original.getHistory();
+    for (const mpz_class& state : fused.getHistory()) {
+      assert(std::find(reached.begin(), reached.end(), state) != reached.end());
+    }
+
+    // The refused chains leave the sparse run on the fractions as given.
+    Fractran plain(game.fractions, two, true);
+    plain.runMachine(60);
+    Fractran sparse(game.fractions, two);
+    assert(sparse.enableSparseHistory(4) && !sparse.setFusedChains(game.chains));
+    for (int i = 0; i < 60; ++i) sparse.runMachine(1);
+    HistoryView view = sparse.historyView();
+    assert(view.size() == plain.getHistory().size());
+    for (size_t i = 0; i < view.size(); ++i) assert(view[i] == plain.getHistory()[i]);
+  }
+
+  // Fibonacci halts; the fused run halts at the same step.
+  std::vector<mpq_class> fibonacci = { mpq_class(1, 143), mpq_class(17, 65), mpq_class(133, 34), mpq_class(17, 19),
+                                       mpq_class(23, 17), mpq_class(2233, 69), mpq_class(23, 29), mpq_class(31, 23),
+                                       mpq_class(74, 341), mpq_class(31, 37), mpq_class(41, 31), mpq_class(129, 287),
+                                       mpq_class(41, 43), mpq_class(13, 41), mpq_class(1, 13), mpq_class(1, 3) };
+  mpz_class input = 78 * 625; // 2^F(5)
+  options.input = &input;
+  OptimizedProgram fib = optimizeProgram(fibonacci, options);
+  assert(fib.removed() == 0 && fib.fused.size() == 4);
+  same(fibonacci, input, fib);
+  Fractran run(fib.fractions, input);
+  run.setFusedChains(fib.chains);
+  run.runMachine(1000000);
+  assert(run.isHalted() && run.getLastNumber() == 32 && run.getStepCount() == 123);
+
+  // Multiplication 2^a 3^b -> 5^ab: 1/143 needs both instruction registers
+  // at once and is dropped; nothing reads the output register.
+  std::vector<mpq_class> multiply = { mpq_class(1, 143), mpq_class(455, 33), mpq_class(11, 13), mpq_class(1, 11),
+                                      mpq_class(3, 7), mpq_class(11, 2), mpq_class(1, 3) };
+  mpz_class factors = 8 * 81;
+  options.input = &factors;
+  OptimizedProgram product = optimizeProgram(multiply, options);
+  assert((product.unreachable == std::vector<size_t>{0}) && product.newIndex[0] == -1);
+  assert((product.unread == std::vector<mpz_class>{5}) && product.fused.size() == 1);
+  same(multiply, factors, product);
+
+  // Without chain fusion nothing needs setFusedChains; a zero input skips the input passes.
+  options.fuse = false;
+  assert(optimizeProgram(fibonacci, options).chains.empty());
+  mpz_class zero = 0;
+  options.input = &zero;
+  assert(!optimizeProgram(fibonacci, options).inputPasses);
+  pass("Program Optimizer (shadowed, unreachable, fused chains, exact step counts)");
+}
+
+void test_program_cache() {
+  std::vector<mpq_class> prog = { mpq_class(17, 91), mpq_class(78, 85), mpq_class(-6, 4), mpq_class(1, 899),
+                                  mpq_class(mpz_class("340282366920938463463374607431768211507"), 29), mpq_class(0, 1) };
+  CompiledProgram compiled;
+  compiled.sourceHash = 42;
+  compiled.sourceSize = 7;
+  compiled.input = "12345678901234567890";
+  compiled.steps = 5000000000ULL;
+  compiled.fractions = prog;
+  compiled.factored = std::make_shared<RegisterProgram>(buildRegisterProgram(prog));
+
+  std::string bytes = encodeCompiledProgram(compiled);
+  CompiledProgram loaded;
+  std::string error;
+  assert(decodeCompiledProgram(bytes.data(), bytes.size(), loaded, error));
+  assert(loaded.sourceHash == 42 && loaded.sourceSize == 7 && loaded.input == compiled.input);
+  assert(loaded.steps == compiled.steps && loaded.fractions == prog && loaded.fractions[2].get_den() == 4);
+  const RegisterProgram& a = *compiled.factored;
+  const RegisterProgram& b = *loaded.factored;
+  assert(a.primes == b.primes && a.scale == b.scale);
+  for (size_t f = 0; f < prog.size(); ++f) {
+    for (auto terms : {std::make_pair(&a.require[f], &b.require[f]), std::make_pair(&a.produce[f], &b.produce[f]),
+                       std::make_pair(&a.delta[f], &b.delta[f])}) {
+      assert(terms.first->size() == terms.second->size());
+      for (size_t t = 0; t < terms.first->size(); ++t) {
+        assert((*terms.first)[t].reg == (*terms.second)[t].reg && (*terms.first)[t].exp == (*terms.second)[t].exp);
+      }
+    }
+  }
+
+  // Any damage fails the checksum; a short file is not a program cache at all.
+  bytes[bytes.size() / 2] ^= 1;
+  assert(!decodeCompiledProgram(bytes.data(), bytes.size(), loaded, error) && error.find("checksum") != std::string::npos);
+  assert(!decodeCompiledProgram(bytes.data(), 4, loaded, error));
+
+  // The register engine on the stored factorization runs like it would on its own,
+  // including an input that needs the register base refined (65537 * 65539 is
+  // one register until the input splits it).
+  std::vector<mpq_class> game = primeGame();
+  RegisterProgram factored = buildRegisterProgram(game);
+  RegisterFractran own(game, 2), shared(game, 2, false, &factored);
+  own.runMachine(5000);
+  shared.runMachine(5000);
+  assert(own.getLastNumber() == shared.getLastNumber() && own.getStepCount() == shared.getStepCount());
+  mpz_class joined = mpz_class(65537) * 65539;
+  std::vector<mpq_class> composite = { mpq_class(mpz_class(3), joined), mpq_class(7, 5) };
+  RegisterProgram coarse = buildRegisterProgram(composite);
+  assert(coarse.primes.back() == joined);
+  RegisterFractran refined(composite, 65537 * 5, false, &coarse);
+  refined.runMachine(10);
+  assert(refined.getProgram().primes.size() == coarse.primes.size() + 1);
+  assert(refined.getLastNumber() == 65537 * 7 && refined.getStepCount() == 1 && refined.isHalted());
+
+  // Concurrent writers of one cache each use their own temporary: the file that lands is one whole write.
+  std::string path = "temp_concurrent.fracc";
+  std::vector<std::string> contents;
+  for (int w = 0; w < 8; ++w) contents.push_back(std::string(4096 * (w + 1), static_cast<char>('a' + w)));
+  std::vector<std::thread> writers;
+  for (int w = 0; w < 8; ++w) {
+    writers.emplace_back([&, w] {
+      for (int round = 0; round < 20; ++round) assert(writeFileAtomic(path, contents[w]));
+    });
+  }
+  for (auto& writer : writers) writer.join();
+  std::ifstream landed(path, std::ios::binary);
+  std::string written((std::istreambuf_iterator<char>(landed)), std::istreambuf_iterator<char>());
+  assert(std::find(contents.begin(), contents.end(), written) != contents.end());
+  std::remove(path.c_str());
+  for (const auto& entry : std::filesystem::directory_iterator(".")) {
+    assert(entry.path().filename().string().rfind(path + ".", 0) != 0);
+  }
+  pass("Program Cache (.fracc round trip, checksum, shared factorization, concurrent writers)");
+}
+
+void test_output_writer() {
+  // A tiny queue wraps and fills constantly; the consumer must still see every value in order.
+  SpscQueue<std::uint64_t> queue(5);
+  assert(queue.capacity() == 8);
+  const std::uint64_t count = 200000;
+  std::thread producer([&] {
+    for (std::uint64_t i = 0; i < count; ++i) {
+      while (!queue.tryPush(i)) std::this_thread::yield();
+    }
+  });
+  std::uint64_t expected = 0, value = 0;
+  while (expected < count) {
+    if (queue.tryPop(value)) {
+      assert(value == expected);
+      expected++;
+    }
+  }
+  producer.join();
+  assert(!queue.tryPop(value));
+
+  // The prime game streamed through the writer, one prime per line.
+  std::vector<mpq_class> prog = primeGame();
+  std::FILE* file = std::tmpfile();
+  assert(file);
+  {
+    AsyncWriter<std::uint64_t> out(file, [](const std::uint64_t& p, std::string& text) {
+      text += std::to_string(p);
+      text += '\n';
+    }, 4);
+    Fractran machine(prog, 2, false);
+    PowerOfPrime<Fractran> primes(machine, prog, 2, 10);
+    primes.onMatch = [&out](std::uint64_t e) { out.push(e); };
+    RunLimits limits;
+    limits.observers.push_back(&primes);
+    assert(machine.run(limits) == StopReason::Predicate);
+    assert(out.close() && out.eventsPushed() == 10 && out.batchesWritten() >= 1);
+  }
+  // Many small events, flushed whenever 64 bytes have piled up.
+  {
+    AsyncWriter<std::uint64_t> out(file, [](const std::uint64_t& i, std::string& text) {
+      text += std::to_string(i % 10);
+    }, 16, 64);
+    for (std::uint64_t i = 0; i < 10000; ++i) out.push(i);
+    assert(out.close());
+  }
+  std::rewind(file);
+  std::string text;
+  char chunk[4096];
+  size_t n;
+  while ((n = std::fread(chunk, 1, sizeof(chunk), file)) > 0) text.append(chunk, n);
+  std::fclose(file);
+  std::string digits;
+  for (int i = 0; i < 10000; ++i) digits += static_cast<char>('0' + i % 10);
+  assert(text == "2\n3\n5\n7\n11\n13\n17\n19\n23\n29\n" + digits);
+
+  // printSequence's buffered formatting matches the per-state output it replaced.
+  std::vector<mpz_class> states = { 2, 15, mpz_class("340282366920938463463374607431768211507"), 0 };
+  std::ostringstream sequence;
+  writeSequence(sequence, states, true);
+  writeSequence(sequence, std::vector<mpz_class>{}, false);
+  assert(sequence.str() == "2, 15, 340282366920938463463374607431768211507, 0, HALT\n...\n");
+  pass("Output Writer (SPSC queue order, streamed primes, batched flushes, printSequence format)");
+}
+
+void test_state_notation() {
+  auto capture = [](auto print) {
+    std::ostringstream out;
+    std::streambuf* saved = std::cout.rdbuf(out.rdbuf());
+    print();
+    std::cout.rdbuf(saved);
+    return out.str();
+  };
+  std::vector<mpz_class> bases = { 2, 3, 5 };
+  assert(factoredString(bases, {3, 0, 1}, 143) == "2^3 * 5 * [143]");
+  assert(factoredString(bases, {0, 2, 0}, -1) == "-3^2");
+  assert(factoredString(bases, {0, 0, 0}, 1) == "1");
+  assert(factoredString(bases, {0, 0, 0}, 7) == "[7]");
+  assert(factoredString(bases, {4, 0, 0}, 0) == "0");
+
+  // A cofactor the program never touches stays in brackets.
+  std::vector<mpq_class> halve = { mpq_class(3, 2) };
+  Fractran gmp(halve, 224, true);
+  gmp.runMachine(10);
+  RegisterFractran registers(halve, 224, true);
+  registers.runMachine(10);
+  std::string expected = "2^5 * [7], 2^4 * 3 * [7], 2^3 * 3^2 * [7], 2^2 * 3^3 * [7], 2 * 3^4 * [7], 3^5 * [7], HALT\n";
+  assert(capture([&] { gmp.printSequence(Notation::Factored); }) == expected);
+  assert(capture([&] { registers.printSequence(Notation::Factored); }) == expected);
+
+  // Negative and zero numerators.
+  Fractran negative({ mpq_class(-1, 2) }, 4, true);
+  negative.runMachine(10);
+  assert(capture([&] { negative.printSequence(Notation::Factored); }) == "2^2, -2, 1, HALT\n");
+  Fractran zero({ mpq_class(0, 3), mpq_class(1, 2) }, 6, true);
+  zero.runMachine(2);
+  assert(capture([&] { zero.printSequence(Notation::Factored); }) == "2 * 3, 0, ...\n");
+
+  // The prime game replayed on exponents matches every state of the run, in
+  // full and sparse history, and both engines write the same stream.
+  std::vector<mpq_class> prog = primeGame();
+  Fractran full(prog, 2, true);
+  full.runMachine(2000);
+  Fractran sparse(prog, 2, true);
+  sparse.enableSparseHistory(64);
+  sparse.runMachine(2000);
+  RegisterFractran factored(prog, 2, true);
+  factored.runMachine(2000);
+  std::string stream = capture([&] { full.printSequence(Notation::Binary); });
+  assert(capture([&] { sparse.printSequence(Notation::Binary); }) == stream);
+  assert(capture([&] { factored.printSequence(Notation::Binary); }) == stream);
+  assert(capture([&] { full.printSequence(Notation::Factored); }) ==
+         capture([&] { factored.printSequence(Notation::Factored); }));
+
+  StateStream states;
+  assert(readStateStream(stream.data(), stream.size(), states));
+  const std::vector<mpz_class>& history = full.getHistory();
+  assert(states.exps.size() == history.size() && !states.halted);
+  RegisterProgram base;
+  base.primes = states.bases;
+  for (size_t i = 0; i < history.size(); ++i) assert(base.decode(states.exps[i], states.cofactors[i]) == history[i]);
+  assert(!readStateStream(stream.data(), stream.size() - 1, states));
+
+  // Without history the stream holds the final state only.
+  Fractran last(prog, 2, false);
+  last.runMachine(2000);
+  std::string single = capture([&] { last.printSequence(Notation::Binary); });
+  assert(readStateStream(single.data(), single.size(), states) && states.exps.size() == 1);
+  assert(base.decode(states.exps[0], states.cofactors[0]) == last.getLastNumber());
+  std::string text = capture([&] { last.printSequence(Notation::Factored); });
+  assert(text.find("Final Value: " + factoredString(states.bases, states.exps[0], states.cofactors[0]) + "\n") !=
+         std::string::npos);
+  pass("State Notation (factored text, FRSTATE1 stream, replay matches history)");
+}
+
+void test_limb_pool() {
+  std::vector<mpq_class> prog = primeGame();
+  Fractran reference(prog, 2, true);
+  reference.runMachine(3100);
+  const std::vector<mpz_class>& expected = reference.getHistory();
+  auto sortedSweep = [&](unsigned threads) {
+    SweepOptions options;
+    options.threads = threads;
+    options.maxSteps = 5000;
+    options.sliceSteps = 100;
+    std::ostringstream out;
+    runSweep<Fractran>(prog, SweepInputs::range(2, 60), options, SweepFormat::Csv, out, [](Fractran&) {});
+    std::vector<std::string> rows;
+    std::istringstream lines(out.str());
+    for (std::string line; std::getline(lines, line);) rows.push_back(line);
+    std::sort(rows.begin(), rows.end());
+    return rows;
+  };
+  std::vector<std::string> sweepRows = sortedSweep(1);
+
+  // GMP's allocator can only change before it allocates, so the pool runs in
+  // a child. Nothing allocated before the fork is freed there.
+  pid_t pid = fork();
+  if (pid == 0) {
+    limb_pool::install();
+    bool ok = true;
+    {
+      Fractran machine(prog, 2, true);
+      machine.runMachine(3000);
+      const limb_pool::Stats& stats = limb_pool::stats();
+      ok = ok && std::equal(expected.begin(), expected.begin() + 3000, machine.getHistory().begin());
+      ok = ok && machine.getHistoryArena() && machine.getHistoryArena()->chunkCount() >= 1;
+      ok = ok && stats.arenaAllocations >= 3000;
+
+      // A copy allocates its own entries; a move takes the arena along;
+      // assignments keep each arena alive until its entries are gone.
+      Fractran copy = machine;
+      Fractran moved = std::move(machine);
+      copy.runMachine(100);
+      moved.runMachine(100);
+      ok = ok && copy.getHistory() == expected && moved.getHistory() == expected;
+      moved = copy;
+      copy = Fractran(prog, 3, true);
+      copy.runMachine(10);
+      ok = ok && moved.getHistory() == expected && copy.getHistory().size() == 10;
+      moved.enableSparseHistory(64);
+      ok = ok && moved.getHistoryArena() == nullptr;
+
+      // Reference mode builds temporaries on every step; the pool recycles them.
+      std::uint64_t before = stats.systemAllocations;
+      Fractran plain(prog, 2, false, ArithmeticMode::Reference);
+      plain.runMachine(1000);
+      ok = ok && plain.getHistoryArena() == nullptr && plain.getLastNumber() == expected[1000];
+      ok = ok && stats.poolHits > 1000 && stats.systemAllocations - before < 100;
+
+      // Large blocks, and reallocs across every kind.
+      mpz_class big;
+      mpz_ui_pow_ui(big.get_mpz_t(), 3, 200000);
+      big *= big;
+      ok = ok && big % 3 == 0 && mpz_sizeinbase(big.get_mpz_t(), 3) == 400001;
+      mpz_realloc2(big.get_mpz_t(), 64);
+      ok = ok && big == 0;
+
+      // Worker threads have pools of their own.
+      ok = ok && sortedSweep(4) == sweepRows;
+    }
+    _exit(ok ? 0 : 1);
+  }
+  int status = 0;
+  assert(pid > 0 && waitpid(pid, &status, 0) == pid);
+  assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  pass("Limb Pool (pooled and arena-backed GMP limbs, copies and moves, worker threads)");
+}
 
 int main() {
     std::cout << "Running Fractran Test Suite..." << std::endl;
@@ -194,6 +1447,31 @@ int main() {
     test_BBf17();
     test_BBf20();
     //test_BBf21();
+    test_arithmetic_modes_agree();
+    test_native_promotion_and_demotion();
+    test_register_engine_matches_gmp();
+    test_register_engine_cofactor();
+    test_register_engine_large_primes();
+    test_dispatch_index();
+    test_simd_kernels();
+    test_loop_acceleration();
+    test_macro_cache();
+    test_cycle_detection();
+    test_trace_round_trip();
+    test_sparse_history();
+    test_snapshot_resume();
+    test_parallel_sweep();
+    test_batch_engine();
+    test_jit();
+    test_static_engine();
+    test_run_stats();
+  test_run_limits();
+  test_step_range();
+  test_program_optimizer();
+  test_program_cache();
+  test_output_writer();
+  test_state_notation();
+  test_limb_pool();
 
     std::cout << "------------------------------" << std::endl;
     std::cout << "All tests passed successfully." << std::endl;
@@ -0,0 +1,152 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <gmpxx.h>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "binary_io.h"
+
+// Receives each step of a machine as it happens, instead of the machine
+// keeping a history. `fraction` is the index of the fraction applied.
+class TraceSink {
+public:
+    virtual ~TraceSink() = default;
+    virtual void onStep(std::uint32_t fraction) = 0;
+};
+
+// Trace file layout:
+//   "FRTRACE1"                       magic
+//   program                          binary::putProgram
+//   initial state                    binary::putMpz
+//   one varint per step              index of the fraction applied
+// The state at any step is recovered by replaying the indices, so a record
+// is usually a single byte, and the file can be memory-mapped and decoded
+// front to back.
+constexpr char TRACE_MAGIC[8] = {'F', 'R', 'T', 'R', 'A', 'C', 'E', '1'};
+
+// Streams a trace to disk through a fixed-size buffer, so memory stays flat
+// however long the run is.
+class TraceWriter : public TraceSink {
+public:
+    TraceWriter(const std::string& path, const std::vector<mpq_class>& program, const mpz_class& input,
+                size_t bufferBytes = 1 << 16)
+        : capacity(bufferBytes < 16 ? 16 : bufferBytes) {
+        file = std::fopen(path.c_str(), "wb");
+        if (!file) return;
+        std::setvbuf(file, nullptr, _IONBF, 0); // `buffer` is the only write buffer
+        std::string header(TRACE_MAGIC, sizeof(TRACE_MAGIC));
+        binary::putProgram(header, program);
+        binary::putMpz(header, input);
+        ok = std::fwrite(header.data(), 1, header.size(), file) == header.size();
+        buffer.resize(capacity);
+    }
+
+    ~TraceWriter() override { close(); }
+
+    TraceWriter(const TraceWriter&) = delete;
+    TraceWriter& operator=(const TraceWriter&) = delete;
+
+    bool good() const { return ok; }
+    unsigned long long stepsWritten() const { return steps; }
+
+    void onStep(std::uint32_t fraction) override {
+        if (used + 10 > capacity) flush();
+        used += binary::encodeVarint(fraction, &buffer[used]);
+        steps++;
+    }
+
+    void flush() {
+        if (!file) return;
+        if (used > 0 && std::fwrite(buffer.data(), 1, used, file) != used) ok = false;
+        used = 0;
+    }
+
+    void close() {
+        if (!file) return;
+        flush();
+        if (std::fclose(file) != 0) ok = false;
+        file = nullptr;
+    }
+
+private:
+    std::FILE* file = nullptr;
+    std::vector<unsigned char> buffer;
+    size_t capacity;
+    size_t used = 0;
+    unsigned long long steps = 0;
+    bool ok = false;
+};
+
+// Memory-maps a trace file and decodes it front to back.
+class TraceReader {
+public:
+    explicit TraceReader(const std::string& path) : in(nullptr, 0) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) { error = "cannot open " + path; return; }
+        struct stat st;
+        if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+            size = static_cast<size_t>(st.st_size);
+            void* p = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) data = p;
+        }
+        ::close(fd);
+        if (!data) { error = "cannot map " + path; return; }
+
+        in = binary::Reader(data, size);
+        char magic[sizeof(TRACE_MAGIC)];
+        if (!in.bytes(magic, sizeof(magic)) || std::string(magic, sizeof(magic)) != std::string(TRACE_MAGIC, sizeof(TRACE_MAGIC))) {
+            error = path + " is not a FRACTRAN trace";
+            return;
+        }
+        fractions = binary::getProgram(in);
+        initial = in.mpz();
+        if (in.failed) error = path + ": corrupt trace (truncated header or invalid fraction)";
+    }
+
+    ~TraceReader() {
+        if (data) ::munmap(data, size);
+    }
+
+    TraceReader(const TraceReader&) = delete;
+    TraceReader& operator=(const TraceReader&) = delete;
+
+    bool good() const { return error.empty(); }
+    const std::string& errorMessage() const { return error; }
+    const std::vector<mpq_class>& program() const { return fractions; }
+    const mpz_class& initialState() const { return initial; }
+
+    // Next fraction index; false at the end of the trace (or on a bad record).
+    bool next(std::uint32_t& fraction) {
+        if (!good() || in.atEnd()) return false;
+        std::uint64_t v = in.varint();
+        if (in.failed || v >= fractions.size()) {
+            error = "corrupt step record";
+            return false;
+        }
+        fraction = static_cast<std::uint32_t>(v);
+        return true;
+    }
+
+    // Applies fraction `fraction` of the program to `state`.
+    void apply(mpz_class& state, std::uint32_t fraction) const {
+        const mpq_class& frac = fractions[fraction];
+        mpz_divexact(state.get_mpz_t(), state.get_mpz_t(), frac.get_den_mpz_t());
+        mpz_mul(state.get_mpz_t(), state.get_mpz_t(), frac.get_num_mpz_t());
+    }
+
+private:
+    void* data = nullptr;
+    size_t size = 0;
+    binary::Reader in;
+    std::vector<mpq_class> fractions;
+    mpz_class initial;
+    std::string error;
+};
+
+#endif // TRACE_H
@@ -0,0 +1,60 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include "trace.h"
+
+// Decodes a trace written by `fractran --trace=FILE`.
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cout << "Usage: " << argv[0] << " <trace> [--summary|--fractions|--states|--final]\n";
+        return 1;
+    }
+    std::string mode = (argc > 2) ? argv[2] : "--summary";
+    if (mode != "--summary" && mode != "--fractions" && mode != "--states" && mode != "--final") {
+        std::cerr << "Error: Unknown mode: " << mode << std::endl;
+        return 1;
+    }
+
+    TraceReader trace(argv[1]);
+    if (!trace.good()) {
+        std::cerr << "Error: " << trace.errorMessage() << std::endl;
+        return 1;
+    }
+
+    mpz_class state = trace.initialState();
+    std::vector<unsigned long long> hits(trace.program().size(), 0);
+    unsigned long long steps = 0;
+    bool replay = (mode != "--fractions");
+
+    if (mode == "--states") std::cout << state;
+    std::uint32_t fraction;
+    while (trace.next(fraction)) {
+        steps++;
+        hits[fraction]++;
+        if (mode == "--fractions") {
+            std::cout << fraction << "\n";
+            continue;
+        }
+        if (replay) trace.apply(state, fraction);
+        if (mode == "--states") std::cout << ", " << state;
+    }
+    if (mode == "--states") std::cout << std::endl;
+
+    if (!trace.good()) {
+        std::cerr << "Error: " << trace.errorMessage() << " after " << steps << " steps" << std::endl;
+        return 1;
+    }
+
+    if (mode == "--final") {
+        std::cout << state << std::endl;
+    } else if (mode == "--summary") {
+        std::cout << "Fractions: " << trace.program().size() << std::endl;
+        std::cout << "Input:     " << trace.initialState() << std::endl;
+        std::cout << "Steps:     " << steps << std::endl;
+        std::cout << "Final Bits: " << mpz_sizeinbase(state.get_mpz_t(), 2) << std::endl;
+        for (size_t f = 0; f < hits.size(); ++f) {
+            std::cout << "  [" << f << "] " << trace.program()[f] << ": " << hits[f] << std::endl;
+        }
+    }
+    return 0;
+}